@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+#include "time_utils.h"
+
+using namespace std;
+
+// what the benchmarks share so every latency they report is summarized the same way: a case's samples end a csv row as
+// count,p50_ns,p99_ns,p99.9_ns,max_ns (LATENCY_CSV_COLUMNS), so rows from two builds can be diffed column by column
+
+constexpr const char *LATENCY_CSV_COLUMNS = "count,p50_ns,p99_ns,p99.9_ns,max_ns";
+
+// nearest rank percentile of sorted samples, 0 without any
+inline auto percentile(const vector<Common::Nanos> &sorted, double p) -> Common::Nanos {
+    if(sorted.empty()) {
+        return 0;
+    }
+    const auto rank = max<size_t>(static_cast<size_t>(ceil(p * static_cast<double>(sorted.size()))), 1) - 1;
+    return sorted[rank];
+}
+
+// one latency per operation, reserved up front so recording does not allocate in the timed loop
+struct LatencySamples {
+    explicit LatencySamples(size_t expected = 0) {
+        samples_.reserve(expected);
+    }
+
+    auto record(Common::Nanos value) noexcept {
+        samples_.push_back(value);
+    }
+
+    auto count() const noexcept {
+        return samples_.size();
+    }
+
+    // the LATENCY_CSV_COLUMNS of a row
+    auto toCsv() {
+        sort(samples_.begin(), samples_.end());
+        stringstream ss;
+        ss << samples_.size() << "," << percentile(samples_, 0.5) << "," << percentile(samples_, 0.99) << ","
+           << percentile(samples_, 0.999) << "," << (samples_.empty() ? 0 : samples_.back());
+
+        return ss.str();
+    }
+
+    vector<Common::Nanos> samples_;
+};
@@ -0,0 +1,92 @@
+#include "time_utils.h"
+#include "tsc_clock.h"
+#include "bench_utils.h"
+
+using namespace std;
+using namespace Common;
+
+// per call cost of the ways we can take a timestamp
+// each clock is called in a tight loop and the loop is timed as a whole, the results are summed so the calls are not optimized out
+// then the spread: groups of CALLS_PER_SAMPLE calls timed with rdtscp, a percentile row of the per call cost in each group,
+// the group amortizes the rdtscp pair around it and a preemption or a slow vDSO path shows up in the tail
+
+constexpr size_t CALLS_PER_SAMPLE = 16;
+
+template<typename F>
+auto timeCalls(size_t iterations, F &&f) {
+    uint64_t sink = 0;
+    const auto start = getCurrentNanos();
+    for(size_t i = 0; i < iterations; ++i) {
+        sink += static_cast<uint64_t>(f());
+    }
+    const auto elapsed = getCurrentNanos() - start;
+    asm volatile("" : : "r"(sink));
+    return static_cast<double>(elapsed) / iterations;
+}
+
+template<typename F>
+auto sampleCalls(size_t iterations, F &&f) {
+    const auto &clock = TSCClock::instance();
+    LatencySamples samples(iterations / CALLS_PER_SAMPLE);
+    uint64_t sink = 0;
+    for(size_t i = 0; i < iterations / CALLS_PER_SAMPLE; ++i) {
+        const auto start = TSCClock::ticksOrdered();
+        for(size_t j = 0; j < CALLS_PER_SAMPLE; ++j) {
+            sink += static_cast<uint64_t>(f());
+        }
+        samples.record(clock.ticksToNanos(TSCClock::ticksOrdered() - start) / static_cast<Nanos>(CALLS_PER_SAMPLE));
+    }
+    asm volatile("" : : "r"(sink));
+    return samples.toCsv();
+}
+
+// offset between the two clocks, best of several back to back readings so a preemption in between does not show up as drift
+auto tscMinusChrono() {
+    Nanos best_window = INT64_MAX, offset = 0;
+    for(int i = 0; i < 16; ++i) {
+        const auto before = getCurrentNanos();
+        const auto tsc = getTSCNanos();
+        const auto after = getCurrentNanos();
+        if(after - before < best_window) {
+            best_window = after - before;
+            offset = tsc - (before + after) / 2;
+        }
+    }
+    return offset;
+}
+
+auto clockGettime(clockid_t clock_id) {
+    timespec ts;
+    clock_gettime(clock_id, &ts);
+    return ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    const size_t iterations = (argc > 1 ? stoul(argv[1]) : 10'000'000);
+    auto &tsc_clock = TSCClock::instance();
+
+    cout << "invariant_tsc:" << tsc_clock.isInvariantTSC() << " nanos_per_tick:" << tsc_clock.nanosPerTick()
+         << " tsc_minus_chrono_ns:" << tscMinusChrono() << endl;
+
+    cout << "clock,iterations,ns_per_call" << endl;
+    cout << "getCurrentNanos," << iterations << "," << timeCalls(iterations, []() { return getCurrentNanos(); }) << endl;
+    cout << "clock_gettime_realtime," << iterations << "," << timeCalls(iterations, []() { return clockGettime(CLOCK_REALTIME); }) << endl;
+    cout << "clock_gettime_monotonic_raw," << iterations << "," << timeCalls(iterations, []() { return clockGettime(CLOCK_MONOTONIC_RAW); }) << endl;
+    cout << "rdtsc," << iterations << "," << timeCalls(iterations, []() { return TSCClock::ticks(); }) << endl;
+    cout << "rdtscp," << iterations << "," << timeCalls(iterations, []() { return TSCClock::ticksOrdered(); }) << endl;
+    cout << "getTSCNanos," << iterations << "," << timeCalls(iterations, []() { return getTSCNanos(); }) << endl;
+
+    cout << "clock,calls_per_sample," << LATENCY_CSV_COLUMNS << endl;
+    cout << "getCurrentNanos," << CALLS_PER_SAMPLE << "," << sampleCalls(iterations, []() { return getCurrentNanos(); }) << endl;
+    cout << "clock_gettime_realtime," << CALLS_PER_SAMPLE << "," << sampleCalls(iterations, []() { return clockGettime(CLOCK_REALTIME); }) << endl;
+    cout << "rdtsc," << CALLS_PER_SAMPLE << "," << sampleCalls(iterations, []() { return TSCClock::ticks(); }) << endl;
+    cout << "getTSCNanos," << CALLS_PER_SAMPLE << "," << sampleCalls(iterations, []() { return getTSCNanos(); }) << endl;
+
+    // offset of the TSC clock from the system clock while it is recalibrated in the background
+    tsc_clock.startRecalibrationThread(100 * NANOS_TO_MILLIS);
+    for(int i = 0; i < 5; ++i) {
+        this_thread::sleep_for(chrono::milliseconds(200));
+        cout << "tsc_minus_chrono_ns:" << tscMinusChrono() << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "time_utils.h"
+#include "tcp_framing.h"
+
+#include <random>
+
+using namespace std;
+using namespace Common;
+
+// parsing throughput of FrameCodec::decode() on a synthetic stream of three message types, in messages/sec
+// the stream is encoded once, then fed into a socket's inbound ring the way reads would fill it:
+// - bulk:     64KB at a time, nearly every frame is complete when decode() runs
+// - segments: 1448 bytes at a time (a TCP segment on ethernet), frames straddle reads and wait for their tail
+// each feed is decoded by FrameCodec, in place with its checks and sequencing, and by a hand rolled switch that copies
+// every frame out into a local message and does nothing else, the floor the framing layer is measured against
+// the feed memcpy stands in for recv() and is in both
+
+constexpr size_t NUM_MSGS = 10 * 1000 * 1000;
+constexpr size_t BULK_READ = 64 * 1024;
+constexpr size_t SEGMENT_READ = 1448;
+
+#pragma pack(push, 1)
+struct NewOrderMsg {
+    static constexpr uint16_t MSG_TYPE = 1;
+    FrameHeader header_;
+    uint64_t order_id_;
+    int64_t price_;
+    uint32_t qty_;
+    char side_;
+};
+
+struct CancelMsg {
+    static constexpr uint16_t MSG_TYPE = 2;
+    FrameHeader header_;
+    uint64_t order_id_;
+};
+
+struct HeartbeatMsg {
+    static constexpr uint16_t MSG_TYPE = 3;
+    FrameHeader header_;
+};
+#pragma pack(pop)
+
+using Protocol = FrameCodec<NewOrderMsg, CancelMsg, HeartbeatMsg>;
+
+// 70% new orders, 25% cancels, 5% heartbeats
+auto encodeStream(Logger &logger) {
+    TCPSocket encoder(logger);
+    vector<char> stream;
+    mt19937 rng(42);
+    for(size_t i = 0; i < NUM_MSGS; ++i) {
+        const auto pick = rng() % 100;
+        if(pick < 70) {
+            auto msg = Protocol::getNextToWriteTo<NewOrderMsg>(&encoder);
+            msg->order_id_ = i;
+            msg->price_ = 100 + static_cast<int64_t>(rng() % 10);
+            msg->qty_ = 1 + rng() % 100;
+            msg->side_ = (pick & 1 ? 'B' : 'S');
+            Protocol::updateWriteIndex<NewOrderMsg>(&encoder);
+        } else if(pick < 95) {
+            auto msg = Protocol::getNextToWriteTo<CancelMsg>(&encoder);
+            msg->order_id_ = i / 2;
+            Protocol::updateWriteIndex<CancelMsg>(&encoder);
+        } else {
+            Protocol::getNextToWriteTo<HeartbeatMsg>(&encoder);
+            Protocol::updateWriteIndex<HeartbeatMsg>(&encoder);
+        }
+        auto &outbound = encoder.outbound_data_;
+        if(outbound.readable() > outbound.capacity() / 2 || i + 1 == NUM_MSGS) {
+            stream.insert(stream.end(), outbound.readPtr(), outbound.readPtr() + outbound.readable());
+            outbound.consume(outbound.readable());
+        }
+    }
+    return stream;
+}
+
+// the handlers fold what they see into a checksum so none of the work can be optimized out
+struct Sink {
+    uint64_t sum_ = 0;
+    uint64_t msgs_ = 0;
+
+    auto operator()(const NewOrderMsg &msg) noexcept {
+        sum_ += msg.order_id_ + static_cast<uint64_t>(msg.price_) * msg.qty_ + static_cast<uint64_t>(msg.side_);
+        ++msgs_;
+    }
+
+    auto operator()(const CancelMsg &msg) noexcept {
+        sum_ += msg.order_id_;
+        ++msgs_;
+    }
+
+    auto operator()(const HeartbeatMsg &) noexcept {
+        ++msgs_;
+    }
+};
+
+// no length checks, unknown types or sequencing
+auto decodeHandRolled(TCPSocket *socket, Sink &sink) {
+    auto &inbound = socket->inbound_data_;
+    while(inbound.readable() >= sizeof(FrameHeader)) {
+        FrameHeader header;
+        memcpy(&header, inbound.readPtr(), sizeof(header));
+        if(inbound.readable() < header.length_) {
+            break;
+        }
+        switch(header.type_) {
+            case NewOrderMsg::MSG_TYPE: {
+                NewOrderMsg msg;
+                memcpy(&msg, inbound.readPtr(), sizeof(msg));
+                sink(msg);
+                break;
+            }
+            case CancelMsg::MSG_TYPE: {
+                CancelMsg msg;
+                memcpy(&msg, inbound.readPtr(), sizeof(msg));
+                sink(msg);
+                break;
+            }
+            case HeartbeatMsg::MSG_TYPE: {
+                HeartbeatMsg msg;
+                memcpy(&msg, inbound.readPtr(), sizeof(msg));
+                sink(msg);
+                break;
+            }
+        }
+        inbound.consume(header.length_);
+    }
+}
+
+template<bool Codec>
+auto run(Logger &logger, const vector<char> &stream, size_t read_size) {
+    TCPSocket socket(logger);
+    Sink sink;
+    auto &inbound = socket.inbound_data_;
+
+    const auto start = getCurrentNanos();
+    for(size_t offset = 0; offset < stream.size();) {
+        const auto n = min({read_size, stream.size() - offset, inbound.writable()});
+        memcpy(inbound.writePtr(), stream.data() + offset, n);
+        inbound.commit(n);
+        offset += n;
+        if constexpr (Codec) {
+            ASSERT(Protocol::decode(&socket, sink), "decode() found a malformed stream.");
+        } else {
+            decodeHandRolled(&socket, sink);
+        }
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    ASSERT(sink.msgs_ == NUM_MSGS && inbound.empty(), "Decoded " + to_string(sink.msgs_) + " of " + to_string(NUM_MSGS) + " messages.");
+    if constexpr (Codec) {
+        ASSERT(socket.frames_.sequence_gaps_ == 0, "Sequence gaps in a gapless stream. " + socket.frames_.toString());
+    }
+    asm volatile("" : : "r"(sink.sum_));
+    return static_cast<double>(NUM_MSGS) / (static_cast<double>(elapsed) / NANOS_TO_SECS);
+}
+
+int main(int, char **) {
+    Logger logger("frame_decode_benchmark.log");
+    const auto stream = encodeStream(logger);
+
+    cout << "feed,decoder,msgs_per_sec,bytes_per_msg" << endl;
+    for(const auto &[feed, read_size] : {pair{"bulk", BULK_READ}, pair{"segments", SEGMENT_READ}}) {
+        const auto bytes_per_msg = static_cast<double>(stream.size()) / NUM_MSGS;
+        cout << feed << ",frame_codec," << run<true>(logger, stream, read_size) << "," << bytes_per_msg << endl;
+        cout << feed << ",hand_rolled," << run<false>(logger, stream, read_size) << "," << bytes_per_msg << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "thread_utils.h"
+#include "time_utils.h"
+#include "tsc_clock.h"
+#include "lf_queue.h"
+#include "bench_utils.h"
+
+using namespace std;
+using namespace Common;
+
+// single producer single consumer handoff between two threads on their own cores, LFQueue vs SPSCLFQueue:
+// - pingpong:   one message to the other thread and one back, over a queue each way, timed per round trip with the TSC,
+//               twice the one way handoff latency including the cache line transfers both ways
+// - throughput: a stream of messages one way, as fast as the consumer drains them, element at a time and, for
+//               SPSCLFQueue, in batches of BATCH through its span API
+// the threads run on the "bench_producer" and "bench_consumer" roles of the cpu layout (LOW_LATENCY_CPU_LAYOUT), cores 0
+// and 1 when the layout does not place them; on a single core machine they share it and yield while waiting, which
+// measures the scheduler rather than the queue
+
+constexpr size_t QUEUE_SIZE = 64 * 1024;
+constexpr size_t BATCH = 64;
+
+struct Msg {
+    size_t seq_;
+    uint64_t payload_[3];
+};
+
+const bool SHARED_CORE = (thread::hardware_concurrency() < 2);
+
+auto threadCfg(const string &role, int default_core) {
+    auto cfg = CpuLayout::instance().threadCfg(role, role);
+    if(cfg.cores_.empty() && !SHARED_CORE) {
+        cfg.cores_.push_back(default_core);
+    }
+    return cfg;
+}
+
+inline auto wait() noexcept {
+    if(SHARED_CORE) {
+        this_thread::yield();
+    }
+}
+
+// LFQueue has no full check and an element at a time API only
+template<typename Q>
+inline auto tryWrite(Q &queue, const Msg &msg) noexcept {
+    if constexpr (is_same_v<Q, LFQueue<Msg>>) {
+        if(queue.size() >= QUEUE_SIZE) {
+            return false;
+        }
+        *queue.getNextToWriteTo() = msg;
+    } else {
+        auto next = queue.getNextToWriteTo();
+        if(!next) {
+            return false;
+        }
+        *next = msg;
+    }
+    queue.updateWriteIndex();
+    return true;
+}
+
+template<typename Q>
+inline auto tryRead(Q &queue, Msg *msg) noexcept {
+    const auto next = queue.getNextToRead();
+    if(!next) {
+        return false;
+    }
+    *msg = *next;
+    queue.updateReadIndex();
+    return true;
+}
+
+template<typename Q>
+auto pingPong(size_t round_trips) {
+    Q ping(QUEUE_SIZE), pong(QUEUE_SIZE);
+    LatencySamples rtts(round_trips);
+
+    auto responder = createAndStartThread(threadCfg("bench_consumer", 1), [&]() {
+        Msg msg;
+        for(size_t i = 0; i < round_trips; ++i) {
+            while(!tryRead(ping, &msg)) {
+                wait();
+            }
+            while(!tryWrite(pong, msg)) {
+                wait();
+            }
+        }
+    });
+    auto initiator = createAndStartThread(threadCfg("bench_producer", 0), [&]() {
+        const auto &clock = TSCClock::instance();
+        Msg msg{};
+        for(size_t i = 0; i < round_trips; ++i) {
+            msg.seq_ = i;
+            const auto start = TSCClock::ticks();
+            while(!tryWrite(ping, msg)) {
+                wait();
+            }
+            while(!tryRead(pong, &msg)) {
+                wait();
+            }
+            rtts.record(clock.ticksToNanos(TSCClock::ticks() - start));
+            if(UNLIKELY(msg.seq_ != i)) {
+                FATAL("Round trip " + to_string(i) + " came back as " + to_string(msg.seq_));
+            }
+        }
+    });
+    ASSERT(responder.joinable() && initiator.joinable(), "Unable to start the ping pong threads.");
+    initiator.join();
+    responder.join();
+    return rtts.toCsv();
+}
+
+template<typename Q, bool batched>
+auto throughput(size_t num_msgs) {
+    Q queue(QUEUE_SIZE);
+    atomic<bool> go = {false};
+
+    auto producer = createAndStartThread(threadCfg("bench_producer", 0), [&]() {
+        while(!go) {
+            wait();
+        }
+        for(size_t seq = 0; seq < num_msgs;) {
+            if constexpr (batched) {
+                auto slots = queue.getNextToWriteTo(min(BATCH, num_msgs - seq));
+                for(auto &slot : slots) {
+                    slot.seq_ = seq++;
+                }
+                queue.updateWriteIndex(slots.size());
+                if(slots.empty()) {
+                    wait();
+                }
+            } else {
+                if(tryWrite(queue, Msg{seq, {}})) {
+                    ++seq;
+                } else {
+                    wait();
+                }
+            }
+        }
+    });
+    ASSERT(producer.joinable(), "Unable to start the producer thread.");
+
+    Nanos elapsed = 0;
+    auto consumer = createAndStartThread(threadCfg("bench_consumer", 1), [&]() {
+        const auto start = getCurrentNanos();
+        go = true;
+        for(size_t seq = 0; seq < num_msgs;) {
+            if constexpr (batched) {
+                const auto msgs = queue.getNextToRead(BATCH);
+                for(const auto &msg : msgs) {
+                    if(UNLIKELY(msg.seq_ != seq)) {
+                        FATAL("Out of sequence at " + to_string(seq));
+                    }
+                    ++seq;
+                }
+                queue.updateReadIndex(msgs.size());
+                if(msgs.empty()) {
+                    wait();
+                }
+            } else {
+                Msg msg;
+                if(tryRead(queue, &msg)) {
+                    if(UNLIKELY(msg.seq_ != seq)) {
+                        FATAL("Out of sequence at " + to_string(seq));
+                    }
+                    ++seq;
+                } else {
+                    wait();
+                }
+            }
+        }
+        elapsed = getCurrentNanos() - start;
+    });
+    ASSERT(consumer.joinable(), "Unable to start the consumer thread.");
+    consumer.join();
+    producer.join();
+    return static_cast<double>(num_msgs) * 1e9 / static_cast<double>(elapsed);
+}
+
+int main(int argc, char **argv) {
+    const size_t round_trips = (argc > 1 ? stoul(argv[1]) : (SHARED_CORE ? 100'000 : 1'000'000));
+    const size_t num_msgs = (argc > 2 ? stoul(argv[2]) : (SHARED_CORE ? 10'000'000 : 100'000'000));
+
+    cout << "shared_core:" << SHARED_CORE << endl;
+    cout << "pingpong,queue," << LATENCY_CSV_COLUMNS << endl;
+    cout << "pingpong,LFQueue," << pingPong<LFQueue<Msg>>(round_trips) << endl;
+    cout << "pingpong,SPSCLFQueue," << pingPong<SPSCLFQueue<Msg>>(round_trips) << endl;
+
+    cout << "throughput,queue,api,msgs,msgs_per_sec" << endl;
+    cout << "throughput,LFQueue,single," << num_msgs << "," << throughput<LFQueue<Msg>, false>(num_msgs) << endl;
+    cout << "throughput,SPSCLFQueue,single," << num_msgs << "," << throughput<SPSCLFQueue<Msg>, false>(num_msgs) << endl;
+    cout << "throughput,SPSCLFQueue,batch," << num_msgs << "," << throughput<SPSCLFQueue<Msg>, true>(num_msgs) << endl;
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "thread_utils.h"
+#include "time_utils.h"
+#include "lf_queue.h"
+
+
+using namespace std;
+using namespace Common;
+
+// fan-in of N producers into one consumer:
+// spsc - one LFQueue per producer and the consumer round-robins over all of them (what we do today)
+// mpsc - every producer writes to the same MPSCLFQueue
+
+constexpr size_t QUEUE_SIZE = 64 * 1024;
+
+struct Msg {
+    size_t producer_;
+    size_t seq_;
+};
+
+auto runSPSC(size_t num_producers, size_t msgs_per_producer) {
+    vector<unique_ptr<LFQueue<Msg>>> queues;
+    for(size_t i = 0; i < num_producers; ++i) {
+        queues.emplace_back(make_unique<LFQueue<Msg>>(QUEUE_SIZE));
+    }
+    atomic<bool> go(false);
+
+    auto producer = [&](size_t p) {
+        while(!go) {}
+        auto &q = *queues[p];
+        for(size_t i = 0; i < msgs_per_producer; ++i) {
+            // LFQueue has no full check, so wait for space here to keep the comparison fair
+            while(q.size() >= QUEUE_SIZE - 1) {
+                this_thread::yield();
+            }
+            *q.getNextToWriteTo() = Msg{p, i};
+            q.updateWriteIndex();
+        }
+    };
+    vector<jthread> producers;
+    for(size_t p = 0; p < num_producers; ++p) {
+        producers.push_back(createAndStartThread(-1, "spsc_producer_" + to_string(p), producer, p));
+    }
+
+    const auto start = getCurrentNanos();
+    go = true;
+    size_t received = 0;
+    vector<size_t> next_seq(num_producers, 0);
+    while(received < num_producers * msgs_per_producer) {
+        bool any = false;
+        for(auto &q : queues) {
+            for(auto msg = q->getNextToRead(); msg; msg = q->getNextToRead()) {
+                ASSERT(msg->seq_ == next_seq[msg->producer_]++, "spsc out of order");
+                q->updateReadIndex();
+                ++received;
+                any = true;
+            }
+        }
+        if(!any) {
+            this_thread::yield();
+        }
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    for(auto &t : producers) {
+        t.join();
+    }
+    return elapsed;
+}
+
+auto runMPSC(size_t num_producers, size_t msgs_per_producer) {
+    MPSCLFQueue<Msg> q(QUEUE_SIZE);
+    atomic<bool> go(false);
+
+    auto producer = [&](size_t p) {
+        while(!go) {}
+        for(size_t i = 0; i < msgs_per_producer; ++i) {
+            Msg *slot;
+            while(!(slot = q.getNextToWriteTo())) {
+                this_thread::yield();
+            }
+            *slot = Msg{p, i};
+            q.updateWriteIndex(slot);
+        }
+    };
+    vector<jthread> producers;
+    for(size_t p = 0; p < num_producers; ++p) {
+        producers.push_back(createAndStartThread(-1, "mpsc_producer_" + to_string(p), producer, p));
+    }
+
+    const auto start = getCurrentNanos();
+    go = true;
+    size_t received = 0;
+    vector<size_t> next_seq(num_producers, 0);
+    while(received < num_producers * msgs_per_producer) {
+        auto msg = q.getNextToRead();
+        if(!msg) {
+            this_thread::yield();
+            continue;
+        }
+        ASSERT(msg->seq_ == next_seq[msg->producer_]++, "mpsc out of order");
+        q.updateReadIndex(msg);
+        ++received;
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    for(auto &t : producers) {
+        t.join();
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    const size_t msgs_per_producer = (argc > 1 ? stoul(argv[1]) : 1'000'000);
+
+    cout << "queue,producers,messages,total_ns,ns_per_msg,msgs_per_sec" << endl;
+    for(size_t num_producers : {1, 2, 4, 8}) {
+        const auto total = num_producers * msgs_per_producer;
+        for(const auto &[name, elapsed] : {pair<const char *, Nanos>{"spsc", runSPSC(num_producers, msgs_per_producer)},
+                                            pair<const char *, Nanos>{"mpsc", runMPSC(num_producers, msgs_per_producer)}}) {
+            cout << name << "," << num_producers << "," << total << "," << elapsed << ","
+                 << static_cast<double>(elapsed) / total << ","
+                 << static_cast<uint64_t>(total * static_cast<double>(NANOS_TO_SECS) / elapsed) << endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "logging.h"
+#include "tsc_clock.h"
+#include "bench_utils.h"
+
+using namespace std;
+using namespace Common;
+
+// what Logger::log() costs the calling thread, per call, timed with the TSC, for argument lists of a few shapes and
+// both file modes: packing the arguments into a record and queueing it, the formatting and the write happen on the
+// logger's own thread
+// calls come in bursts of BURST with a pause in between, about what a busy hot path logs, so the writer keeps up and
+// the numbers are the queueing cost rather than the cost of waiting for a full queue (LogOverflowPolicy::BLOCK)
+// repo_style is the "%:% %() % ..." line the components log with, getCurrentTimeStr() included
+
+constexpr size_t CALLS_PER_CASE = 1000000;
+constexpr size_t BURST = 1000;
+
+template<typename F>
+auto run(Logger &logger, const string &file_mode, const string &name, F &&log_call) {
+    const auto &clock = TSCClock::instance();
+    LatencySamples samples(CALLS_PER_CASE);
+    for(size_t i = 0; i < CALLS_PER_CASE; ++i) {
+        const auto start = TSCClock::ticks();
+        log_call(logger, i);
+        samples.record(clock.ticksToNanos(TSCClock::ticks() - start));
+        if((i + 1) % BURST == 0) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+    cout << file_mode << "," << name << "," << samples.toCsv() << endl;
+}
+
+auto runAll(Logger &logger, const string &file_mode) {
+    const string str = "a std::string of thirty-two chars";
+    string time_str;
+
+    run(logger, file_mode, "no_args", [](Logger &l, size_t) {
+        l.log("a record without arguments\n");
+    });
+    run(logger, file_mode, "3_ints", [](Logger &l, size_t i) {
+        l.log("a:% b:% c:%\n", i, static_cast<int>(i) * 2, static_cast<uint32_t>(i) * 3);
+    });
+    run(logger, file_mode, "double_char_cstr", [](Logger &l, size_t i) {
+        l.log("price:% side:% symbol:%\n", static_cast<double>(i) * 0.01, 'B', "AAPL");
+    });
+    run(logger, file_mode, "std_string", [&str](Logger &l, size_t i) {
+        l.log("% %\n", str, i);
+    });
+    run(logger, file_mode, "repo_style", [&time_str](Logger &l, size_t i) {
+        l.log("%:% %() % order:%\n", __FILE__, __LINE__, __FUNCTION__, getCurrentTimeStr(&time_str), i);
+    });
+}
+
+int main(int, char **) {
+    cout << "file_mode,args," << LATENCY_CSV_COLUMNS << endl;
+    {
+        Logger logger("logging_benchmark.log");
+        runAll(logger, "text");
+    }
+    {
+        Logger logger("logging_benchmark.bin", LoggerCfg{.file_mode_ = LogFileMode::BINARY});
+        runAll(logger, "binary");
+    }
+    return 0;
+}
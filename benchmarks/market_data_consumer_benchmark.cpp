@@ -0,0 +1,104 @@
+#include "time_utils.h"
+#include "bench_utils.h"
+#include "tests/market_data_stand_in.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace Common;
+using namespace Exchange;
+using namespace Trading;
+
+// MarketDataConsumer against a StandInPublisher over loopback multicast that drops a share of its incrementals
+// - in order: a burst of BURST incrementals being sent to all of them being on the strategy's queue, for the bursts
+//   that went out whole while the consumer was in sync, the in-order path that recovery must not slow down
+// - recovery: the consumer seeing a gap to it being back in sync, about one snapshot interval on average
+// that recovery loses nothing is market_data_consumer_test's job, this only times it
+// one thread drives the stand-in, the synthesizer, the consumer and the strategy in turn
+
+constexpr size_t UPDATES_PER_RUN = 200000;
+constexpr size_t BURST = 16;
+constexpr Nanos SNAPSHOT_INTERVAL = 5 * 1000 * 1000;
+
+auto run(Logger &logger, double drop_rate, int port) {
+    MarketDataConsumerCfg cfg;
+    cfg.incremental_port_ = port;
+    cfg.snapshot_port_ = port + 1;
+    cfg.mcast_cfg_.rcvbuf_size_ = 16 * 1024 * 1024;
+
+    MEMarketUpdateLFQueue strategy_updates(ME_MAX_MARKET_UPDATES);
+    MarketDataConsumer consumer(&strategy_updates, logger, cfg);
+    StandInPublisherCfg publisher_cfg;
+    publisher_cfg.snapshot_interval_ = SNAPSHOT_INTERVAL;
+    publisher_cfg.drop_rate_ = drop_rate;
+    StandInPublisher publisher(logger, cfg, publisher_cfg);
+
+    const auto drain = [&]() {
+        for(auto batch = strategy_updates.getNextToRead(256); !batch.empty(); batch = strategy_updates.getNextToRead(256)) {
+            strategy_updates.updateReadIndex(batch.size());
+        }
+    };
+
+    vector<Nanos> in_order;
+    in_order.reserve(UPDATES_PER_RUN / BURST);
+
+    const auto start = getCurrentNanos();
+    for(size_t round = 0; round < UPDATES_PER_RUN / BURST; ++round) {
+        const auto was_in_sync = !consumer.inRecovery();
+        const auto forwarded = consumer.stats().updates_forwarded_;
+
+        const auto sent_at = getTSCNanos();
+        size_t sent = 0;
+        for(size_t i = 0; i < BURST; ++i) {
+            sent += publisher.publish(publisher.nextUpdate());
+        }
+        publisher.flush();
+
+        // loopback delivers before sendmmsg() returns, a read or two picks it all up
+        for(const auto deadline = getTSCNanos() + 1000 * 1000; getTSCNanos() < deadline;) {
+            consumer.poll();
+            if(consumer.stats().updates_forwarded_ - forwarded >= sent) {
+                break;
+            }
+        }
+        const auto done_at = getTSCNanos();
+        if(was_in_sync && sent == BURST && !consumer.inRecovery()) {
+            in_order.push_back(done_at - sent_at);
+        }
+        publisher.pollSnapshots();
+        drain();
+    }
+
+    // the last drop may never be noticed without something after it
+    for(const auto deadline = getCurrentNanos() + 5 * SNAPSHOT_INTERVAL;
+        (consumer.inRecovery() || consumer.nextExpectedSeqNum() != publisher.next_seq_num_) && getCurrentNanos() < deadline;) {
+        publisher.publishTrade();
+        publisher.flush();
+        publisher.pollSnapshots();
+        consumer.poll();
+    }
+    drain();
+    const auto elapsed = getCurrentNanos() - start;
+
+    sort(in_order.begin(), in_order.end());
+    const auto &stats = consumer.stats();
+    cout << drop_rate << "," << static_cast<double>(UPDATES_PER_RUN) * 1e9 / static_cast<double>(elapsed) << ","
+         << publisher.dropped_ << "," << stats.gaps_ << "," << stats.snapshots_discarded_ << ","
+         << percentile(in_order, 0.5) << "," << percentile(in_order, 0.99) << "," << percentile(in_order, 0.999) << ","
+         << (in_order.empty() ? 0 : in_order.back()) << ","
+         << (stats.recovery_time_.count_ ? stats.recovery_time_.total_ / static_cast<Nanos>(stats.recovery_time_.count_) / 1000 : 0) << ","
+         << stats.recovery_time_.max_ / 1000 << endl;
+}
+
+int main(int, char **) {
+    Logger logger("market_data_consumer_benchmark.log");
+
+    int port = 22000;
+    cout << "drop_rate,updates_per_sec,dropped,gaps,snapshots_discarded,burst_p50_ns,burst_p99_ns,burst_p99.9_ns,burst_max_ns,"
+            "recovery_mean_us,recovery_max_us" << endl;
+    for(const auto drop_rate : {0.0, 0.0001, 0.001, 0.01}) {
+        run(logger, drop_rate, port);
+        port += 2;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "time_utils.h"
+#include "market_data_publisher.h"
+#include "bench_utils.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace Common;
+using namespace Exchange;
+
+// MarketDataPublisher over loopback multicast: a stand-in engine queues a burst of market updates, the publisher sends
+// them, and a subscriber on the incremental group reads them back
+// - publish latency: the update being queued to the subscriber's read returning it, per update, so an update late in a
+//   burst also waits for the ones sent before it
+// - throughput: updates received per second over the whole run, with the snapshot synthesizer applying every update
+// bursts of 1 pay a sendmmsg() per update, bigger ones share it between up to McastBatchSize updates
+// one thread drives the publisher, the synthesizer and the subscriber in turn, so the numbers do not depend on having a
+// core per thread; a last row times a full snapshot of a book of SNAPSHOT_ORDERS orders
+
+constexpr size_t UPDATES_PER_RUN = 200000;
+constexpr size_t SNAPSHOT_ORDERS = 100000;
+
+auto makeCfg(int port) {
+    MarketDataPublisherCfg cfg;
+    cfg.incremental_port_ = port;
+    cfg.snapshot_cfg_.port_ = port + 1;
+    // snapshots only when asked for
+    cfg.snapshot_cfg_.interval_ = numeric_limits<Nanos>::max();
+    return cfg;
+}
+
+auto makeSubscriber(Logger &logger, const MarketDataPublisherCfg &cfg, const string &ip, int port) {
+    McastCfg mcast_cfg;
+    mcast_cfg.rcvbuf_size_ = 16 * 1024 * 1024;
+    auto subscriber = make_unique<McastSocket>(logger, mcast_cfg);
+    ASSERT(subscriber->init(ip, cfg.iface_, port, true) >= 0 && subscriber->join(ip), "Unable to join " + ip);
+    return subscriber;
+}
+
+auto run(Logger &logger, size_t burst, int port) {
+    MEMarketUpdateLFQueue updates(ME_MAX_MARKET_UPDATES);
+    const auto cfg = makeCfg(port);
+    MarketDataPublisher publisher(&updates, logger, cfg);
+    auto &synthesizer = publisher.snapshotSynthesizer();
+    auto subscriber = makeSubscriber(logger, cfg, cfg.incremental_ip_, cfg.incremental_port_);
+
+    vector<Nanos> latencies;
+    latencies.reserve(UPDATES_PER_RUN);
+    vector<Nanos> queued_at(burst);
+    size_t lost = 0;
+    OrderId order_id = 1;
+
+    const auto start = getCurrentNanos();
+    for(size_t round = 0; round < UPDATES_PER_RUN / burst; ++round) {
+        // adds and cancels of the same orders, so the shadow book stays small
+        for(size_t i = 0; i < burst; ++i) {
+            auto next = updates.getNextToWriteTo();
+            const auto add = ((order_id + i) % 2 == 0);
+            *next = {(add ? MarketUpdateType::ADD : MarketUpdateType::CANCEL), (order_id + i) / 2, 0, Side::BUY, 100, 10, 1};
+            queued_at[i] = getTSCNanos();
+            updates.updateWriteIndex();
+        }
+        order_id += burst;
+
+        publisher.poll();
+        synthesizer.poll();
+
+        // a datagram dropped on the way is given up on after a millisecond
+        size_t received = 0;
+        for(const auto deadline = getCurrentNanos() + 1000 * 1000; received < burst && getCurrentNanos() < deadline;) {
+            subscriber->sendAndRecv();
+            while(subscriber->packetsReadable()) {
+                latencies.push_back(subscriber->frontPacket().user_time_ - queued_at[received++]);
+                subscriber->popPacket();
+            }
+        }
+        lost += burst - received;
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    sort(latencies.begin(), latencies.end());
+    const auto &stats = publisher.stats();
+    cout << "incremental," << burst << "," << static_cast<double>(latencies.size()) * 1e9 / static_cast<double>(elapsed) << ","
+         << static_cast<double>(stats.updates_published_) / static_cast<double>(stats.send_batches_) << ","
+         << percentile(latencies, 0.5) << "," << percentile(latencies, 0.99) << "," << percentile(latencies, 0.999) << ","
+         << latencies.back() << "," << lost << endl;
+}
+
+auto runSnapshot(Logger &logger, int port) {
+    MEMarketUpdateLFQueue updates(ME_MAX_MARKET_UPDATES);
+    const auto cfg = makeCfg(port);
+    MarketDataPublisher publisher(&updates, logger, cfg);
+    auto &synthesizer = publisher.snapshotSynthesizer();
+    // a member of the snapshot group, so the datagrams have somewhere to go as in production, it is never read
+    auto subscriber = makeSubscriber(logger, cfg, cfg.snapshot_cfg_.ip_, cfg.snapshot_cfg_.port_);
+
+    for(OrderId order_id = 1; order_id <= SNAPSHOT_ORDERS; ++order_id) {
+        auto next = updates.getNextToWriteTo();
+        *next = {MarketUpdateType::ADD, order_id, static_cast<TickerId>(order_id % cfg.snapshot_cfg_.num_tickers_),
+                 Side::SELL, static_cast<Price>(100 + order_id % 64), 10, order_id};
+        updates.updateWriteIndex();
+        if(order_id % 1024 == 0) {
+            publisher.poll();
+            synthesizer.poll();
+        }
+    }
+    publisher.poll();
+    synthesizer.poll();
+
+    const auto start = getCurrentNanos();
+    synthesizer.publishSnapshot();
+    const auto elapsed = getCurrentNanos() - start;
+    cout << "snapshot,orders:" << synthesizer.numOrders() << ",publish_ms:" << static_cast<double>(elapsed) / 1e6 << endl;
+}
+
+int main(int, char **) {
+    Logger logger("market_data_publisher_benchmark.log");
+
+    int port = 21000;
+    cout << "stream,burst,updates_per_sec,updates_per_sendmmsg,p50_ns,p99_ns,p99.9_ns,max_ns,lost" << endl;
+    for(const auto burst : {1ul, 16ul, 64ul, 256ul}) {
+        run(logger, burst, port);
+        port += 2;
+    }
+    runSnapshot(logger, port);
+    return 0;
+}
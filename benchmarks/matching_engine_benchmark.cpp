@@ -0,0 +1,168 @@
+#include "time_utils.h"
+#include "tsc_clock.h"
+#include "matching_engine.h"
+#include "bench_utils.h"
+
+#include <random>
+#include <algorithm>
+
+using namespace std;
+using namespace Common;
+using namespace Exchange;
+
+// cost of the matching engine per request, replaying synthetic order flow for one ticker around a slowly moving mid:
+// - passive:    a new order a few ticks behind the touch, rests in the book
+// - aggressive: a new order priced through the touch, matches one or more resting orders and may rest the remainder
+// - cancel:     cancels an order sent earlier, which may have been filled in the meantime (then it is cancel rejected)
+// the flow is generated up front, every request is timed on its own with the TSC and the engine's output queues are
+// drained between requests outside the timed region
+// a second run feeds the same flow through the engine thread and measures throughput end to end, when there are cores
+// for both threads
+
+constexpr size_t NUM_REQUESTS = 2 * 1000 * 1000;
+constexpr size_t WARMUP_REQUESTS = 100 * 1000;
+constexpr Price START_MID = 100 * 1000;
+// orders sent and not cancelled yet, some of them filled, past this every request is a cancel so the book stays bounded
+constexpr size_t MAX_OPEN_ORDERS = 16 * 1024;
+
+enum class Op : uint8_t {
+    PASSIVE = 0,
+    AGGRESSIVE = 1,
+    CANCEL = 2
+};
+
+constexpr const char *OP_NAMES[] = {"passive", "aggressive", "cancel"};
+
+auto generateFlow(size_t num_requests) {
+    mt19937_64 rng(42);
+    vector<pair<Op, MEClientRequest>> flow;
+    flow.reserve(num_requests);
+    vector<OrderId> sent;
+    auto mid = START_MID;
+    OrderId next_order_id = 1;
+
+    for(size_t i = 0; i < num_requests; ++i) {
+        const auto draw = rng() % 100;
+        if(draw < 3) {
+            mid += static_cast<Price>(rng() % 3) - 1;
+        }
+        const auto side = (rng() & 1 ? Side::BUY : Side::SELL);
+        const auto sign = static_cast<Price>(side);
+        const auto qty = static_cast<Qty>(1 + rng() % 100);
+
+        if(sent.size() < 1000 || (draw < 45 && sent.size() < MAX_OPEN_ORDERS)) {
+            const auto price = mid - sign * static_cast<Price>(1 + rng() % 20);
+            flow.push_back({Op::PASSIVE, {ClientRequestType::NEW, 1, 0, next_order_id, side, price, qty}});
+            sent.push_back(next_order_id++);
+        } else if(draw < 60 && sent.size() < MAX_OPEN_ORDERS) {
+            const auto price = mid + sign * static_cast<Price>(rng() % 3);
+            flow.push_back({Op::AGGRESSIVE, {ClientRequestType::NEW, 2, 0, next_order_id, side, price, qty}});
+            sent.push_back(next_order_id++);
+        } else {
+            // mostly recent orders, the way strategies requote
+            const auto index = sent.size() - 1 - min<size_t>(sent.size() - 1, rng() % 256);
+            const auto order_id = sent[index];
+            sent[index] = sent.back();
+            sent.pop_back();
+            const auto client_id = static_cast<ClientId>(order_id % 2 ? 1 : 2);
+            flow.push_back({Op::CANCEL, {ClientRequestType::CANCEL, client_id, 0, order_id, Side::INVALID, Price_INVALID, 0}});
+        }
+    }
+
+    // cancels name the client the order was sent by
+    vector<ClientId> client_of(next_order_id);
+    for(auto &[op, request] : flow) {
+        if(op != Op::CANCEL) {
+            client_of[request.order_id_] = request.client_id_;
+        } else {
+            request.client_id_ = client_of[request.order_id_];
+        }
+    }
+    return flow;
+}
+
+auto drain(ClientResponseLFQueue &responses, MEMarketUpdateLFQueue &updates) {
+    size_t drained = 0;
+    for(auto batch = responses.getNextToRead(1024); !batch.empty(); batch = responses.getNextToRead(1024)) {
+        drained += batch.size();
+        responses.updateReadIndex(batch.size());
+    }
+    for(auto batch = updates.getNextToRead(1024); !batch.empty(); batch = updates.getNextToRead(1024)) {
+        drained += batch.size();
+        updates.updateReadIndex(batch.size());
+    }
+    return drained;
+}
+
+auto runInline(Logger &logger, const vector<pair<Op, MEClientRequest>> &flow) {
+    ClientRequestLFQueue requests(ME_MAX_CLIENT_UPDATES);
+    ClientResponseLFQueue responses(ME_MAX_CLIENT_UPDATES);
+    MEMarketUpdateLFQueue updates(ME_MAX_MARKET_UPDATES);
+    MatchingEngine engine(&requests, &responses, &updates, logger, {1, {}});
+    const auto &clock = TSCClock::instance();
+
+    LatencySamples samples[3];
+    Nanos total_ns = 0;
+    for(size_t i = 0; i < flow.size(); ++i) {
+        const auto &[op, request] = flow[i];
+        const auto start = TSCClock::ticksOrdered();
+        engine.processClientRequest(request);
+        const auto elapsed = clock.ticksToNanos(TSCClock::ticksOrdered() - start);
+        drain(responses, updates);
+        if(i >= WARMUP_REQUESTS) {
+            samples[static_cast<size_t>(op)].record(elapsed);
+            total_ns += elapsed;
+        }
+    }
+
+    cout << "op," << LATENCY_CSV_COLUMNS << endl;
+    for(size_t op = 0; op < 3; ++op) {
+        cout << OP_NAMES[op] << "," << samples[op].toCsv() << endl;
+    }
+    cout << "inline,requests_per_sec," << static_cast<double>(flow.size() - WARMUP_REQUESTS) * 1e9 / static_cast<double>(total_ns)
+         << endl;
+    cout << "resting_orders," << engine.orderBook(0)->numOrders() << endl;
+}
+
+auto runThreaded(Logger &logger, const vector<pair<Op, MEClientRequest>> &flow) {
+    ClientRequestLFQueue requests(ME_MAX_CLIENT_UPDATES);
+    ClientResponseLFQueue responses(ME_MAX_CLIENT_UPDATES);
+    MEMarketUpdateLFQueue updates(ME_MAX_MARKET_UPDATES);
+    MatchingEngine engine(&requests, &responses, &updates, logger, {1, {}});
+    engine.start();
+
+    const auto start = getCurrentNanos();
+    size_t outputs = 0;
+    for(const auto &[op, request] : flow) {
+        auto next = requests.getNextToWriteTo();
+        while(!next) {
+            outputs += drain(responses, updates);
+            next = requests.getNextToWriteTo();
+        }
+        *next = request;
+        requests.updateWriteIndex();
+    }
+    // the engine releases a batch of requests once it has written everything they produced
+    while(requests.size()) {
+        outputs += drain(responses, updates);
+    }
+    outputs += drain(responses, updates);
+    const auto elapsed = getCurrentNanos() - start;
+    engine.stop();
+
+    cout << "threaded,requests_per_sec," << static_cast<double>(flow.size()) * 1e9 / static_cast<double>(elapsed) << endl;
+    cout << "threaded,outputs_per_request," << static_cast<double>(outputs) / static_cast<double>(flow.size()) << endl;
+}
+
+int main(int, char **) {
+    Logger logger("matching_engine_benchmark.log");
+    const auto flow = generateFlow(NUM_REQUESTS);
+
+    runInline(logger, flow);
+    if(thread::hardware_concurrency() >= 2) {
+        runThreaded(logger, flow);
+    } else {
+        cout << "threaded,skipped,needs 2 cores" << endl;
+    }
+    return 0;
+}
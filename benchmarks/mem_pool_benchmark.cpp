@@ -0,0 +1,121 @@
+#include "time_utils.h"
+#include "tsc_clock.h"
+#include "mem_pool.h"
+#include "bench_utils.h"
+
+#include <random>
+
+using namespace std;
+using namespace Common;
+
+// allocate/free cost of MemPool (linear free-slot scan) vs FreeListMemPool (intrusive free list)
+// the pool is filled to the given occupancy, then we repeatedly free a random live object and allocate a new one,
+// which scatters the free slots the way out of order order cancels do
+// means come from timing batches of operations, the percentiles from a second pass timing every operation on its own
+// with the TSC, which adds the rdtsc pair to each sample
+
+constexpr size_t POOL_SIZE = 64 * 1024;
+
+struct Order {
+    uint64_t order_id_ = 0;
+    uint64_t client_id_ = 0;
+    int64_t price_ = 0;
+    uint32_t qty_ = 0;
+    bool is_buy_ = false;
+};
+
+template<typename Pool>
+auto run(double occupancy, size_t iterations) {
+    Pool pool(POOL_SIZE);
+    vector<Order *> live;
+    const auto target = static_cast<size_t>(POOL_SIZE * occupancy);
+    for(size_t i = 0; i < target; ++i) {
+        live.push_back(pool.allocate(Order{i, 0, 0, 0, false}));
+    }
+
+    mt19937_64 rng(42);
+    vector<size_t> victims(iterations);
+    for(auto &v : victims) {
+        v = rng() % live.size();
+    }
+
+    Nanos alloc_ns = 0, free_ns = 0;
+    // time in batches so the clock read does not dominate a single operation
+    constexpr size_t BATCH = 1024;
+    for(size_t done = 0; done < iterations; done += BATCH) {
+        const auto n = min(BATCH, iterations - done);
+        const auto t0 = getCurrentNanos();
+        for(size_t i = 0; i < n; ++i) {
+            auto &victim = live[victims[done + i]];
+            if(victim) { // the same slot can be picked twice in one batch.
+                pool.deallocate(victim);
+                victim = nullptr;
+            }
+        }
+        const auto t1 = getCurrentNanos();
+        for(size_t i = 0; i < n; ++i) {
+            auto &victim = live[victims[done + i]];
+            if(!victim) {
+                victim = pool.allocate(Order{done + i, 0, 0, 0, false});
+            }
+        }
+        const auto t2 = getCurrentNanos();
+        free_ns += t1 - t0;
+        alloc_ns += t2 - t1;
+    }
+    for(auto p : live) {
+        pool.deallocate(p);
+    }
+    return pair<double, double>{static_cast<double>(alloc_ns) / iterations, static_cast<double>(free_ns) / iterations};
+}
+
+template<typename Pool>
+auto sample(double occupancy, size_t iterations) {
+    Pool pool(POOL_SIZE);
+    vector<Order *> live;
+    const auto target = static_cast<size_t>(POOL_SIZE * occupancy);
+    for(size_t i = 0; i < target; ++i) {
+        live.push_back(pool.allocate(Order{i, 0, 0, 0, false}));
+    }
+
+    const auto &clock = TSCClock::instance();
+    LatencySamples alloc_samples(iterations), free_samples(iterations);
+    mt19937_64 rng(42);
+    for(size_t i = 0; i < iterations; ++i) {
+        auto &victim = live[rng() % live.size()];
+        auto start = TSCClock::ticks();
+        pool.deallocate(victim);
+        free_samples.record(clock.ticksToNanos(TSCClock::ticks() - start));
+
+        start = TSCClock::ticks();
+        victim = pool.allocate(Order{i, 0, 0, 0, false});
+        alloc_samples.record(clock.ticksToNanos(TSCClock::ticks() - start));
+    }
+    for(auto p : live) {
+        pool.deallocate(p);
+    }
+    return pair<string, string>{alloc_samples.toCsv(), free_samples.toCsv()};
+}
+
+int main(int argc, char **argv) {
+    const size_t iterations = (argc > 1 ? stoul(argv[1]) : 1'000'000);
+
+    cout << "pool,occupancy,iterations,alloc_ns,free_ns" << endl;
+    for(auto occupancy : {0.10, 0.90, 0.99}) {
+        const auto [mp_alloc, mp_free] = run<MemPool<Order>>(occupancy, iterations);
+        cout << "MemPool," << occupancy << "," << iterations << "," << mp_alloc << "," << mp_free << endl;
+        const auto [fl_alloc, fl_free] = run<FreeListMemPool<Order>>(occupancy, iterations);
+        cout << "FreeListMemPool," << occupancy << "," << iterations << "," << fl_alloc << "," << fl_free << endl;
+    }
+
+    cout << "pool,occupancy,op," << LATENCY_CSV_COLUMNS << endl;
+    for(auto occupancy : {0.10, 0.90, 0.99}) {
+        const auto [mp_alloc, mp_free] = sample<MemPool<Order>>(occupancy, iterations);
+        cout << "MemPool," << occupancy << ",alloc," << mp_alloc << endl;
+        cout << "MemPool," << occupancy << ",free," << mp_free << endl;
+        const auto [fl_alloc, fl_free] = sample<FreeListMemPool<Order>>(occupancy, iterations);
+        cout << "FreeListMemPool," << occupancy << ",alloc," << fl_alloc << endl;
+        cout << "FreeListMemPool," << occupancy << ",free," << fl_free << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "time_utils.h"
+#include "order_gateway.h"
+#include "bench_utils.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace Common;
+using namespace Exchange;
+
+// latency the order gateway adds on loopback: every client sends one OMClientRequest, the gateway forwards it to the
+// engine's queue, a stand-in engine answers each request with an ACCEPTED response, and the gateway writes it back
+// - gateway: OrderGateway, with session checks, the receive time ordering and the response routing
+// - echo:    a plain TCPServer answering each request frame from its recv_callback_, the same syscalls and no protocol
+// the difference between the two is what the gateway's own work costs
+// one thread drives the server, the engine and the clients in turn, so the numbers do not depend on having a core per
+// thread, a round trip is the time from a client's send() to its response arriving, including the clients' syscalls
+
+constexpr size_t ROUND_TRIPS = 100000;
+constexpr int BASE_PORT = 12445;
+
+auto connectClients(int port, size_t num_clients) {
+    vector<int> clients;
+    for(size_t i = 0; i < num_clients; ++i) {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{AF_INET, htons(port), {htonl(INADDR_LOOPBACK)}, {}};
+        ASSERT(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "connect() failed. error:" + string(strerror(errno)));
+        ASSERT(disableNagle(fd), "disableNagle() failed.");
+        ASSERT(setNonBlocking(fd), "setNonBlocking() failed.");
+        clients.push_back(fd);
+    }
+    return clients;
+}
+
+// every round each client sends a request and polls until its response is back, poll() runs the server side
+template<typename Poll>
+auto runRounds(const vector<int> &clients, Poll &&poll) {
+    const auto num_clients = clients.size();
+    vector<Nanos> rtts;
+    rtts.reserve(ROUND_TRIPS);
+    vector<Nanos> sent_at(num_clients);
+    vector<size_t> received(num_clients);
+    uint64_t seq_num = 1;
+    char reply[sizeof(OMClientResponse)];
+
+    for(size_t round = 0; round < ROUND_TRIPS / num_clients; ++round, ++seq_num) {
+        for(size_t i = 0; i < num_clients; ++i) {
+            OMClientRequest request{{sizeof(OMClientRequest), OMClientRequest::MSG_TYPE, seq_num},
+                                    {ClientRequestType::NEW, static_cast<ClientId>(i), 0, seq_num, Side::BUY, 100, 10}};
+            sent_at[i] = getCurrentNanos();
+            ASSERT(send(clients[i], &request, sizeof(request), 0) == sizeof(request), "client send() failed. error:" + string(strerror(errno)));
+            received[i] = 0;
+        }
+        for(size_t done = 0; done < num_clients;) {
+            poll();
+            for(size_t i = 0; i < num_clients; ++i) {
+                if(received[i] == sizeof(OMClientResponse)) {
+                    continue;
+                }
+                const auto n = recv(clients[i], reply + received[i], sizeof(OMClientResponse) - received[i], 0);
+                if(n > 0) {
+                    received[i] += n;
+                    if(received[i] == sizeof(OMClientResponse)) {
+                        rtts.push_back(getCurrentNanos() - sent_at[i]);
+                        ++done;
+                    }
+                }
+            }
+        }
+    }
+
+    for(auto fd : clients) {
+        close(fd);
+    }
+    sort(rtts.begin(), rtts.end());
+    return rtts;
+}
+
+auto runGateway(Logger &logger, size_t num_clients, int port) {
+    ClientRequestLFQueue requests(ME_MAX_CLIENT_UPDATES);
+    ClientResponseLFQueue responses(ME_MAX_CLIENT_UPDATES);
+    OrderGatewayCfg cfg;
+    cfg.iface_ = "lo";
+    cfg.port_ = port;
+    cfg.max_connections_ = num_clients;
+    OrderGateway gateway(&requests, &responses, logger, cfg);
+    gateway.listen();
+    const auto clients = connectClients(port, num_clients);
+
+    // the stand-in engine answers between two gateway rounds, the way a spinning gateway thread meets it
+    auto rtts = runRounds(clients, [&]() {
+        gateway.poll();
+        while(auto request = requests.getNextToRead()) {
+            auto response = responses.getNextToWriteTo();
+            *response = {ClientResponseType::ACCEPTED, request->client_id_, request->ticker_id_, request->order_id_, 1,
+                         request->side_, request->price_, 0, request->qty_};
+            responses.updateWriteIndex();
+            requests.updateReadIndex();
+        }
+        gateway.poll();
+    });
+    gateway.poll();
+    ASSERT(gateway.stats().requests_dropped_ == 0, "Gateway dropped requests. " + gateway.stats().toString());
+    return pair{rtts, gateway.stats().rx_to_forward_};
+}
+
+auto runEcho(Logger &logger, size_t num_clients, int port) {
+    TCPServer server(logger, num_clients);
+    // answers every whole request frame with a response sized one, the bytes are whatever the ring holds
+    server.recv_callback_ = [](TCPSocket *socket, Nanos) {
+        auto &inbound = socket->inbound_data_;
+        while(inbound.readable() >= sizeof(OMClientRequest) && socket->send(inbound.readPtr(), sizeof(OMClientResponse))) {
+            inbound.consume(sizeof(OMClientRequest));
+        }
+    };
+    server.listen("lo", port);
+    const auto clients = connectClients(port, num_clients);
+
+    return runRounds(clients, [&]() {
+        server.poll();
+        server.sendAndRecv();
+    });
+}
+
+int main(int, char **) {
+    Logger logger("order_gateway_benchmark.log");
+
+    int port = BASE_PORT;
+    cout << "server,clients,p50_ns,p99_ns,p99.9_ns,max_ns,rx_to_forward_mean_ns" << endl;
+    for(const auto num_clients : {1ul, 16ul}) {
+        const auto echo = runEcho(logger, num_clients, port++);
+        cout << "echo," << num_clients << "," << percentile(echo, 0.5) << "," << percentile(echo, 0.99) << ","
+             << percentile(echo, 0.999) << "," << echo.back() << "," << endl;
+
+        const auto [gateway, rx_to_forward] = runGateway(logger, num_clients, port++);
+        cout << "gateway," << num_clients << "," << percentile(gateway, 0.5) << "," << percentile(gateway, 0.99) << ","
+             << percentile(gateway, 0.999) << "," << gateway.back() << ","
+             << rx_to_forward.total_ / static_cast<Nanos>(rx_to_forward.count_) << endl;
+    }
+    return 0;
+}
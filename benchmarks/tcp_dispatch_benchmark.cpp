@@ -0,0 +1,118 @@
+#include "time_utils.h"
+#include "tcp_socket.h"
+
+#include <sys/socket.h>
+
+using namespace std;
+using namespace Common;
+
+// per read cost of handing received data to the business logic, through the recv_callback_ std::function every socket
+// carries versus a TCPRecvHandler the template sendAndRecv() calls directly
+// - dispatch:   64 sockets take turns, each gets a 64 byte message put into its inbound ring and handed over, no syscalls,
+//               so the difference is the dispatch alone: an indirect call the compiler cannot see through, and the handler
+//               state it forces out of registers, versus an inlined call
+// - socketpair: the same messages written to unix socketpairs and read with TCPSocket::sendAndRecv(), what the difference
+//               amounts to next to the recvmsg() / sendmsg() of a real read
+// the handler sums the first 8 bytes of each message and consumes it
+
+constexpr size_t NUM_SOCKETS = 64;
+constexpr size_t MSG_SIZE = 64;
+constexpr size_t DISPATCH_READS = 50 * 1000 * 1000;
+constexpr size_t SOCKETPAIR_READS = 1000 * 1000;
+
+struct SumHandler {
+    uint64_t sum_ = 0;
+
+    auto onRecv(TCPSocket *socket, Nanos) noexcept {
+        auto &inbound = socket->inbound_data_;
+        uint64_t value;
+        memcpy(&value, inbound.readPtr(), sizeof(value));
+        sum_ += value;
+        inbound.consume(inbound.readable());
+    }
+};
+
+auto makeSockets(Logger &logger) {
+    vector<unique_ptr<TCPSocket>> sockets;
+    for(size_t i = 0; i < NUM_SOCKETS; ++i) {
+        sockets.push_back(make_unique<TCPSocket>(logger, StorageCfg{}, 4096));
+    }
+    return sockets;
+}
+
+// every socket's recv_callback_ is a copy of the same std::function, the way TCPServer hands it out on accept
+auto setCallbacks(vector<unique_ptr<TCPSocket>> &sockets, SumHandler &handler) {
+    const function<void(TCPSocket *, Nanos)> callback = [&handler](TCPSocket *socket, Nanos rx_time) {
+        handler.onRecv(socket, rx_time);
+    };
+    for(auto &socket : sockets) {
+        socket->recv_callback_ = callback;
+    }
+}
+
+template<bool Template>
+auto runDispatch(Logger &logger) {
+    auto sockets = makeSockets(logger);
+    SumHandler handler;
+    setCallbacks(sockets, handler);
+    char msg[MSG_SIZE] = {1};
+
+    const auto start = getCurrentNanos();
+    for(size_t i = 0; i < DISPATCH_READS; ++i) {
+        auto socket = sockets[i % NUM_SOCKETS].get();
+        socket->inbound_data_.write(msg, MSG_SIZE);
+        if constexpr (Template) {
+            handler.onRecv(socket, 0);
+        } else {
+            socket->recv_callback_(socket, 0);
+        }
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    ASSERT(handler.sum_ == DISPATCH_READS, "Handler saw " + to_string(handler.sum_) + " of " + to_string(DISPATCH_READS) + " reads.");
+    return static_cast<double>(elapsed) / DISPATCH_READS;
+}
+
+template<bool Template>
+auto runSocketpair(Logger &logger) {
+    auto sockets = makeSockets(logger);
+    SumHandler handler;
+    setCallbacks(sockets, handler);
+    vector<int> peers;
+    for(auto &socket : sockets) {
+        int fds[2];
+        ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "socketpair() failed. error:" + string(strerror(errno)));
+        socket->socket_fd_ = fds[0];
+        peers.push_back(fds[1]);
+    }
+    char msg[MSG_SIZE] = {1};
+
+    const auto start = getCurrentNanos();
+    for(size_t i = 0; i < SOCKETPAIR_READS; ++i) {
+        const auto index = i % NUM_SOCKETS;
+        ASSERT(write(peers[index], msg, MSG_SIZE) == MSG_SIZE, "write() failed. error:" + string(strerror(errno)));
+        if constexpr (Template) {
+            sockets[index]->sendAndRecv(handler);
+        } else {
+            sockets[index]->sendAndRecv();
+        }
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    for(auto fd : peers) {
+        close(fd);
+    }
+    ASSERT(handler.sum_ == SOCKETPAIR_READS, "Handler saw " + to_string(handler.sum_) + " of " + to_string(SOCKETPAIR_READS) + " reads.");
+    return static_cast<double>(elapsed) / SOCKETPAIR_READS;
+}
+
+int main(int, char **) {
+    Logger logger("tcp_dispatch_benchmark.log");
+
+    cout << "path,handler,ns_per_read" << endl;
+    cout << "dispatch,std_function," << runDispatch<false>(logger) << endl;
+    cout << "dispatch,template," << runDispatch<true>(logger) << endl;
+    cout << "socketpair,std_function," << runSocketpair<false>(logger) << endl;
+    cout << "socketpair,template," << runSocketpair<true>(logger) << endl;
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "time_utils.h"
+#include "tcp_server.h"
+#include "bench_utils.h"
+
+#include <thread>
+#include <algorithm>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace Common;
+
+// loopback echo through TCPServer on each reactor backend: epoll, io_uring, and io_uring with a kernel submission poller
+// the server thread busy polls, the client sends one 64 byte message on every connection, then waits for all of them to
+// come back, and records each round trip
+// we report messages/sec and round trip percentiles, which include the client's own syscalls on both ends
+// sqpoll wants a spare core for its kernel thread, with fewer than 3 cores it competes with the server and client threads
+// and is skipped
+
+constexpr size_t MSG_SIZE = 64;
+constexpr size_t MSGS_PER_RUN = 100000;
+constexpr int BASE_PORT = 12345;
+
+// every run listens on a port of its own, a closed ring lets go of its listener asynchronously
+auto run(Logger &logger, const TCPServerCfg &cfg, size_t num_connections, int port) {
+    TCPServer server(logger, num_connections, cfg);
+    // echoes everything back as it arrives
+    server.recv_callback_ = [](TCPSocket *socket, Nanos) {
+        auto &inbound = socket->inbound_data_;
+        if(socket->send(inbound.readPtr(), inbound.readable())) {
+            inbound.consume(inbound.readable());
+        }
+    };
+    server.listen("lo", port);
+    const auto backend = server.backend();
+
+    atomic<bool> running = true;
+    thread server_thread([&server, &running]() {
+        while(running.load(memory_order_relaxed)) {
+            server.poll();
+            server.sendAndRecv();
+        }
+    });
+
+    vector<int> clients;
+    for(size_t i = 0; i < num_connections; ++i) {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{AF_INET, htons(port), {htonl(INADDR_LOOPBACK)}, {}};
+        ASSERT(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "connect() failed. error:" + string(strerror(errno)));
+        ASSERT(disableNagle(fd), "disableNagle() failed.");
+        clients.push_back(fd);
+    }
+
+    const size_t rounds = MSGS_PER_RUN / num_connections;
+    vector<Nanos> rtts;
+    rtts.reserve(rounds * num_connections);
+    vector<Nanos> sent_at(num_connections);
+    char msg[MSG_SIZE] = {};
+    char reply[MSG_SIZE];
+
+    const auto start = getCurrentNanos();
+    for(size_t round = 0; round < rounds; ++round) {
+        for(size_t i = 0; i < num_connections; ++i) {
+            sent_at[i] = getCurrentNanos();
+            ASSERT(send(clients[i], msg, MSG_SIZE, 0) == MSG_SIZE, "client send() failed. error:" + string(strerror(errno)));
+        }
+        for(size_t i = 0; i < num_connections; ++i) {
+            for(size_t received = 0; received < MSG_SIZE;) {
+                const auto n = recv(clients[i], reply + received, MSG_SIZE - received, 0);
+                ASSERT(n > 0, "client recv() failed. error:" + string(strerror(errno)));
+                received += n;
+            }
+            rtts.push_back(getCurrentNanos() - sent_at[i]);
+        }
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    for(auto fd : clients) {
+        close(fd);
+    }
+    running = false;
+    server_thread.join();
+
+    sort(rtts.begin(), rtts.end());
+    return tuple{backend, static_cast<double>(rtts.size()) / (static_cast<double>(elapsed) / NANOS_TO_SECS),
+                 percentile(rtts, 0.5), percentile(rtts, 0.99), percentile(rtts, 0.999), rtts.back()};
+}
+
+int main(int, char **) {
+    Logger logger("tcp_reactor_benchmark.log");
+
+    TCPServerCfg epoll_cfg;
+    TCPServerCfg uring_cfg;
+    uring_cfg.backend_ = TCPServerBackend::IO_URING;
+    auto sqpoll_cfg = uring_cfg;
+    sqpoll_cfg.sqpoll_ = true;
+
+    vector<TCPServerCfg> cfgs = {epoll_cfg, uring_cfg};
+    if(thread::hardware_concurrency() >= 3) {
+        cfgs.push_back(sqpoll_cfg);
+    }
+
+    int port = BASE_PORT;
+    cout << "backend,sqpoll,connections,msgs_per_sec,p50_ns,p99_ns,p99.9_ns,max_ns" << endl;
+    for(const auto num_connections : {1ul, 16ul, 64ul}) {
+        for(const auto &cfg : cfgs) {
+            const auto [backend, msgs_per_sec, p50, p99, p999, max_rtt] = run(logger, cfg, num_connections, port++);
+            cout << tcpServerBackendToString(backend) << "," << cfg.sqpoll_ << "," << num_connections << "," << msgs_per_sec << ","
+                 << p50 << "," << p99 << "," << p999 << "," << max_rtt << endl;
+        }
+    }
+    return 0;
+}
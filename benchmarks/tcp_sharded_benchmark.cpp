@@ -0,0 +1,154 @@
+#include "time_utils.h"
+#include "sharded_tcp_server.h"
+
+#include <thread>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace Common;
+
+// aggregate loopback throughput of ShardedTCPServer as reactors are added, one per core
+// every reactor parses fixed size 64 byte requests and queues them to a business logic thread which echoes them back
+// through the reactor's response queue, one client thread per reactor keeps CONNECTIONS_PER_CLIENT requests in flight,
+// one per connection, so the offered load grows with the number of reactors
+// the kernel spreads the connections over the reactors' listeners by hashing their addresses, so the split is not exact
+// scaling needs a core for each reactor and client thread plus the business logic thread, runs that do not fit on this
+// machine are skipped
+
+constexpr size_t MSG_SIZE = 64;
+constexpr size_t CONNECTIONS_PER_CLIENT = 16;
+constexpr size_t MSGS_PER_CLIENT = 100000;
+constexpr int BASE_PORT = 13345;
+
+struct Message {
+    uint64_t connection_id_ = 0;
+    char data_[MSG_SIZE];
+};
+
+auto client(int port, size_t *received_out) {
+    vector<int> fds;
+    for(size_t i = 0; i < CONNECTIONS_PER_CLIENT; ++i) {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{AF_INET, htons(port), {htonl(INADDR_LOOPBACK)}, {}};
+        ASSERT(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "connect() failed. error:" + string(strerror(errno)));
+        ASSERT(disableNagle(fd), "disableNagle() failed.");
+        fds.push_back(fd);
+    }
+
+    char msg[MSG_SIZE] = {};
+    char reply[MSG_SIZE];
+    size_t received = 0;
+    for(size_t round = 0; round < MSGS_PER_CLIENT / CONNECTIONS_PER_CLIENT; ++round) {
+        for(auto fd : fds) {
+            ASSERT(send(fd, msg, MSG_SIZE, 0) == MSG_SIZE, "client send() failed. error:" + string(strerror(errno)));
+        }
+        for(auto fd : fds) {
+            for(size_t n = 0; n < MSG_SIZE;) {
+                const auto r = recv(fd, reply + n, MSG_SIZE - n, 0);
+                ASSERT(r > 0, "client recv() failed. error:" + string(strerror(errno)));
+                n += r;
+            }
+            ++received;
+        }
+    }
+    for(auto fd : fds) {
+        close(fd);
+    }
+    *received_out = received;
+}
+
+auto run(Logger &logger, const TCPServerCfg &server_cfg, size_t num_reactors, int port) {
+    const auto num_cores = static_cast<int>(thread::hardware_concurrency());
+    ShardedTCPServerCfg cfg;
+    cfg.iface_ = "lo";
+    cfg.port_ = port;
+    cfg.max_connections_per_shard_ = CONNECTIONS_PER_CLIENT * num_reactors;
+    cfg.server_cfg_ = server_cfg;
+    // core 0 is left to the business logic thread
+    for(size_t i = 0; i < num_reactors; ++i) {
+        cfg.reactor_cores_.push_back(static_cast<int>(i + 1) % num_cores);
+    }
+
+    ShardedTCPServer<Message, Message> server(logger, cfg,
+        [](TCPSocket *socket, Nanos, SPSCLFQueue<Message> &requests) {
+            auto &inbound = socket->inbound_data_;
+            while(inbound.readable() >= MSG_SIZE) {
+                auto request = requests.getNextToWriteTo();
+                if(UNLIKELY(!request)) {
+                    break;
+                }
+                request->connection_id_ = socket->connection_id_;
+                memcpy(request->data_, inbound.readPtr(), MSG_SIZE);
+                requests.updateWriteIndex();
+                inbound.consume(MSG_SIZE);
+            }
+        },
+        [](TCPSocket *socket, const Message &response) {
+            socket->send(response.data_, MSG_SIZE);
+        });
+    server.start();
+
+    atomic<bool> running = true;
+    // requests handled per shard, shows how evenly SO_REUSEPORT spread the connections
+    vector<size_t> handled(num_reactors);
+    thread business([&server, &running, &handled]() {
+        setThreadCore(0);
+        while(running.load(memory_order_relaxed)) {
+            server.poll([&server, &handled](size_t shard, const Message &request) {
+                const auto responded = server.respond(shard, request);
+                handled[shard] += responded;
+                return responded;
+            });
+        }
+    });
+
+    vector<size_t> received(num_reactors);
+    vector<thread> clients;
+    const auto start = getCurrentNanos();
+    for(size_t i = 0; i < num_reactors; ++i) {
+        clients.emplace_back(client, port, &received[i]);
+    }
+    for(auto &c : clients) {
+        c.join();
+    }
+    const auto elapsed = getCurrentNanos() - start;
+
+    running = false;
+    business.join();
+    server.stop();
+
+    size_t total = 0;
+    for(auto r : received) {
+        total += r;
+    }
+    string split;
+    for(size_t i = 0; i < num_reactors; ++i) {
+        split += (i ? "/" : "") + to_string(handled[i]);
+    }
+    return pair{static_cast<double>(total) / (static_cast<double>(elapsed) / NANOS_TO_SECS), split};
+}
+
+int main(int, char **) {
+    Logger logger("tcp_sharded_benchmark.log");
+    const auto num_cores = thread::hardware_concurrency();
+
+    TCPServerCfg epoll_cfg;
+    TCPServerCfg uring_cfg;
+    uring_cfg.backend_ = TCPServerBackend::IO_URING;
+
+    int port = BASE_PORT;
+    cout << "backend,reactors,msgs_per_sec,per_reactor_msgs_per_sec" << endl;
+    for(const auto &server_cfg : {epoll_cfg, uring_cfg}) {
+        for(const auto num_reactors : {1ul, 2ul, 4ul, 8ul}) {
+            // a reactor and a client per shard, and the business logic thread
+            if(num_reactors > 1 && 2 * num_reactors + 1 > num_cores) {
+                break;
+            }
+            const auto [msgs_per_sec, split] = run(logger, server_cfg, num_reactors, port++);
+            cout << tcpServerBackendToString(server_cfg.backend_) << "," << num_reactors << "," << msgs_per_sec << ","
+                 << msgs_per_sec / static_cast<double>(num_reactors) << endl;
+            logger.log("backend:% reactors:% requests per shard:%\n", tcpServerBackendToString(server_cfg.backend_), num_reactors, split);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "time_utils.h"
+#include "tcp_socket.h"
+
+#include <thread>
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace Common;
+
+// loopback transmit cost of a stream of length-prefixed messages:
+// - copy:     TCPSocket::send() of the header and the payload into the outbound ring, then one sendPending() per message
+// - sendv:    TCPSocket::sendv() of {header, payload} straight from the caller's buffers in one sendmsg()
+// - zerocopy: the same with MSG_ZEROCOPY, payload buffers are only reused once their completion has been reaped
+// a receiver thread drains the other end, we report throughput and the sender thread's CPU time per message
+// note that over loopback the kernel always ends up copying zero-copy payloads (see zerocopy_copied), real NICs do not
+
+constexpr size_t BYTES_PER_RUN = 64 * 1024 * 1024;
+constexpr size_t NUM_PAYLOADS = 64;
+
+enum class Mode { COPY, SENDV, ZEROCOPY };
+
+auto threadCpuNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+}
+
+auto run(Logger &logger, Mode mode, size_t msg_size) {
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{AF_INET, 0, {htonl(INADDR_LOOPBACK)}, {}};
+    socklen_t addr_len = sizeof(addr);
+    ASSERT(bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 && listen(listener, 1) == 0 &&
+           getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &addr_len) == 0, "listener setup failed. error:" + string(strerror(errno)));
+
+    const size_t num_msgs = max<size_t>(BYTES_PER_RUN / msg_size, 1000);
+    const size_t total_bytes = num_msgs * (sizeof(uint64_t) + msg_size);
+    thread receiver([listener, total_bytes]() {
+        const int fd = accept(listener, nullptr, nullptr);
+        vector<char> buffer(4 * 1024 * 1024);
+        for(size_t received = 0; received < total_bytes;) {
+            const auto n = recv(fd, buffer.data(), buffer.size(), 0);
+            ASSERT(n > 0, "receiver recv() failed. error:" + string(strerror(errno)));
+            received += n;
+        }
+        close(fd);
+    });
+
+    TCPSocket socket(logger, {}, 4 * 1024 * 1024);
+    socket.socket_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(connect(socket.socket_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "connect() failed. error:" + string(strerror(errno)));
+    ASSERT(setNonBlocking(socket.socket_fd_) && disableNagle(socket.socket_fd_), "socket setup failed.");
+    socket.zerocopy_threshold_ = (mode == Mode::ZEROCOPY ? 0 : SIZE_MAX);
+
+    vector<vector<char>> payloads(NUM_PAYLOADS, vector<char>(msg_size, 'x'));
+    // completion id each payload buffer is waiting for, released ids are counted in order
+    vector<int64_t> payload_zerocopy_id(NUM_PAYLOADS, -1);
+    int64_t zerocopy_done = -1;
+    socket.zerocopy_callback_ = [&zerocopy_done](TCPSocket *, uint32_t, uint32_t last_id) {
+        zerocopy_done = max<int64_t>(zerocopy_done, last_id);
+    };
+
+    const auto cpu_start = threadCpuNanos();
+    const auto wall_start = getCurrentNanos();
+    for(size_t i = 0; i < num_msgs; ++i) {
+        const auto slot = i % NUM_PAYLOADS;
+        while(payload_zerocopy_id[slot] > zerocopy_done) {
+            socket.reapErrorQueue();
+            this_thread::yield();
+        }
+        const uint64_t header = msg_size;
+        const auto payload = payloads[slot].data();
+
+        if(mode == Mode::COPY) {
+            while(!socket.send(&header, sizeof(header))) {
+                socket.sendPending();
+                this_thread::yield();
+            }
+            while(!socket.send(payload, msg_size)) {
+                socket.sendPending();
+                this_thread::yield();
+            }
+            socket.sendPending();
+            continue;
+        }
+
+        iovec iov[2] = {{const_cast<uint64_t *>(&header), sizeof(header)}, {payload, msg_size}};
+        size_t first = 0;
+        while(first < 2) {
+            const auto result = socket.sendv(iov + first, 2 - first);
+            if(result.zerocopy_) {
+                payload_zerocopy_id[slot] = result.zerocopy_id_;
+            }
+            // skip what was taken and retry the rest once the kernel has room again.
+            for(auto left = result.accepted_; first < 2 && left;) {
+                const auto done = min(left, iov[first].iov_len);
+                iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + done;
+                iov[first].iov_len -= done;
+                left -= done;
+                first += !iov[first].iov_len;
+            }
+            if(first < 2) {
+                this_thread::yield();
+            }
+        }
+    }
+    while(!socket.sendPending()) {
+        this_thread::yield();
+    }
+    const auto cpu_ns = threadCpuNanos() - cpu_start;
+    receiver.join();
+    const auto wall_ns = getCurrentNanos() - wall_start;
+    while(socket.zeroCopyInFlight()) {
+        socket.reapErrorQueue();
+        this_thread::yield();
+    }
+    close(listener);
+
+    return tuple{num_msgs, static_cast<double>(total_bytes) / 1e6 / (static_cast<double>(wall_ns) / NANOS_TO_SECS),
+                 static_cast<double>(cpu_ns) / num_msgs, socket.zerocopy_copied_};
+}
+
+int main(int, char **) {
+    Logger logger("tcp_transmit_benchmark.log");
+
+    cout << "mode,msg_size,messages,MB_per_sec,cpu_ns_per_msg,zerocopy_copied" << endl;
+    for(const auto msg_size : {64ul, 1024ul, 16 * 1024ul, 256 * 1024ul}) {
+        for(const auto &[mode, name] : {pair{Mode::COPY, "copy"}, pair{Mode::SENDV, "sendv"}, pair{Mode::ZEROCOPY, "zerocopy"}}) {
+            const auto [num_msgs, mb_per_sec, cpu_ns_per_msg, copied] = run(logger, mode, msg_size);
+            cout << name << "," << msg_size << "," << num_msgs << "," << mb_per_sec << "," << cpu_ns_per_msg << "," << copied << endl;
+        }
+    }
+    return 0;
+}
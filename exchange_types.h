@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <sstream>
+
+#include "lf_queue.h"
+
+using namespace std;
+
+// ids, prices and the messages the matching engine reads and writes
+// prices are integer ticks, quantities whole lots, messages are packed fixed layout structs so they can go on the wire as is
+
+namespace Exchange {
+    typedef uint64_t OrderId;
+    typedef uint32_t TickerId;
+    typedef uint32_t ClientId;
+    typedef int64_t Price;
+    typedef uint32_t Qty;
+    typedef uint64_t Priority;
+
+    constexpr OrderId OrderId_INVALID = numeric_limits<OrderId>::max();
+    constexpr TickerId TickerId_INVALID = numeric_limits<TickerId>::max();
+    constexpr ClientId ClientId_INVALID = numeric_limits<ClientId>::max();
+    constexpr Price Price_INVALID = numeric_limits<Price>::max();
+    constexpr Qty Qty_INVALID = numeric_limits<Qty>::max();
+    constexpr Priority Priority_INVALID = numeric_limits<Priority>::max();
+
+    enum class Side : int8_t {
+        INVALID = 0,
+        BUY = 1,
+        SELL = -1
+    };
+
+    inline auto sideToString(Side side) -> string {
+        switch(side) {
+            case Side::BUY:
+                return "BUY";
+            case Side::SELL:
+                return "SELL";
+            case Side::INVALID:
+                return "INVALID";
+        }
+        return "UNKNOWN";
+    }
+
+    // capacity of the queues between the engine and the gateway / market data publisher
+    constexpr size_t ME_MAX_CLIENT_UPDATES = 256 * 1024;
+    constexpr size_t ME_MAX_MARKET_UPDATES = 256 * 1024;
+
+#pragma pack(push, 1)
+    enum class ClientRequestType : uint8_t {
+        INVALID = 0,
+        NEW = 1,
+        CANCEL = 2
+    };
+
+    inline auto clientRequestTypeToString(ClientRequestType type) -> string {
+        switch(type) {
+            case ClientRequestType::NEW:
+                return "NEW";
+            case ClientRequestType::CANCEL:
+                return "CANCEL";
+            case ClientRequestType::INVALID:
+                return "INVALID";
+        }
+        return "UNKNOWN";
+    }
+
+    // order_id_ is the client's own id for the order, unique per client, a cancel names the order it cancels by it
+    struct MEClientRequest {
+        ClientRequestType type_ = ClientRequestType::INVALID;
+        ClientId client_id_ = ClientId_INVALID;
+        TickerId ticker_id_ = TickerId_INVALID;
+        OrderId order_id_ = OrderId_INVALID;
+        Side side_ = Side::INVALID;
+        Price price_ = Price_INVALID;
+        Qty qty_ = Qty_INVALID;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MEClientRequest[type:" << clientRequestTypeToString(type_)
+            << " client:" << client_id_
+            << " ticker:" << ticker_id_
+            << " oid:" << order_id_
+            << " side:" << sideToString(side_)
+            << " price:" << price_
+            << " qty:" << qty_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    enum class ClientResponseType : uint8_t {
+        INVALID = 0,
+        ACCEPTED = 1,
+        CANCELED = 2,
+        FILLED = 3,
+        CANCEL_REJECTED = 4,
+        // a new order the book cannot take, e.g. a price outside the book's window
+        REJECTED = 5
+    };
+
+    inline auto clientResponseTypeToString(ClientResponseType type) -> string {
+        switch(type) {
+            case ClientResponseType::ACCEPTED:
+                return "ACCEPTED";
+            case ClientResponseType::CANCELED:
+                return "CANCELED";
+            case ClientResponseType::FILLED:
+                return "FILLED";
+            case ClientResponseType::CANCEL_REJECTED:
+                return "CANCEL_REJECTED";
+            case ClientResponseType::REJECTED:
+                return "REJECTED";
+            case ClientResponseType::INVALID:
+                return "INVALID";
+        }
+        return "UNKNOWN";
+    }
+
+    // exec_qty_ is what this fill executed, leaves_qty_ what is still open on the order
+    struct MEClientResponse {
+        ClientResponseType type_ = ClientResponseType::INVALID;
+        ClientId client_id_ = ClientId_INVALID;
+        TickerId ticker_id_ = TickerId_INVALID;
+        OrderId client_order_id_ = OrderId_INVALID;
+        OrderId market_order_id_ = OrderId_INVALID;
+        Side side_ = Side::INVALID;
+        Price price_ = Price_INVALID;
+        Qty exec_qty_ = Qty_INVALID;
+        Qty leaves_qty_ = Qty_INVALID;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MEClientResponse[type:" << clientResponseTypeToString(type_)
+            << " client:" << client_id_
+            << " ticker:" << ticker_id_
+            << " coid:" << client_order_id_
+            << " moid:" << market_order_id_
+            << " side:" << sideToString(side_)
+            << " exec_qty:" << exec_qty_
+            << " leaves_qty:" << leaves_qty_
+            << " price:" << price_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    enum class MarketUpdateType : uint8_t {
+        INVALID = 0,
+        // book entries, keyed by the market order id: a resting order was added, its quantity changed, it left the book
+        ADD = 1,
+        MODIFY = 2,
+        CANCEL = 3,
+        // an execution, at the passive order's price
+        TRADE = 4,
+        // consumers drop their book for the ticker, the first message of a snapshot
+        CLEAR = 5,
+        SNAPSHOT_START = 6,
+        SNAPSHOT_END = 7
+    };
+
+    inline auto marketUpdateTypeToString(MarketUpdateType type) -> string {
+        switch(type) {
+            case MarketUpdateType::ADD:
+                return "ADD";
+            case MarketUpdateType::MODIFY:
+                return "MODIFY";
+            case MarketUpdateType::CANCEL:
+                return "CANCEL";
+            case MarketUpdateType::TRADE:
+                return "TRADE";
+            case MarketUpdateType::CLEAR:
+                return "CLEAR";
+            case MarketUpdateType::SNAPSHOT_START:
+                return "SNAPSHOT_START";
+            case MarketUpdateType::SNAPSHOT_END:
+                return "SNAPSHOT_END";
+            case MarketUpdateType::INVALID:
+                return "INVALID";
+        }
+        return "UNKNOWN";
+    }
+
+    // priority_ is the order's place in the FIFO queue at its price
+    struct MEMarketUpdate {
+        MarketUpdateType type_ = MarketUpdateType::INVALID;
+        OrderId order_id_ = OrderId_INVALID;
+        TickerId ticker_id_ = TickerId_INVALID;
+        Side side_ = Side::INVALID;
+        Price price_ = Price_INVALID;
+        Qty qty_ = Qty_INVALID;
+        Priority priority_ = Priority_INVALID;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MEMarketUpdate[type:" << marketUpdateTypeToString(type_)
+            << " ticker:" << ticker_id_
+            << " oid:" << order_id_
+            << " side:" << sideToString(side_)
+            << " qty:" << qty_
+            << " price:" << price_
+            << " priority:" << priority_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // what the market data publisher sends, one per datagram
+    // seq_num_ counts the messages of a stream: the incremental stream from 1 for its whole life, a snapshot from 0 at its
+    // SNAPSHOT_START, whose order_id_ (as its SNAPSHOT_END's) is the last incremental seq_num_ the snapshot includes
+    struct MDPMarketUpdate {
+        uint64_t seq_num_ = 0;
+        MEMarketUpdate me_market_update_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MDPMarketUpdate[seq:" << seq_num_
+            << " " << me_market_update_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+    static_assert(sizeof(MDPMarketUpdate) == sizeof(uint64_t) + sizeof(MEMarketUpdate), "MDPMarketUpdate's layout is the wire format.");
+#pragma pack(pop)
+
+    // single producer single consumer: the gateway feeds the engine, the engine feeds the gateway and the publisher, the
+    // publisher feeds the snapshot synthesizer
+    typedef Common::SPSCLFQueue<MEClientRequest> ClientRequestLFQueue;
+    typedef Common::SPSCLFQueue<MEClientResponse> ClientResponseLFQueue;
+    typedef Common::SPSCLFQueue<MEMarketUpdate> MEMarketUpdateLFQueue;
+    typedef Common::SPSCLFQueue<MDPMarketUpdate> MDPMarketUpdateLFQueue;
+}
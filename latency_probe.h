@@ -0,0 +1,280 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "macros.h"
+#include "tsc_clock.h"
+
+using namespace std;
+
+// hot path latency probes
+// every probe site has a static id and records TSC tick deltas into a log-linear (HDR style) histogram owned by the
+// recording thread, so recording is an rdtsc, a bucket computation and a plain increment - no atomic read-modify-write
+// and no shared cache lines
+// a reporter thread merges every thread's histograms and periodically emits p50/p99/p99.9/max per site for the last period,
+// percentiles to the histogram's precision and the max exact, each histogram keeps its thread's alongside the counts
+// build with -DDISABLE_LATENCY_PROBES (cmake -DLATENCY_PROBES=OFF) to compile every probe out
+
+namespace Common {
+    constexpr size_t MAX_PROBE_SITES = 64;
+
+    // 2^SUB_BUCKET_BITS linear buckets per power of two, i.e. values are kept with a relative error under 1/32
+    // values are in TSC ticks and clamped to 2^MAX_MAGNITUDE
+    class LatencyHistogram final {
+        public:
+        static constexpr size_t SUB_BUCKET_BITS = 5;
+        static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static constexpr size_t MAX_MAGNITUDE = 47;
+        static constexpr size_t NUM_BUCKETS = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+        static constexpr auto bucketIndex(uint64_t value) noexcept -> size_t {
+            if(value < SUB_BUCKETS) {
+                return value;
+            }
+            const size_t magnitude = min<size_t>(63 - __builtin_clzll(value), MAX_MAGNITUDE);
+            const auto shift = magnitude - SUB_BUCKET_BITS;
+            return ((shift + 1) << SUB_BUCKET_BITS) + ((min(value >> shift, 2 * SUB_BUCKETS - 1)) & (SUB_BUCKETS - 1));
+        }
+
+        static constexpr auto bucketLowerBound(size_t index) noexcept -> uint64_t {
+            if(index < SUB_BUCKETS) {
+                return index;
+            }
+            const auto shift = (index >> SUB_BUCKET_BITS) - 1;
+            return (SUB_BUCKETS + (index & (SUB_BUCKETS - 1))) << shift;
+        }
+
+        // owning thread only
+        auto record(uint64_t value) noexcept {
+            auto &count = counts_[bucketIndex(value)];
+            count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            if(UNLIKELY(value > max_.load(memory_order_relaxed))) {
+                max_.store(value, memory_order_relaxed);
+            }
+        }
+
+        // any thread
+        auto count(size_t index) const noexcept {
+            return counts_[index].load(memory_order_relaxed);
+        }
+
+        // any thread, the largest value recorded since the previous call, exact and not clamped
+        // a sample racing with the reset may be left out of it, summarize() keeps the max at least its bucket's bound
+        auto takeMax() noexcept {
+            return max_.exchange(0, memory_order_relaxed);
+        }
+
+        private:
+        atomic<uint64_t> counts_[NUM_BUCKETS] = {};
+        atomic<uint64_t> max_ = 0;
+    };
+
+    // percentiles of one site over one reporting period, in nanoseconds
+    struct LatencySummary {
+        string site_;
+        uint64_t count_ = 0;
+        Nanos p50_ = 0;
+        Nanos p99_ = 0;
+        Nanos p999_ = 0;
+        Nanos max_ = 0;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "LatencySummary[site:" << site_
+            << " count:" << count_
+            << " p50:" << p50_
+            << " p99:" << p99_
+            << " p99.9:" << p999_
+            << " max:" << max_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    class LatencyProbes final {
+        public:
+        static auto instance() noexcept -> LatencyProbes & {
+            static LatencyProbes probes;
+            return probes;
+        }
+
+        // called once per probe site through a function local static, returns the site's id
+        auto registerSite(const char *name) noexcept -> uint32_t {
+            lock_guard<mutex> lock(mutex_);
+            for(size_t i = 0; i < site_names_.size(); ++i) {
+                if(site_names_[i] == name) {
+                    return static_cast<uint32_t>(i);
+                }
+            }
+            ASSERT(site_names_.size() < MAX_PROBE_SITES, "Too many latency probe sites, raise MAX_PROBE_SITES.");
+            site_names_.emplace_back(name);
+            return static_cast<uint32_t>(site_names_.size() - 1);
+        }
+
+        static auto record(uint32_t site, uint64_t ticks) noexcept {
+            thread_local ThreadHistograms *thread_histograms = instance().registerThread();
+            auto histogram = thread_histograms->histograms_[site].load(memory_order_relaxed);
+            if(UNLIKELY(!histogram)) { // first sample of this site on this thread.
+                histogram = new LatencyHistogram();
+                thread_histograms->histograms_[site].store(histogram, memory_order_release);
+            }
+            histogram->record(ticks);
+        }
+
+        // percentiles per site for the samples recorded since the previous call, sites without samples are skipped
+        auto summarize() noexcept -> vector<LatencySummary> {
+            lock_guard<mutex> lock(mutex_);
+            vector<LatencySummary> summaries;
+            vector<uint64_t> counts(LatencyHistogram::NUM_BUCKETS);
+            previous_counts_.resize(site_names_.size(), vector<uint64_t>(LatencyHistogram::NUM_BUCKETS, 0));
+            for(size_t site = 0; site < site_names_.size(); ++site) {
+                fill(counts.begin(), counts.end(), 0);
+                uint64_t max_ticks = 0;
+                for(auto &thread_histograms : threads_) {
+                    if(auto histogram = thread_histograms->histograms_[site].load(memory_order_acquire)) {
+                        for(size_t i = 0; i < counts.size(); ++i) {
+                            counts[i] += histogram->count(i);
+                        }
+                        max_ticks = max(max_ticks, histogram->takeMax());
+                    }
+                }
+
+                LatencySummary summary{site_names_[site]};
+                for(size_t i = 0; i < counts.size(); ++i) {
+                    const auto cumulative = counts[i];
+                    counts[i] -= previous_counts_[site][i];
+                    previous_counts_[site][i] = cumulative;
+                    summary.count_ += counts[i];
+                }
+                if(!summary.count_) {
+                    continue;
+                }
+
+                const auto &clock = TSCClock::instance();
+                // smallest bucket holding at least p of the samples
+                auto percentile = [&](double p) {
+                    const auto rank = max<uint64_t>(static_cast<uint64_t>(ceil(p * static_cast<double>(summary.count_))), 1) - 1;
+                    uint64_t seen = 0;
+                    for(size_t i = 0; i < counts.size(); ++i) {
+                        seen += counts[i];
+                        if(seen > rank) {
+                            return clock.ticksToNanos(LatencyHistogram::bucketLowerBound(i));
+                        }
+                    }
+                    return Nanos{0};
+                };
+                summary.p50_ = percentile(0.5);
+                summary.p99_ = percentile(0.99);
+                summary.p999_ = percentile(0.999);
+                summary.max_ = max(clock.ticksToNanos(max_ticks), percentile(1.0));
+                summaries.push_back(summary);
+            }
+            return summaries;
+        }
+
+        // calls emit with every site's summary once per period on a background thread, until stopReporter()
+        auto startReporter(Nanos period, function<void(const LatencySummary &)> emit) -> void {
+            ASSERT(!reporter_thread_.joinable(), "Latency reporter already running.");
+            reporter_running_ = true;
+            reporter_thread_ = thread([this, period, emit]() {
+                unique_lock<mutex> lock(reporter_mutex_);
+                while(!reporter_wakeup_.wait_for(lock, chrono::nanoseconds(period), [this]() { return !reporter_running_; })) {
+                    for(const auto &summary : summarize()) {
+                        emit(summary);
+                    }
+                }
+            });
+        }
+
+        auto stopReporter() -> void {
+            {
+                lock_guard<mutex> lock(reporter_mutex_);
+                reporter_running_ = false;
+            }
+            reporter_wakeup_.notify_one();
+            if(reporter_thread_.joinable()) {
+                reporter_thread_.join();
+            }
+        }
+
+        ~LatencyProbes() {
+            stopReporter();
+        }
+
+        LatencyProbes(const LatencyProbes &) = delete;
+
+        LatencyProbes(const LatencyProbes &&) = delete;
+
+        LatencyProbes &operator=(const LatencyProbes &) = delete;
+
+        LatencyProbes &operator=(const LatencyProbes &&) = delete;
+
+        private:
+        LatencyProbes() = default;
+
+        // a thread's histograms outlive the thread so its samples still show up in reports
+        struct ThreadHistograms {
+            atomic<LatencyHistogram *> histograms_[MAX_PROBE_SITES] = {};
+        };
+
+        auto registerThread() noexcept -> ThreadHistograms * {
+            lock_guard<mutex> lock(mutex_);
+            threads_.emplace_back(make_unique<ThreadHistograms>());
+            return threads_.back().get();
+        }
+
+        mutex mutex_;
+        vector<string> site_names_;
+        vector<unique_ptr<ThreadHistograms>> threads_;
+        vector<vector<uint64_t>> previous_counts_;
+
+        mutex reporter_mutex_;
+        condition_variable reporter_wakeup_;
+        bool reporter_running_ = false;
+        thread reporter_thread_;
+    };
+
+    // records the time from construction to destruction under site
+    class LatencyProbeScope final {
+        public:
+        explicit LatencyProbeScope(uint32_t site) noexcept : site_(site), start_(TSCClock::ticks()) {}
+
+        ~LatencyProbeScope() {
+            LatencyProbes::record(site_, TSCClock::ticks() - start_);
+        }
+
+        private:
+        const uint32_t site_;
+        const uint64_t start_;
+    };
+}
+
+#define LATENCY_PROBE_CONCAT_(a, b) a##b
+#define LATENCY_PROBE_CONCAT(a, b) LATENCY_PROBE_CONCAT_(a, b)
+
+#ifndef DISABLE_LATENCY_PROBES
+// LATENCY_PROBE_START(tag) ... LATENCY_PROBE_END(tag, "site") measures the code in between, tag only has to be unique in the scope
+#define LATENCY_PROBE_START(tag) const auto tag##_probe_start = Common::TSCClock::ticks()
+#define LATENCY_PROBE_END(tag, site_name) do { \
+        static const auto tag##_probe_site = Common::LatencyProbes::instance().registerSite(site_name); \
+        Common::LatencyProbes::record(tag##_probe_site, Common::TSCClock::ticks() - tag##_probe_start); \
+    } while(false)
+// measures the rest of the enclosing scope
+#define LATENCY_PROBE_SCOPE(site_name) \
+    static const auto LATENCY_PROBE_CONCAT(probe_site_, __LINE__) = Common::LatencyProbes::instance().registerSite(site_name); \
+    const Common::LatencyProbeScope LATENCY_PROBE_CONCAT(probe_scope_, __LINE__)(LATENCY_PROBE_CONCAT(probe_site_, __LINE__))
+#else
+#define LATENCY_PROBE_START(tag) do {} while(false)
+#define LATENCY_PROBE_END(tag, site_name) do {} while(false)
+#define LATENCY_PROBE_SCOPE(site_name) do {} while(false)
+#endif
@@ -3,8 +3,13 @@
 #include <iostream>
 #include <vector>
 #include <atomic>
+#include <span>
+#include <bit>
+#include <algorithm>
+#include <optional>
 
 #include "macros.h"
+#include "mem_utils.h"
 
 using namespace std;
 
@@ -12,7 +17,7 @@ namespace Common {
     template<typename T>
     class LFQueue final {
         public:
-        LFQueue(size_t num_elems) : store_(num_elems, T()) {}
+        LFQueue(size_t num_elems, const StorageCfg &storage_cfg = {}) : store_(num_elems, T(), StorageAllocator<T>(storage_cfg)) {}
 
         auto getNextToWriteTo() noexcept {
             return &store_[next_write_index_];
@@ -37,6 +42,10 @@ namespace Common {
             return num_elements_.load();
         }
 
+        auto storageInfo() const noexcept -> StorageInfo {
+            return store_.get_allocator().info();
+        }
+
         LFQueue() = delete;
 
         LFQueue(const LFQueue &) = delete;
@@ -49,9 +58,305 @@ namespace Common {
 
         private:
 
-        vector<T> store_;
+        vector<T, StorageAllocator<T>> store_;
         atomic<size_t> next_write_index_ = {0};
         atomic<size_t> next_read_index_ = {0};
         atomic<size_t> num_elements_ = {0};
     };
+
+    // single producer single consumer queue where the producer and consumer never write to the same cache line
+    // the capacity is rounded up to a power of two so wraparound is a mask instead of a divide
+    // each side keeps a cached copy of the other side's index and only reloads it when the cached one says full/empty
+    // indices grow monotonically, (index & mask_) is the slot, (write - read) is the number of elements
+    template<typename T>
+    class SPSCLFQueue final {
+        public:
+        explicit SPSCLFQueue(size_t num_elems, const StorageCfg &storage_cfg = {}) :
+            store_(bit_ceil(num_elems), T(), StorageAllocator<T>(storage_cfg)), mask_(store_.size() - 1) {
+            ASSERT(num_elems > 0, "SPSCLFQueue needs a non zero capacity.");
+        }
+
+        // producer side, returns nullptr when the queue is full
+        auto getNextToWriteTo() noexcept -> T* {
+            const auto write_index = producer_.index_.load(memory_order_relaxed);
+            if(UNLIKELY(write_index - producer_.cached_remote_index_ == store_.size())) {
+                producer_.cached_remote_index_ = consumer_.index_.load(memory_order_acquire);
+                if(write_index - producer_.cached_remote_index_ == store_.size()) {
+                    return nullptr;
+                }
+            }
+            return &store_[write_index & mask_];
+        }
+
+        auto updateWriteIndex() noexcept {
+            producer_.index_.store(producer_.index_.load(memory_order_relaxed) + 1, memory_order_release);
+        }
+
+        // claims up to n contiguous free slots, the span is shorter than n if the queue is nearly full or the slots wrap around
+        auto getNextToWriteTo(size_t n) noexcept -> span<T> {
+            const auto write_index = producer_.index_.load(memory_order_relaxed);
+            auto free_slots = store_.size() - (write_index - producer_.cached_remote_index_);
+            if(free_slots < n) {
+                producer_.cached_remote_index_ = consumer_.index_.load(memory_order_acquire);
+                free_slots = store_.size() - (write_index - producer_.cached_remote_index_);
+            }
+            const auto slot = write_index & mask_;
+            return {&store_[slot], min({n, free_slots, store_.size() - slot})};
+        }
+
+        // publishes n slots written through the batch getNextToWriteTo() with a single release store
+        auto updateWriteIndex(size_t n) noexcept {
+            producer_.index_.store(producer_.index_.load(memory_order_relaxed) + n, memory_order_release);
+        }
+
+        // consumer side, returns nullptr when the queue is empty
+        auto getNextToRead() noexcept -> const T* {
+            const auto read_index = consumer_.index_.load(memory_order_relaxed);
+            if(read_index == consumer_.cached_remote_index_) {
+                consumer_.cached_remote_index_ = producer_.index_.load(memory_order_acquire);
+                if(read_index == consumer_.cached_remote_index_) {
+                    return nullptr;
+                }
+            }
+            return &store_[read_index & mask_];
+        }
+
+        auto updateReadIndex() noexcept {
+            const auto read_index = consumer_.index_.load(memory_order_relaxed);
+            if(UNLIKELY(read_index == consumer_.cached_remote_index_)) {
+                FATAL("Read an invalid element in:" + to_string(pthread_self()));
+            }
+            consumer_.index_.store(read_index + 1, memory_order_release);
+        }
+
+        // peeks up to n contiguous readable elements without consuming them
+        auto getNextToRead(size_t n) noexcept -> span<const T> {
+            const auto read_index = consumer_.index_.load(memory_order_relaxed);
+            auto available = consumer_.cached_remote_index_ - read_index;
+            if(available < n) {
+                consumer_.cached_remote_index_ = producer_.index_.load(memory_order_acquire);
+                available = consumer_.cached_remote_index_ - read_index;
+            }
+            const auto slot = read_index & mask_;
+            return {&store_[slot], min({n, available, store_.size() - slot})};
+        }
+
+        // releases n elements returned by the batch getNextToRead() back to the producer
+        auto updateReadIndex(size_t n) noexcept {
+            const auto read_index = consumer_.index_.load(memory_order_relaxed);
+            if(UNLIKELY(consumer_.cached_remote_index_ - read_index < n)) {
+                FATAL("Released more elements than were read in:" + to_string(pthread_self()));
+            }
+            consumer_.index_.store(read_index + n, memory_order_release);
+        }
+
+        // approximate when called from a thread other than the producer or consumer
+        auto size() const noexcept {
+            const auto read_index = consumer_.index_.load(memory_order_acquire);
+            return producer_.index_.load(memory_order_acquire) - read_index;
+        }
+
+        auto capacity() const noexcept {
+            return store_.size();
+        }
+
+        auto storageInfo() const noexcept -> StorageInfo {
+            return store_.get_allocator().info();
+        }
+
+        SPSCLFQueue() = delete;
+
+        SPSCLFQueue(const SPSCLFQueue &) = delete;
+
+        SPSCLFQueue(const SPSCLFQueue &&) = delete;
+
+        SPSCLFQueue &operator=(const SPSCLFQueue &) = delete;
+
+        SPSCLFQueue &operator=(const SPSCLFQueue &&) = delete;
+
+        private:
+        // index_ is written only by its owner, cached_remote_index_ is the owner's last view of the other side
+        struct alignas(CACHE_LINE_SIZE) Cursor {
+            atomic<size_t> index_ = {0};
+            size_t cached_remote_index_ = 0;
+        };
+
+        // store_ and mask_ are read-only after construction so they can share a line read by both threads
+        alignas(CACHE_LINE_SIZE) vector<T, StorageAllocator<T>> store_;
+        const size_t mask_;
+
+        Cursor producer_;
+        Cursor consumer_;
+    };
+
+    // bounded multi producer queue with a sequence number per slot, so producers never serialize on a lock
+    // a producer claims a slot by advancing enqueue_pos_ with a CAS and publishes it by bumping the slot's sequence
+    // sequence == pos: free for the producer of pos, sequence == pos + 1: published for the consumer of pos,
+    // sequence == pos + capacity: released by the consumer and free for the producer of the next lap
+    // with MultiConsumer = false the consumer side needs no atomic read-modify-write at all
+    template<typename T, bool MultiConsumer>
+    class MPLFQueue final {
+        public:
+        explicit MPLFQueue(size_t num_elems, const StorageCfg &storage_cfg = {}) :
+            store_(bit_ceil(num_elems), StorageAllocator<Slot>(storage_cfg)), mask_(store_.size() - 1) {
+            ASSERT(num_elems > 0, "MPLFQueue needs a non zero capacity.");
+            ASSERT(reinterpret_cast<const Slot *>(&(store_[0].object_)) == &(store_[0]), "T object should be first member of Slot.");
+            for(size_t i = 0; i < store_.size(); ++i) {
+                store_[i].sequence_.store(i, memory_order_relaxed);
+            }
+        }
+
+        // claims the next slot for the calling producer, returns nullptr when the queue is full
+        auto getNextToWriteTo() noexcept -> T* {
+            auto pos = producer_pos_.load(memory_order_relaxed);
+            while(true) {
+                auto slot = &store_[pos & mask_];
+                const auto sequence = slot->sequence_.load(memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if(LIKELY(diff == 0)) {
+                    if(producer_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                        return &(slot->object_);
+                    }
+                } else if(diff < 0) {
+                    return nullptr;
+                } else {
+                    pos = producer_pos_.load(memory_order_relaxed);
+                }
+            }
+        }
+
+        // publishes a slot returned by getNextToWriteTo(), slots claimed by different producers can be published in any order
+        auto updateWriteIndex(T *elem) noexcept {
+            auto slot = reinterpret_cast<Slot *>(elem);
+            slot->sequence_.store(slot->sequence_.load(memory_order_relaxed) + 1, memory_order_release);
+        }
+
+        // returns the next published element or nullptr, for multiple consumers this also claims it for the caller
+        auto getNextToRead() noexcept -> const T* {
+            auto pos = consumer_pos_.load(memory_order_relaxed);
+            while(true) {
+                auto slot = &store_[pos & mask_];
+                const auto sequence = slot->sequence_.load(memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+                if(diff < 0) {
+                    return nullptr;
+                }
+                if constexpr (!MultiConsumer) {
+                    return &(slot->object_);
+                } else {
+                    if(diff == 0) {
+                        if(consumer_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                            return &(slot->object_);
+                        }
+                    } else {
+                        pos = consumer_pos_.load(memory_order_relaxed);
+                    }
+                }
+            }
+        }
+
+        // hands a slot returned by getNextToRead() back to the producers of the next lap
+        auto updateReadIndex(const T *elem) noexcept {
+            auto slot = const_cast<Slot *>(reinterpret_cast<const Slot *>(elem));
+            if constexpr (!MultiConsumer) {
+                consumer_pos_.store(consumer_pos_.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            }
+            slot->sequence_.store(slot->sequence_.load(memory_order_relaxed) + mask_, memory_order_release);
+        }
+
+        // batch API for variable length records spread over consecutive slots, single consumer only
+        // claims n consecutive slots for the calling producer, returns the position of the first one or nullopt when full
+        // the last slot decides: the consumer releases in order, so if it is free for this lap all the ones before it are too
+        auto claim(size_t n) noexcept -> optional<size_t> {
+            static_assert(!MultiConsumer, "claim() needs the in order release of a single consumer.");
+            auto pos = producer_pos_.load(memory_order_relaxed);
+            while(true) {
+                const auto last = pos + n - 1;
+                const auto sequence = store_[last & mask_].sequence_.load(memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(last);
+                if(LIKELY(diff == 0)) {
+                    if(producer_pos_.compare_exchange_weak(pos, pos + n, memory_order_relaxed)) {
+                        return pos;
+                    }
+                } else if(diff < 0) {
+                    return nullopt;
+                } else {
+                    pos = producer_pos_.load(memory_order_relaxed);
+                }
+            }
+        }
+
+        auto at(size_t pos) noexcept -> T* {
+            return &(store_[pos & mask_].object_);
+        }
+
+        // publishes n slots returned by claim(), the first one last so a consumer that sees it also sees all the others
+        auto publish(size_t pos, size_t n) noexcept {
+            for(size_t i = n; i-- > 0;) {
+                store_[(pos + i) & mask_].sequence_.store(pos + i + 1, memory_order_release);
+            }
+        }
+
+        // peeks at the element offset places after the next one to read, nullptr if it is not published yet
+        auto peek(size_t offset) const noexcept -> const T* {
+            static_assert(!MultiConsumer, "peek() needs a single consumer.");
+            const auto pos = consumer_pos_.load(memory_order_relaxed) + offset;
+            const auto &slot = store_[pos & mask_];
+            return (slot.sequence_.load(memory_order_acquire) == pos + 1 ? &(slot.object_) : nullptr);
+        }
+
+        // releases the next n elements to the producers of the next lap
+        auto release(size_t n) noexcept {
+            static_assert(!MultiConsumer, "release() needs a single consumer.");
+            const auto pos = consumer_pos_.load(memory_order_relaxed);
+            for(size_t i = 0; i < n; ++i) {
+                store_[(pos + i) & mask_].sequence_.store(pos + i + store_.size(), memory_order_release);
+            }
+            consumer_pos_.store(pos + n, memory_order_relaxed);
+        }
+
+        // approximate, counts slots that are claimed but not yet published or released
+        auto size() const noexcept {
+            const auto read_pos = consumer_pos_.load(memory_order_acquire);
+            const auto write_pos = producer_pos_.load(memory_order_acquire);
+            return (write_pos > read_pos ? write_pos - read_pos : 0);
+        }
+
+        auto capacity() const noexcept {
+            return store_.size();
+        }
+
+        auto storageInfo() const noexcept -> StorageInfo {
+            return store_.get_allocator().info();
+        }
+
+        MPLFQueue() = delete;
+
+        MPLFQueue(const MPLFQueue &) = delete;
+
+        MPLFQueue(const MPLFQueue &&) = delete;
+
+        MPLFQueue &operator=(const MPLFQueue &) = delete;
+
+        MPLFQueue &operator=(const MPLFQueue &&) = delete;
+
+        private:
+        // object_ comes first so the T* handed out by the queue can be cast back to its Slot, like MemPool's ObjectBlock
+        struct Slot {
+            T object_ = T();
+            atomic<size_t> sequence_ = {0};
+        };
+
+        alignas(CACHE_LINE_SIZE) vector<Slot, StorageAllocator<Slot>> store_;
+        const size_t mask_;
+
+        alignas(CACHE_LINE_SIZE) atomic<size_t> producer_pos_ = {0};
+        alignas(CACHE_LINE_SIZE) atomic<size_t> consumer_pos_ = {0};
+    };
+
+    template<typename T>
+    using MPSCLFQueue = MPLFQueue<T, false>;
+
+    template<typename T>
+    using MPMCLFQueue = MPLFQueue<T, true>;
 }
\ No newline at end of file
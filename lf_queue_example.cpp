@@ -14,7 +14,7 @@ auto consumeFunction(LFQueue<MyStruct>* lfq){
     this_thread::sleep_for(5s);
 
     while(lfq->size()){
-        const auto d = lfq->getNextRead();
+        const auto d = lfq->getNextToRead();
         lfq->updateReadIndex();
         cout << "consumeFunction read elem:" << d->d_[0] << "," << d->d_[1] << "," << d->d_[2] << " lfq-size:" << lfq->size() << endl;
         this_thread::sleep_for(1s);
@@ -30,7 +30,7 @@ int main() {
 
     for(auto i=0; i<50; ++i){
         const MyStruct d{i, i*10, i*100};
-        *(lfq.getNextWriteTo()) = d;
+        *(lfq.getNextToWriteTo()) = d;
         lfq.updateWriteIndex();
 
         std::cout << "main constructed elem:" << d.d_[0] << "," << d.d_[1] << "," << d.d_[2] << " lfq-size:" << lfq.size() << std::endl;
@@ -39,7 +39,7 @@ int main() {
         this_thread::sleep_for(1s);
     }
 
-    ct->join();
+    ct.join();
     cout<<"main exiting."<<endl;
     return 0;
 }
@@ -0,0 +1,60 @@
+#include <fstream>
+
+#include "logging.h"
+
+using namespace std;
+
+// turns a binary log written by a Logger in LogFileMode::BINARY into the text the Logger would have written
+// usage: log_decoder <binary log file> [-t]
+// -t prefixes every record with its timestamp in nanoseconds since epoch
+
+int main(int argc, char **argv) {
+    using namespace Common;
+
+    if(argc < 2) {
+        cerr << "usage: " << argv[0] << " <binary log file> [-t]" << endl;
+        return EXIT_FAILURE;
+    }
+    const bool print_timestamps = (argc > 2 && string(argv[2]) == "-t");
+
+    ifstream file(argv[1], ios::in | ios::binary);
+    ASSERT(file.is_open(), "Could not open log file:" + string(argv[1]));
+
+    char magic[sizeof(LOG_FILE_MAGIC)];
+    ASSERT(file.read(magic, sizeof(magic)) && !memcmp(magic, LOG_FILE_MAGIC, sizeof(magic)), "Not a binary log file:" + string(argv[1]));
+
+    auto read = [&file]<typename T>(T *value) {
+        return static_cast<bool>(file.read(reinterpret_cast<char *>(value), sizeof(T)));
+    };
+
+    vector<ParsedLogFormat> formats;
+    string args;
+    LogFileEntry entry;
+    while(read(&entry)) {
+        uint32_t format_id;
+        ASSERT(read(&format_id), "Truncated entry in:" + string(argv[1]));
+        if(entry == LogFileEntry::FORMAT) {
+            uint32_t len;
+            ASSERT(read(&len), "Truncated format in:" + string(argv[1]));
+            string format(len, '\0');
+            ASSERT(static_cast<bool>(file.read(format.data(), len)), "Truncated format in:" + string(argv[1]));
+            ASSERT(format_id == formats.size(), "Unexpected format id:" + to_string(format_id));
+            formats.emplace_back(format.c_str());
+            continue;
+        }
+
+        Nanos timestamp;
+        uint32_t args_size;
+        ASSERT(read(&timestamp) && read(&args_size), "Truncated record in:" + string(argv[1]));
+        args.resize(args_size);
+        if(!file.read(args.data(), args_size)) {
+            break; // the writer was stopped in the middle of this record.
+        }
+        ASSERT(format_id < formats.size(), "Record references unknown format id:" + to_string(format_id));
+        if(print_timestamps) {
+            cout << timestamp << " ";
+        }
+        formatLogRecord(formats[format_id], args.data(), args.size(), cout);
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <charconv>
+#include <new>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <cstdio>
+
+#include "macros.h"
+#include "time_utils.h"
+
+using namespace std;
+
+// file side of the Logger, only ever used from the Logger thread
+// records are formatted (or copied, for binary logs) into a ring of large page aligned buffers, and all filled buffers go
+// to the kernel in one writev() when the Logger decides to flush or when every buffer is full
+// the file is rotated on size and/or age: the current file is renamed to <file_name>.<n> and a fresh <file_name> started
+
+namespace Common {
+    constexpr size_t LOG_BUFFER_ALIGNMENT = 4096;
+
+    class LogFileWriter final {
+        public:
+        // file_header is written at the start of every file, including the ones started by rotation
+        LogFileWriter(const string &file_name, size_t buffer_size, size_t num_buffers, size_t rotate_bytes, Nanos rotate_interval,
+                      string_view file_header) :
+            file_name_(file_name), buffer_size_(buffer_size), rotate_bytes_(rotate_bytes), rotate_interval_(rotate_interval),
+            file_header_(file_header) {
+            ASSERT(buffer_size > 0 && num_buffers > 0 && num_buffers <= IOV_MAX, "LogFileWriter needs 1 to IOV_MAX non empty buffers.");
+            for(size_t i = 0; i < num_buffers; ++i) {
+                buffers_.push_back({static_cast<char *>(::operator new(buffer_size, align_val_t(LOG_BUFFER_ALIGNMENT))), 0});
+            }
+            open();
+        }
+
+        ~LogFileWriter() {
+            flush();
+            close(fd_);
+            for(auto &buffer : buffers_) {
+                ::operator delete(buffer.data_, align_val_t(LOG_BUFFER_ALIGNMENT));
+            }
+        }
+
+        auto write(const char *data, size_t len) noexcept {
+            if(UNLIKELY(!buffered_bytes_)) {
+                oldest_buffered_time_ = getCurrentNanos();
+            }
+            buffered_bytes_ += len;
+            while(len) {
+                auto &buffer = buffers_[current_buffer_];
+                const auto n = min(len, buffer_size_ - buffer.size_);
+                memcpy(buffer.data_ + buffer.size_, data, n);
+                buffer.size_ += n;
+                data += n;
+                len -= n;
+                if(buffer.size_ == buffer_size_ && ++current_buffer_ == buffers_.size()) {
+                    flush();
+                }
+            }
+        }
+
+        auto operator<<(char value) noexcept -> LogFileWriter & {
+            auto &buffer = buffers_[current_buffer_];
+            if(LIKELY(buffered_bytes_ && buffer.size_ < buffer_size_ - 1)) {
+                buffer.data_[buffer.size_++] = value;
+                ++buffered_bytes_;
+            } else {
+                write(&value, 1);
+            }
+            return *this;
+        }
+
+        auto operator<<(string_view value) noexcept -> LogFileWriter & {
+            write(value.data(), value.size());
+            return *this;
+        }
+
+        auto operator<<(const string &value) noexcept -> LogFileWriter & {
+            return *this << string_view(value);
+        }
+
+        auto operator<<(const char *value) noexcept -> LogFileWriter & {
+            return *this << string_view(value);
+        }
+
+        template<typename T> requires is_integral_v<T>
+        auto operator<<(T value) noexcept -> LogFileWriter & {
+            char buf[24];
+            const auto result = to_chars(buf, buf + sizeof(buf), value);
+            write(buf, result.ptr - buf);
+            return *this;
+        }
+
+        // same digits an ostream prints with its default precision of 6
+        template<typename T> requires is_floating_point_v<T>
+        auto operator<<(T value) noexcept -> LogFileWriter & {
+            char buf[32];
+            const auto result = to_chars(buf, buf + sizeof(buf), value, chars_format::general, 6);
+            write(buf, result.ptr - buf);
+            return *this;
+        }
+
+        // hands every filled buffer to the kernel in one writev()
+        auto flush() noexcept -> void {
+            iovec iov[IOV_MAX];
+            size_t num_iov = 0;
+            for(size_t i = 0; i <= current_buffer_ && i < buffers_.size(); ++i) {
+                if(buffers_[i].size_) {
+                    iov[num_iov++] = {buffers_[i].data_, buffers_[i].size_};
+                }
+            }
+            for(size_t first = 0; first < num_iov;) {
+                const auto n = writev(fd_, iov + first, static_cast<int>(num_iov - first));
+                write_calls_.fetch_add(1, memory_order_relaxed);
+                if(UNLIKELY(n < 0)) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    write_errors_.fetch_add(1, memory_order_relaxed);
+                    break; // the disk is full or gone, drop what we have rather than stall the Logger.
+                }
+                file_bytes_ += n;
+                bytes_written_.fetch_add(n, memory_order_relaxed);
+                // skip the fully written buffers and advance into a partially written one.
+                for(auto left = static_cast<size_t>(n); first < num_iov && left;) {
+                    const auto done = min(left, iov[first].iov_len);
+                    iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + done;
+                    iov[first].iov_len -= done;
+                    left -= done;
+                    if(!iov[first].iov_len) {
+                        ++first;
+                    }
+                }
+            }
+            for(auto &buffer : buffers_) {
+                buffer.size_ = 0;
+            }
+            current_buffer_ = 0;
+            buffered_bytes_ = 0;
+        }
+
+        // called between records so a record never straddles two files, returns true if a new file was started
+        auto rotateIfNeeded(Nanos now) noexcept {
+            if(!((rotate_bytes_ && file_bytes_ + buffered_bytes_ >= rotate_bytes_) ||
+                 (rotate_interval_ && now - file_open_time_ >= rotate_interval_))) {
+                return false;
+            }
+            flush();
+            close(fd_);
+            const auto rotated_name = file_name_ + "." + to_string(++files_rotated_);
+            if(rename(file_name_.c_str(), rotated_name.c_str()) != 0) {
+                write_errors_.fetch_add(1, memory_order_relaxed);
+            }
+            open();
+            return true;
+        }
+
+        auto bufferedBytes() const noexcept {
+            return buffered_bytes_;
+        }
+
+        auto oldestBufferedTime() const noexcept {
+            return oldest_buffered_time_;
+        }
+
+        auto bytesWritten() const noexcept {
+            return bytes_written_.load(memory_order_relaxed);
+        }
+
+        auto writeCalls() const noexcept {
+            return write_calls_.load(memory_order_relaxed);
+        }
+
+        auto writeErrors() const noexcept {
+            return write_errors_.load(memory_order_relaxed);
+        }
+
+        auto filesRotated() const noexcept {
+            return files_rotated_.load(memory_order_relaxed);
+        }
+
+        LogFileWriter() = delete;
+
+        LogFileWriter(const LogFileWriter &) = delete;
+
+        LogFileWriter(const LogFileWriter &&) = delete;
+
+        LogFileWriter &operator=(const LogFileWriter &) = delete;
+
+        LogFileWriter &operator=(const LogFileWriter &&) = delete;
+
+        private:
+        auto open() -> void {
+            fd_ = ::open(file_name_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            ASSERT(fd_ >= 0, "Could not open log file:" + file_name_ + " error:" + strerror(errno));
+            file_bytes_ = 0;
+            file_open_time_ = getCurrentNanos();
+            write(file_header_.data(), file_header_.size());
+        }
+
+        struct Buffer {
+            char *data_;
+            size_t size_;
+        };
+
+        const string file_name_;
+        const size_t buffer_size_;
+        const size_t rotate_bytes_;
+        const Nanos rotate_interval_;
+        const string file_header_;
+
+        int fd_ = -1;
+        vector<Buffer> buffers_;
+        size_t current_buffer_ = 0;
+        size_t buffered_bytes_ = 0;
+        Nanos oldest_buffered_time_ = 0;
+
+        size_t file_bytes_ = 0;
+        Nanos file_open_time_ = 0;
+
+        // read by Logger::metrics() from other threads.
+        atomic<uint64_t> bytes_written_ = {0};
+        atomic<uint64_t> write_calls_ = {0};
+        atomic<uint64_t> write_errors_ = {0};
+        atomic<uint64_t> files_rotated_ = {0};
+    };
+}
@@ -1,20 +1,42 @@
-#pragma once 
+#pragma once
 
 #include <string>
-#include <fstream>
+#include <string_view>
 #include <cstdio>
+#include <unordered_map>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
 #include "macros.h"
 #include "lf_queue.h"
+#include "log_writer.h"
 #include "thread_utils.h"
 #include "time_utils.h"
+#include "tsc_clock.h"
+#include "latency_probe.h"
 
 using namespace std;
-// the performace critical thread does not write to the disk as it is expensive, it only pushes to the queue 
-// a background thread periodically checks the queue and logs all the messages to the file 
+// the performace critical thread does not write to the disk as it is expensive, it only pushes to the queue
+// a background thread periodically checks the queue and logs all the messages to the file
 // this way the performance critical thread does not have to wait for io resources for every log
 
+// every log() call becomes one binary record: the format string pointer, a timestamp and the packed arguments
+// the record is copied into consecutive chunks of a multi producer queue, so the cost of a call does not depend on the
+// length of the format string and several threads can share one Logger
+// the background thread either formats the records into a text file or writes them as they are into a binary file
+// that log_decoder turns into text offline - format strings have to be string literals, only their pointer is queued
+// the number of '%' placeholders is checked against the arguments at compile time (LogFormat)
+// LoggerCfg decides what happens when the queue is full, when buffered output is flushed and when the file is rotated
+
 namespace Common {
-    constexpr size_t LOG_QUEUE_SIZE = 8 * 1024 * 1024;
+    // in chunks of LOG_CHUNK_SIZE bytes
+    constexpr size_t LOG_QUEUE_SIZE = 1024 * 1024;
+    // a chunk and its queue sequence number fill one cache line
+    constexpr size_t LOG_CHUNK_SIZE = CACHE_LINE_SIZE - sizeof(size_t);
+    // string arguments are truncated so the whole record fits
+    constexpr size_t LOG_MAX_RECORD_CHUNKS = 64;
+    constexpr size_t LOG_MAX_RECORD_SIZE = LOG_MAX_RECORD_CHUNKS * LOG_CHUNK_SIZE;
 
     enum class LogType : int8_t {
         CHAR = 0,
@@ -25,188 +47,476 @@ namespace Common {
         UNSIGNED_LONG_INTEGER = 5,
         UNSIGNED_LONG_LONG_INTEGER = 6,
         FLOAT = 7,
-        DOUBLE = 8
+        DOUBLE = 8,
+        STRING = 9
     };
 
-    struct LogElement {
-        LogType type_ = LogType::CHAR;
-        union {
-            char c;
-            int i;
-            long l;
-            long long ll;
-            unsigned u;
-            unsigned long ul;
-            unsigned long long ull;
-            float f;
-            double d;
-        } u_;
+    enum class LogFileMode : int8_t {
+        TEXT = 0,
+        BINARY = 1
     };
 
-    class Logger final {
+    struct LogChunk {
+        char data_[LOG_CHUNK_SIZE];
+    };
+
+    // followed by args_size_ bytes of arguments, each one a LogType tag and the value
+    // (strings: a uint16_t length and the characters)
+    struct LogRecordHeader {
+        const char *format_;
+        Nanos timestamp_;
+        uint32_t args_size_;
+        uint32_t num_chunks_;
+    };
+
+    // binary log file: LOG_FILE_MAGIC then a sequence of entries, each starting with a LogFileEntry tag
+    // FORMAT: uint32_t format id, uint32_t length, the format string - written the first time a format is used
+    // RECORD: uint32_t format id, Nanos timestamp, uint32_t args size, the packed arguments
+    constexpr char LOG_FILE_MAGIC[8] = {'L', 'L', 'T', 'S', 'L', 'O', 'G', '1'};
+
+    enum class LogFileEntry : int8_t {
+        FORMAT = 0,
+        RECORD = 1
+    };
+
+    // what log() does when the queue has no room for its record
+    enum class LogOverflowPolicy : int8_t {
+        BLOCK = 0, // wait for the Logger thread to make room.
+        DROP = 1,  // throw the record away and count it.
+        SPILL = 2  // park the record in an unbounded, mutex protected list written after the queue, so it may appear out of order.
+    };
+
+    struct LoggerCfg {
+        LogFileMode file_mode_ = LogFileMode::TEXT;
+        LogOverflowPolicy overflow_policy_ = LogOverflowPolicy::BLOCK;
+        // output is collected in num_buffers_ buffers of buffer_size_ bytes and written with one writev()
+        size_t buffer_size_ = 1024 * 1024;
+        size_t num_buffers_ = 4;
+        // flush once this much output is buffered, or once the oldest buffered byte is this old, whichever comes first
+        size_t flush_bytes_ = 1024 * 1024;
+        Nanos flush_interval_ = 10 * NANOS_TO_MILLIS;
+        // start a new file after this many bytes or this long, 0 disables either
+        size_t rotate_bytes_ = 0;
+        Nanos rotate_interval_ = 0;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "LoggerCfg[file_mode:" << static_cast<int>(file_mode_)
+            << " overflow_policy:" << static_cast<int>(overflow_policy_)
+            << " buffer_size:" << buffer_size_
+            << " num_buffers:" << num_buffers_
+            << " flush_bytes:" << flush_bytes_
+            << " flush_interval:" << flush_interval_
+            << " rotate_bytes:" << rotate_bytes_
+            << " rotate_interval:" << rotate_interval_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    struct LoggerMetrics {
+        size_t queue_depth_ = 0; // in chunks.
+        uint64_t records_written_ = 0;
+        uint64_t records_dropped_ = 0;
+        uint64_t records_spilled_ = 0;
+        uint64_t bytes_written_ = 0;
+        uint64_t write_calls_ = 0;
+        uint64_t write_errors_ = 0;
+        uint64_t files_rotated_ = 0;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "LoggerMetrics[queue_depth:" << queue_depth_
+            << " records_written:" << records_written_
+            << " records_dropped:" << records_dropped_
+            << " records_spilled:" << records_spilled_
+            << " bytes_written:" << bytes_written_
+            << " write_calls:" << write_calls_
+            << " write_errors:" << write_errors_
+            << " files_rotated:" << files_rotated_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // number of '%' placeholders in a format string, '%%' is a literal '%'
+    constexpr auto countLogPlaceholders(const char *format) noexcept {
+        size_t count = 0;
+        for(const char *s = format; *s; ++s) {
+            if(*s == '%') {
+                if(*(s+1) == '%') {
+                    ++s;
+                } else {
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+
+    // not constexpr on purpose: reaching it while evaluating a LogFormat constructor makes the call site fail to compile
+    inline auto logFormatPlaceholderCountDoesNotMatchArguments() noexcept {}
+
+    // format string of a log() call, checked against the argument types A at compile time like std::format_string
+    // only accepts string literals, which is also what keeps the queued pointer valid until the Logger thread gets to it
+    template<typename... A>
+    class LogFormat {
         public:
-        auto flushQueue() noexcept {
-            while(running_) {
-                for(auto next=queue_.getNextToRead(); queue_.size() && next; next=queue_.getNextToRead()){
-                    switch (next->type_) {
-                        case LogType::CHAR:
-                            file_ << next->u_.c;
-                            break;
-                        case LogType::INTEGER:
-                            file_ << next->u_.i;
-                            break;
-                        case LogType::LONG_INTEGER:
-                            file_ << next->u_.l;
-                            break;
-                        case LogType::LONG_LONG_INTEGER:
-                            file_ << next->u_.ll;
-                            break;
-                        case LogType::UNSIGNED_INTEGER:
-                            file_ << next->u_.u;
-                            break;
-                        case LogType::UNSIGNED_LONG_INTEGER:
-                            file_ << next->u_.ul;
-                            break;
-                        case LogType::UNSIGNED_LONG_LONG_INTEGER:
-                            file_ << next->u_.ull;
-                            break;
-                        case LogType::FLOAT:
-                            file_ << next->u_.f;
-                            break;
-                        case LogType::DOUBLE:
-                            file_ << next->u_.d;
-                            break;
+        template<size_t N>
+        consteval LogFormat(const char (&format)[N]) : format_(format) {
+            if(countLogPlaceholders(format) != sizeof...(A)) {
+                logFormatPlaceholderCountDoesNotMatchArguments();
+            }
+        }
+
+        constexpr auto get() const noexcept {
+            return format_;
+        }
+
+        private:
+        const char *format_;
+    };
+
+    // keeps the format from taking part in deducing A, the arguments alone decide
+    template<typename... A>
+    using LogFormatString = LogFormat<type_identity_t<A>...>;
+
+    // a format string split once into the literal text around its placeholders, '%%' already turned into '%'
+    // the Logger thread and log_decoder keep one per distinct format so records are formatted without scanning for '%'
+    struct ParsedLogFormat {
+        explicit ParsedLogFormat(const char *format) {
+            literals_.emplace_back();
+            for(const char *s = format; *s; ++s) {
+                if(*s != '%') {
+                    literals_.back() += *s;
+                } else if(*(s+1) == '%') {
+                    literals_.back() += *++s;
+                } else {
+                    literals_.emplace_back();
                 }
-                queue_.updateReadIndex();
             }
-            file_.flush();
+        }
+
+        // placeholders + 1 entries
+        vector<string> literals_;
+    };
+
+    // formats a record's packed arguments into out, shared by the Logger thread and log_decoder
+    template<typename Out>
+    inline auto formatLogRecord(const ParsedLogFormat &format, const char *args, size_t args_size, Out &out) {
+        const char *end = args + args_size;
+        auto read = [&args]<typename T>(T *value) {
+            memcpy(value, args, sizeof(T));
+            args += sizeof(T);
+        };
+        out << format.literals_[0];
+        for(size_t i = 1; i < format.literals_.size(); ++i) {
+            // only possible for arguments dropped because the record was full
+            if(UNLIKELY(args >= end)) {
+                out << "<missing argument>" << format.literals_[i];
+                continue;
+            }
+            LogType type;
+            read(&type);
+            switch (type) {
+                case LogType::CHAR: { char v; read(&v); out << v; break; }
+                case LogType::INTEGER: { int v; read(&v); out << v; break; }
+                case LogType::LONG_INTEGER: { long v; read(&v); out << v; break; }
+                case LogType::LONG_LONG_INTEGER: { long long v; read(&v); out << v; break; }
+                case LogType::UNSIGNED_INTEGER: { unsigned v; read(&v); out << v; break; }
+                case LogType::UNSIGNED_LONG_INTEGER: { unsigned long v; read(&v); out << v; break; }
+                case LogType::UNSIGNED_LONG_LONG_INTEGER: { unsigned long long v; read(&v); out << v; break; }
+                case LogType::FLOAT: { float v; read(&v); out << v; break; }
+                case LogType::DOUBLE: { double v; read(&v); out << v; break; }
+                case LogType::STRING: {
+                    uint16_t len;
+                    read(&len);
+                    out << string_view(args, len);
+                    args += len;
+                    break;
+                }
+            }
+            out << format.literals_[i];
+        }
+    }
 
-            using namespace literals::chrono_literals;
-            this_thread::sleep_for(10ms); 
+    class Logger final {
+        public:
+        auto flushQueue() noexcept {
+            // on shutdown keep going until everything queued or spilled before running_ was cleared is written
+            for(bool stopping = false; ; ) {
+                const auto drained = drainQueue() + drainSpill();
+                const auto now = getCurrentNanos();
+                if(writer_.bufferedBytes() &&
+                   (stopping || writer_.bufferedBytes() >= cfg_.flush_bytes_ || now - writer_.oldestBufferedTime() >= cfg_.flush_interval_)) {
+                    writer_.flush();
+                }
+                if(writer_.rotateIfNeeded(now)) {
+                    format_ids_.clear(); // every binary file carries its own format definitions.
+                }
+                if(stopping) {
+                    break;
+                }
+                if(!drained) {
+                    unique_lock<mutex> lock(wakeup_mutex_);
+                    wakeup_.wait_for(lock, chrono::milliseconds(1), [this]() { return !running_; });
+                    stopping = !running_;
+                }
             }
         }
 
-        explicit Logger(const string &file_name): file_name_(file_name), queue_(LOG_QUEUE_SIZE) {
-            file_.open(file_name);
-            ASSERT(file_.is_open(), "Could not open log file:"+file_name);
-            logger_thread_ = createAndStartThread(-1, "Common/Logger"+file_name_, [this]() {flushQueue();});
-            ASSERT(logger_thread_ != nullptr, "Failed to start Logger thread.");
+        explicit Logger(const string &file_name, const LoggerCfg &cfg = {}):
+            file_name_(file_name), cfg_(cfg), queue_(LOG_QUEUE_SIZE),
+            writer_(file_name, cfg.buffer_size_, cfg.num_buffers_, cfg.rotate_bytes_, cfg.rotate_interval_,
+                    cfg.file_mode_ == LogFileMode::BINARY ? string_view(LOG_FILE_MAGIC, sizeof(LOG_FILE_MAGIC)) : string_view()) {
+            TSCClock::instance(); // calibrate now rather than on the first log() call.
+            // runs on the cores the process's CpuLayout gives the "logger" role, away from the hot path threads
+            logger_thread_ = createAndStartThread(CpuLayout::instance().threadCfg("logger", "Common/Logger"+file_name_), [this]() {flushQueue();});
+            ASSERT(logger_thread_.joinable(), "Failed to start Logger thread.");
         }
 
         ~Logger() {
             string time_str;
             cerr << Common::getCurrentTimeStr(&time_str) <<"Flushing and closing Logger for " << file_name_ << endl;
 
-            while(queue_.size()){
-                using namespace literals::chrono_literals;
-                this_thread::sleep_for(1s);
+            {
+                lock_guard<mutex> lock(wakeup_mutex_);
+                running_ = false;
             }
+            wakeup_.notify_one();
+            logger_thread_.join();
 
-            running_ = false;
-            logger_thread_->join();
+            cerr << Common::getCurrentTimeStr(&time_str) << "Logger for "<<file_name_ << " exiting. " << metrics().toString() << endl;
+        }
 
-            file_.close();
-            cerr << Common::getCurrentTimeStr(&time_str) << "Logger for "<<file_name_ << " exiting." << endl;
+        auto metrics() const noexcept -> LoggerMetrics {
+            LoggerMetrics metrics;
+            metrics.queue_depth_ = queue_.size();
+            metrics.records_written_ = records_written_.load(memory_order_relaxed);
+            metrics.records_dropped_ = records_dropped_.load(memory_order_relaxed);
+            metrics.records_spilled_ = records_spilled_.load(memory_order_relaxed);
+            metrics.bytes_written_ = writer_.bytesWritten();
+            metrics.write_calls_ = writer_.writeCalls();
+            metrics.write_errors_ = writer_.writeErrors();
+            metrics.files_rotated_ = writer_.filesRotated();
+            return metrics;
         }
 
-        auto pushValue(const LogElement &log_element) noexcept {
-            *(queue_.getNextToWriteTo()) = log_element;
-            queue_.updateWriteIndex();
+        // packs the arguments into one record and queues it, the format string is not looked at on this thread
+        // a format whose placeholder count does not match the arguments does not compile
+        template<typename... A>
+        auto log(LogFormatString<A...> format, const A &... args) noexcept {
+            LATENCY_PROBE_SCOPE("Logger::log");
+            char record[LOG_MAX_RECORD_SIZE];
+            size_t size = sizeof(LogRecordHeader);
+            // stops at the first argument that does not fit, the formatter reports the rest as missing
+            static_cast<void>((pushValue(record, size, args) && ...));
+
+            const LogRecordHeader header{format.get(), getTSCNanos(), static_cast<uint32_t>(size - sizeof(LogRecordHeader)),
+                                         static_cast<uint32_t>((size + LOG_CHUNK_SIZE - 1) / LOG_CHUNK_SIZE)};
+            memcpy(record, &header, sizeof(header));
+            pushRecord(record, header.num_chunks_);
         }
 
-        auto pushValue(const char value) noexcept {
-            pushValue(LogElement{LogType::CHAR, {.c = value}});
+        Logger() = delete;
+
+        Logger(const Logger &) = delete;
+
+        Logger(const Logger &&) = delete;
+
+        Logger &operator=(const Logger &) = delete;
+
+        Logger &operator=(const Logger &&) = delete;
+
+        private:
+        template<typename T>
+        static auto pushValue(char *record, size_t &size, LogType type, const T &value) noexcept {
+            if(UNLIKELY(size + sizeof(type) + sizeof(value) > LOG_MAX_RECORD_SIZE)) {
+                return false;
+            }
+            memcpy(record + size, &type, sizeof(type));
+            memcpy(record + size + sizeof(type), &value, sizeof(value));
+            size += sizeof(type) + sizeof(value);
+            return true;
         }
 
-        auto pushValue(const int value) noexcept {
-            pushValue(LogElement{LogType::INTEGER, {.i = value}});
+        static auto pushValue(char *record, size_t &size, const char value) noexcept {
+            return pushValue(record, size, LogType::CHAR, value);
         }
 
-        auto pushValue(const long value) noexcept {
-            pushValue(LogElement{LogType::LONG_INTEGER, {.l = value}});
+        static auto pushValue(char *record, size_t &size, const int value) noexcept {
+            return pushValue(record, size, LogType::INTEGER, value);
         }
 
-        auto pushValue(const long long value) noexcept {
-            pushValue(LogElement{LogType::LONG_LONG_INTEGER, {.ll = value}});
+        static auto pushValue(char *record, size_t &size, const long value) noexcept {
+            return pushValue(record, size, LogType::LONG_INTEGER, value);
         }
 
-        auto pushValue(const unsigned value) noexcept {
-            pushValue(LogElement{LogType::UNSIGNED_INTEGER, {.u = value}});
+        static auto pushValue(char *record, size_t &size, const long long value) noexcept {
+            return pushValue(record, size, LogType::LONG_LONG_INTEGER, value);
         }
 
-        auto pushValue(const unsigned long value) noexcept {
-            pushValue(LogElement{LogType::UNSIGNED_LONG_INTEGER, {.ul = value}});
+        static auto pushValue(char *record, size_t &size, const unsigned value) noexcept {
+            return pushValue(record, size, LogType::UNSIGNED_INTEGER, value);
         }
 
-        auto pushValue(const unsigned long long value) noexcept {
-            pushValue(LogElement{LogType::UNSIGNED_LONG_LONG_INTEGER, {.ull = value}});
+        static auto pushValue(char *record, size_t &size, const unsigned long value) noexcept {
+            return pushValue(record, size, LogType::UNSIGNED_LONG_INTEGER, value);
         }
 
-        auto pushValue(const float value) noexcept {
-            pushValue(LogElement{LogType::FLOAT, {.f = value}});
+        static auto pushValue(char *record, size_t &size, const unsigned long long value) noexcept {
+            return pushValue(record, size, LogType::UNSIGNED_LONG_LONG_INTEGER, value);
         }
 
-        auto pushValue(const double value) noexcept {
-            pushValue(LogElement{LogType::DOUBLE, {.d = value}});
+        static auto pushValue(char *record, size_t &size, const float value) noexcept {
+            return pushValue(record, size, LogType::FLOAT, value);
         }
 
-        auto pushValue(const char *value) noexcept {
-            while (*value) {
-                pushValue(*value);
-                ++value;
+        static auto pushValue(char *record, size_t &size, const double value) noexcept {
+            return pushValue(record, size, LogType::DOUBLE, value);
+        }
+
+        static auto pushValue(char *record, size_t &size, const string_view value) noexcept {
+            constexpr auto overhead = sizeof(LogType) + sizeof(uint16_t);
+            if(UNLIKELY(size + overhead > LOG_MAX_RECORD_SIZE)) {
+                return false;
             }
+            const auto len = static_cast<uint16_t>(min(value.size(), LOG_MAX_RECORD_SIZE - size - overhead));
+            const auto type = LogType::STRING;
+            memcpy(record + size, &type, sizeof(type));
+            memcpy(record + size + sizeof(type), &len, sizeof(len));
+            memcpy(record + size + overhead, value.data(), len);
+            size += overhead + len;
+            return true;
         }
 
-        auto pushValue(const std::string &value) noexcept {
-            pushValue(value.c_str());
+        static auto pushValue(char *record, size_t &size, const char *value) noexcept {
+            return pushValue(record, size, string_view(value));
         }
 
-        template<typename T, typename... A>
-        auto log(const char *s, const T &value, A... args) noexcept {
-            while(*s){
-                if(*s == '%'){
-                    if(UNLIKELY(*(s+1)=='%')) {
-                        ++s;
-                    } else {
-                        pushValue(value);
-                        log(s+1, args...);
+        static auto pushValue(char *record, size_t &size, const std::string &value) noexcept {
+            return pushValue(record, size, string_view(value));
+        }
+
+        auto pushRecord(const char *record, size_t num_chunks) noexcept -> void {
+            LATENCY_PROBE_SCOPE("Logger::pushRecord");
+            auto pos = queue_.claim(num_chunks);
+            if(UNLIKELY(!pos)) {
+                switch (cfg_.overflow_policy_) {
+                    case LogOverflowPolicy::BLOCK:
+                        do {
+                            this_thread::yield();
+                            pos = queue_.claim(num_chunks);
+                        } while(!pos);
+                        break;
+                    case LogOverflowPolicy::DROP:
+                        records_dropped_.fetch_add(1, memory_order_relaxed);
+                        return;
+                    case LogOverflowPolicy::SPILL: {
+                        lock_guard<mutex> lock(spill_mutex_);
+                        spill_.insert(spill_.end(), record, record + num_chunks * LOG_CHUNK_SIZE);
+                        records_spilled_.fetch_add(1, memory_order_relaxed);
                         return;
                     }
                 }
-                pushValue(*s++);
             }
-            FATAL("extra arguments provided to log()");
+            for(size_t i = 0; i < num_chunks; ++i) {
+                memcpy(queue_.at(*pos + i)->data_, record + i * LOG_CHUNK_SIZE, LOG_CHUNK_SIZE);
+            }
+            queue_.publish(*pos, num_chunks);
         }
 
-        auto log(const char *s) noexcept {
-            while(*s) {
-                if(*s == '%'){
-                    if(UNLIKELY(*(s+1)=='%')){
-                        ++s;
-                    } else {
-                        FATAL("missing arguments to log()");
-                    }
+        // Logger thread: writes out everything currently in the queue, returns the number of records
+        auto drainQueue() noexcept -> size_t {
+            size_t num_records = 0;
+            for(auto chunk = queue_.peek(0); chunk; chunk = queue_.peek(0), ++num_records) {
+                LogRecordHeader header;
+                memcpy(&header, chunk->data_, sizeof(header));
+                // the producer publishes the first chunk last, so all the others are visible already
+                for(size_t i = 0; i < header.num_chunks_; ++i) {
+                    memcpy(record_ + i * LOG_CHUNK_SIZE, queue_.peek(i)->data_, LOG_CHUNK_SIZE);
                 }
-                pushValue(*s++);
+                queue_.release(header.num_chunks_);
+                writeRecord(header, record_ + sizeof(LogRecordHeader));
             }
+            return num_records;
         }
 
-        Logger() = delete;
-
-        Logger(const Logger &) = delete;
-
-        Logger(const Logger &&) = delete;
+        // Logger thread: writes out the records spilled since the last call, returns the number of records
+        auto drainSpill() noexcept -> size_t {
+            if(cfg_.overflow_policy_ != LogOverflowPolicy::SPILL) {
+                return 0;
+            }
+            {
+                lock_guard<mutex> lock(spill_mutex_);
+                spill_.swap(spill_draining_);
+            }
+            size_t num_records = 0;
+            for(size_t offset = 0; offset < spill_draining_.size(); ++num_records) {
+                LogRecordHeader header;
+                memcpy(&header, spill_draining_.data() + offset, sizeof(header));
+                writeRecord(header, spill_draining_.data() + offset + sizeof(LogRecordHeader));
+                offset += header.num_chunks_ * LOG_CHUNK_SIZE;
+            }
+            spill_draining_.clear();
+            return num_records;
+        }
 
-        Logger &operator=(const Logger &) = delete;
+        auto writeRecord(const LogRecordHeader &header, const char *args) noexcept -> void {
+            records_written_.fetch_add(1, memory_order_relaxed);
+            if(cfg_.file_mode_ == LogFileMode::TEXT) {
+                auto format = parsed_formats_.find(header.format_);
+                if(UNLIKELY(format == parsed_formats_.end())) {
+                    format = parsed_formats_.emplace(header.format_, ParsedLogFormat(header.format_)).first;
+                }
+                formatLogRecord(format->second, args, header.args_size_, writer_);
+                return;
+            }
 
-        Logger &operator=(const Logger &&) = delete;
+            const auto entry = LogFileEntry::RECORD;
+            auto format_id = format_ids_.find(header.format_);
+            if(UNLIKELY(format_id == format_ids_.end())) {
+                format_id = format_ids_.emplace(header.format_, static_cast<uint32_t>(format_ids_.size())).first;
+                const auto format_entry = LogFileEntry::FORMAT;
+                const auto len = static_cast<uint32_t>(strlen(header.format_));
+                writer_.write(reinterpret_cast<const char *>(&format_entry), sizeof(format_entry));
+                writer_.write(reinterpret_cast<const char *>(&format_id->second), sizeof(format_id->second));
+                writer_.write(reinterpret_cast<const char *>(&len), sizeof(len));
+                writer_.write(header.format_, len);
+            }
+            writer_.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+            writer_.write(reinterpret_cast<const char *>(&format_id->second), sizeof(format_id->second));
+            writer_.write(reinterpret_cast<const char *>(&header.timestamp_), sizeof(header.timestamp_));
+            writer_.write(reinterpret_cast<const char *>(&header.args_size_), sizeof(header.args_size_));
+            writer_.write(args, header.args_size_);
+        }
 
-        private:
         const string file_name_;
-        ofstream file_;
+        const LoggerCfg cfg_;
 
-        LFQueue<LogElement> queue_;
+        MPSCLFQueue<LogChunk> queue_;
         atomic<bool> running_ = {true};
-        thread *logger_thread_ = nullptr;
+        jthread logger_thread_;
+
+        // wakes the idle Logger thread up for shutdown, never touched by log().
+        mutex wakeup_mutex_;
+        condition_variable wakeup_;
+
+        // LogOverflowPolicy::SPILL only.
+        mutex spill_mutex_;
+        vector<char> spill_;
+
+        atomic<uint64_t> records_written_ = {0};
+        atomic<uint64_t> records_dropped_ = {0};
+        atomic<uint64_t> records_spilled_ = {0};
+
+        // Logger thread only.
+        LogFileWriter writer_;
+        vector<char> spill_draining_;
+        char record_[LOG_MAX_RECORD_SIZE];
+        unordered_map<const char *, ParsedLogFormat> parsed_formats_;
+        unordered_map<const char *, uint32_t> format_ids_;
     };
-}
\ No newline at end of file
+}
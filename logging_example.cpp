@@ -15,10 +15,25 @@ int main(int, char **) {
 
   Logger logger("logging_example.log");
 
+  // p50/p99/p99.9/max of every probe site that saw samples, every 100ms
+  LatencyProbes::instance().startReporter(100 * NANOS_TO_MILLIS, [&logger](const LatencySummary &summary) {
+    logger.log("%\n", summary.toString());
+  });
+
   logger.log("Logging a char:% an int:% and an unsigned:%\n", c, i, ul);
   logger.log("Logging a float:% and a double:%\n", f, d);
   logger.log("Logging a C-string:'%'\n", s);
   logger.log("Logging a string:'%'\n", ss);
 
+  // same records, kept binary on disk - read them back with: log_decoder logging_example.bin
+  Logger binary_logger("logging_example.bin", LoggerCfg{.file_mode_ = LogFileMode::BINARY});
+
+  binary_logger.log("Logging a char:% an int:% and an unsigned:%\n", c, i, ul);
+  binary_logger.log("Logging a float:% and a double:%\n", f, d);
+  binary_logger.log("Logging a C-string:'%'\n", s);
+  binary_logger.log("Logging a string:'%'\n", ss);
+
+  LatencyProbes::instance().stopReporter();
+
   return 0;
 }
\ No newline at end of file
@@ -8,6 +8,9 @@ using namespace std;
 #define LIKELY(x) __builtin_expect(!!(x), 1)
 #define UNLIKELY(x) __builtin_expect(!!(x), 0)
 
+// size of a cache line on the x86 cores we run on, used to pad data written by different threads
+constexpr size_t CACHE_LINE_SIZE = 64;
+
 inline auto ASSERT(bool cond, const string& msg) noexcept {
     if(UNLIKELY(!cond)){
         cerr<<"ASSERT : "<< msg <<endl;
@@ -0,0 +1,175 @@
+#include "market_data_consumer.h"
+
+using namespace std;
+using namespace Exchange;
+
+namespace Trading {
+    MarketDataConsumer::MarketDataConsumer(MEMarketUpdateLFQueue *market_updates, Common::Logger &logger,
+                                           const MarketDataConsumerCfg &cfg) :
+        cfg_(cfg), market_updates_(market_updates), incremental_socket_(logger, cfg.mcast_cfg_),
+        snapshot_socket_(logger, cfg.mcast_cfg_), logger_(logger) {
+        ASSERT(incremental_socket_.init(cfg_.incremental_ip_, cfg_.iface_, cfg_.incremental_port_, true) >= 0 &&
+               incremental_socket_.join(cfg_.incremental_ip_),
+               "Unable to join incremental multicast group. error:" + string(strerror(errno)) + " " + cfg_.toString());
+        // bound now, the group is only joined while recovering
+        ASSERT(snapshot_socket_.init(cfg_.snapshot_ip_, cfg_.iface_, cfg_.snapshot_port_, true) >= 0,
+               "Unable to create snapshot multicast socket. error:" + string(strerror(errno)) + " " + cfg_.toString());
+    }
+
+    MarketDataConsumer::~MarketDataConsumer() {
+        stop();
+    }
+
+    auto MarketDataConsumer::start(const Common::ThreadCfg &thread_cfg) -> void {
+        logger_.log("%:% %() % starting %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                    cfg_.toString());
+        running_ = true;
+        thread_ = Common::createAndStartThread(thread_cfg, [this]() { run(); });
+        ASSERT(thread_.joinable(), "Failed to start market data consumer thread. " + thread_cfg.toString());
+    }
+
+    auto MarketDataConsumer::stop() -> void {
+        running_ = false;
+        if(thread_.joinable()) {
+            thread_.join();
+            logger_.log("%:% %() % stopped %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                        stats_.toString());
+        }
+    }
+
+    auto MarketDataConsumer::run() noexcept -> void {
+        while(running_.load(memory_order_relaxed)) {
+            poll();
+        }
+    }
+
+    auto MarketDataConsumer::poll() noexcept -> void {
+        incremental_socket_.sendAndRecv();
+        for(; incremental_socket_.packetsReadable(); incremental_socket_.popPacket()) {
+            const auto &packet = incremental_socket_.frontPacket();
+            if(UNLIKELY(packet.len_ != sizeof(MDPMarketUpdate))) {
+                ++stats_.packets_ignored_;
+                continue;
+            }
+            onIncremental(*reinterpret_cast<const MDPMarketUpdate *>(packet.data_));
+        }
+
+        if(UNLIKELY(in_recovery_)) {
+            snapshot_socket_.sendAndRecv();
+            for(; snapshot_socket_.packetsReadable(); snapshot_socket_.popPacket()) {
+                const auto &packet = snapshot_socket_.frontPacket();
+                if(UNLIKELY(packet.len_ != sizeof(MDPMarketUpdate))) {
+                    ++stats_.packets_ignored_;
+                    continue;
+                }
+                onSnapshot(*reinterpret_cast<const MDPMarketUpdate *>(packet.data_));
+            }
+            checkSnapshotSync();
+        }
+    }
+
+    auto MarketDataConsumer::onIncremental(const MDPMarketUpdate &update) noexcept -> void {
+        if(LIKELY(!in_recovery_)) {
+            if(LIKELY(update.seq_num_ == next_exp_inc_seq_num_)) {
+                ++next_exp_inc_seq_num_;
+                forward(update.me_market_update_);
+                return;
+            }
+            // a duplicate, or one that arrived after the snapshot that covered it
+            if(update.seq_num_ < next_exp_inc_seq_num_) {
+                ++stats_.packets_ignored_;
+                return;
+            }
+            startRecovery(update);
+        }
+        incremental_queued_[update.seq_num_] = update.me_market_update_;
+    }
+
+    auto MarketDataConsumer::onSnapshot(const MDPMarketUpdate &update) noexcept -> void {
+        // every snapshot restarts its numbering at 0 with SNAPSHOT_START, so a new START drops whatever partial one we had
+        if(update.me_market_update_.type_ == MarketUpdateType::SNAPSHOT_START) {
+            if(!snapshot_queued_.empty()) {
+                ++stats_.snapshots_discarded_;
+            }
+            snapshot_queued_.clear();
+        }
+        snapshot_queued_[update.seq_num_] = update.me_market_update_;
+    }
+
+    auto MarketDataConsumer::startRecovery(const MDPMarketUpdate &update) noexcept -> void {
+        logger_.log("%:% %() % gap expected seq:% received %, recovering from the snapshot group\n", __FILE__, __LINE__,
+                    __FUNCTION__, Common::getCurrentTimeStr(&time_str_), next_exp_inc_seq_num_, update.toString());
+        ++stats_.gaps_;
+        in_recovery_ = true;
+        recovery_start_ = Common::getTSCNanos();
+        snapshot_queued_.clear();
+        incremental_queued_.clear();
+        ASSERT(snapshot_socket_.join(cfg_.snapshot_ip_),
+               "Unable to join snapshot multicast group. error:" + string(strerror(errno)) + " " + cfg_.toString());
+    }
+
+    auto MarketDataConsumer::checkSnapshotSync() noexcept -> void {
+        // a complete snapshot is every message from SNAPSHOT_START at 0 through SNAPSHOT_END
+        if(snapshot_queued_.empty() || snapshot_queued_.begin()->second.type_ != MarketUpdateType::SNAPSHOT_START) {
+            snapshot_queued_.clear();
+            return;
+        }
+        const auto &last = *snapshot_queued_.rbegin();
+        if(last.second.type_ != MarketUpdateType::SNAPSHOT_END) {
+            return;
+        }
+        if(last.first + 1 != snapshot_queued_.size()) {
+            logger_.log("%:% %() % snapshot missing % of % messages, waiting for the next one\n", __FILE__, __LINE__,
+                        __FUNCTION__, Common::getCurrentTimeStr(&time_str_), last.first + 1 - snapshot_queued_.size(),
+                        last.first + 1);
+            ++stats_.snapshots_discarded_;
+            snapshot_queued_.clear();
+            return;
+        }
+
+        // the snapshot is good up to its last incremental, everything queued after that has to follow without a gap
+        const auto snapshot_inc_seq_num = last.second.order_id_;
+        incremental_queued_.erase(incremental_queued_.begin(), incremental_queued_.upper_bound(snapshot_inc_seq_num));
+        auto next_inc_seq_num = snapshot_inc_seq_num + 1;
+        for(const auto &[seq_num, update] : incremental_queued_) {
+            if(seq_num != next_inc_seq_num) {
+                logger_.log("%:% %() % incremental seq:% lost after snapshot at seq:%, waiting for the next one\n",
+                            __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), next_inc_seq_num,
+                            snapshot_inc_seq_num);
+                ++stats_.snapshots_discarded_;
+                snapshot_queued_.clear();
+                return;
+            }
+            ++next_inc_seq_num;
+        }
+
+        for(const auto &[seq_num, update] : snapshot_queued_) {
+            if(update.type_ != MarketUpdateType::SNAPSHOT_START && update.type_ != MarketUpdateType::SNAPSHOT_END) {
+                forward(update);
+            }
+        }
+        for(const auto &[seq_num, update] : incremental_queued_) {
+            forward(update);
+        }
+        next_exp_inc_seq_num_ = next_inc_seq_num;
+
+        in_recovery_ = false;
+        snapshot_queued_.clear();
+        incremental_queued_.clear();
+        snapshot_socket_.leave(cfg_.snapshot_ip_);
+        stats_.recovery_time_.record(Common::getTSCNanos() - recovery_start_);
+        logger_.log("%:% %() % recovered from snapshot at seq:%, next expected seq:%\n", __FILE__, __LINE__, __FUNCTION__,
+                    Common::getCurrentTimeStr(&time_str_), snapshot_inc_seq_num, next_exp_inc_seq_num_);
+    }
+
+    auto MarketDataConsumer::forward(const MEMarketUpdate &update) noexcept -> void {
+        // the strategy drains its queue on its own thread, a full queue only means waiting for it to catch up
+        auto next = market_updates_->getNextToWriteTo();
+        while(UNLIKELY(!next)) {
+            next = market_updates_->getNextToWriteTo();
+        }
+        *next = update;
+        market_updates_->updateWriteIndex();
+        ++stats_.updates_forwarded_;
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <map>
+
+#include "mcast_socket.h"
+#include "tcp_socket.h"
+#include "thread_utils.h"
+#include "exchange_types.h"
+
+using namespace std;
+
+namespace Trading {
+    struct MarketDataConsumerCfg {
+        string iface_ = "lo";
+        string incremental_ip_ = "239.255.14.1";
+        int incremental_port_ = 20000;
+        string snapshot_ip_ = "239.255.14.3";
+        int snapshot_port_ = 20001;
+        Common::McastCfg mcast_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MarketDataConsumerCfg[iface:" << iface_
+            << " incremental:" << incremental_ip_ << ":" << incremental_port_
+            << " snapshot:" << snapshot_ip_ << ":" << snapshot_port_
+            << " mcast:" << mcast_cfg_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // kept by the consumer thread, read them once it is stopped
+    struct MarketDataConsumerStats {
+        uint64_t updates_forwarded_ = 0;
+        // incrementals that skipped ahead of the next expected sequence number, each starts a recovery
+        uint64_t gaps_ = 0;
+        // snapshots given up on, because one of their messages was lost or the incrementals after them were
+        uint64_t snapshots_discarded_ = 0;
+        // truncated datagrams and incrementals already forwarded
+        uint64_t packets_ignored_ = 0;
+        // gap detected to being back in sync
+        Common::LatencyStat recovery_time_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MarketDataConsumerStats[updates_forwarded:" << updates_forwarded_
+            << " gaps:" << gaps_
+            << " snapshots_discarded:" << snapshots_discarded_
+            << " packets_ignored:" << packets_ignored_
+            << " recovery_time:" << recovery_time_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // the client side of the exchange's market data feed: reads the incremental group and forwards its updates in
+    // sequence order to the strategy's queue
+    // an incremental that skips ahead starts a recovery: incrementals are queued from then on, the snapshot group is joined,
+    // and once a complete snapshot arrives along with every incremental after the one it was taken at, the snapshot and
+    // those incrementals are forwarded, the snapshot group is left and the consumer is back on the incremental stream
+    // a snapshot's CLEAR for each ticker tells the strategy to drop what it knew of that book before the ADDs that follow
+    // without a gap an incremental costs a sequence number compare and a queue write, the snapshot socket is not even read
+    class MarketDataConsumer final {
+        public:
+        MarketDataConsumer(Exchange::MEMarketUpdateLFQueue *market_updates, Common::Logger &logger, const MarketDataConsumerCfg &cfg);
+
+        ~MarketDataConsumer();
+
+        // runs poll() on its own thread, set up with the "md_consumer" role of the cpu layout by default
+        auto start(const Common::ThreadCfg &thread_cfg =
+                       Common::CpuLayout::instance().threadCfg("md_consumer", "Trading/MDConsumer")) -> void;
+
+        auto stop() -> void;
+
+        // reads both groups once and forwards whatever is in order
+        auto poll() noexcept -> void;
+
+        auto inRecovery() const noexcept {
+            return in_recovery_;
+        }
+
+        // sequence number of the next incremental to forward
+        auto nextExpectedSeqNum() const noexcept {
+            return next_exp_inc_seq_num_;
+        }
+
+        auto stats() const noexcept -> const MarketDataConsumerStats & {
+            return stats_;
+        }
+
+        MarketDataConsumer() = delete;
+
+        MarketDataConsumer(const MarketDataConsumer &) = delete;
+
+        MarketDataConsumer(const MarketDataConsumer &&) = delete;
+
+        MarketDataConsumer &operator=(const MarketDataConsumer &) = delete;
+
+        MarketDataConsumer &operator=(const MarketDataConsumer &&) = delete;
+
+        private:
+        auto onIncremental(const Exchange::MDPMarketUpdate &update) noexcept -> void;
+
+        auto onSnapshot(const Exchange::MDPMarketUpdate &update) noexcept -> void;
+
+        auto startRecovery(const Exchange::MDPMarketUpdate &update) noexcept -> void;
+
+        // forwards the queued snapshot and incrementals and leaves recovery if they line up
+        auto checkSnapshotSync() noexcept -> void;
+
+        auto forward(const Exchange::MEMarketUpdate &update) noexcept -> void;
+
+        auto run() noexcept -> void;
+
+        const MarketDataConsumerCfg cfg_;
+        Exchange::MEMarketUpdateLFQueue *market_updates_ = nullptr;
+        uint64_t next_exp_inc_seq_num_ = 1;
+
+        Common::McastSocket incremental_socket_;
+        Common::McastSocket snapshot_socket_;
+
+        // what arrived while recovering, keyed by sequence number so either stream can come in any order
+        // both only grow during a recovery, which is off the in-order path
+        bool in_recovery_ = false;
+        Common::Nanos recovery_start_ = 0;
+        map<uint64_t, Exchange::MEMarketUpdate> snapshot_queued_;
+        map<uint64_t, Exchange::MEMarketUpdate> incremental_queued_;
+
+        MarketDataConsumerStats stats_;
+
+        jthread thread_;
+        atomic<bool> running_ = {false};
+
+        string time_str_;
+        Common::Logger &logger_;
+    };
+}
@@ -0,0 +1,74 @@
+#include "market_data_publisher.h"
+
+using namespace std;
+
+namespace Exchange {
+    MarketDataPublisher::MarketDataPublisher(MEMarketUpdateLFQueue *market_updates, Common::Logger &logger,
+                                             const MarketDataPublisherCfg &cfg) :
+        cfg_(cfg), market_updates_(market_updates), incremental_socket_(logger, cfg.mcast_cfg_),
+        snapshot_updates_(cfg.snapshot_queue_size_), snapshot_synthesizer_(&snapshot_updates_, logger, cfg.snapshot_cfg_),
+        logger_(logger) {
+        ASSERT(incremental_socket_.init(cfg_.incremental_ip_, cfg_.iface_, cfg_.incremental_port_, false) >= 0,
+               "Unable to create incremental multicast socket. error:" + string(strerror(errno)) + " " + cfg_.toString());
+    }
+
+    MarketDataPublisher::~MarketDataPublisher() {
+        stop();
+    }
+
+    auto MarketDataPublisher::start(const Common::ThreadCfg &thread_cfg, const Common::ThreadCfg &snapshot_thread_cfg) -> void {
+        logger_.log("%:% %() % starting %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                    cfg_.toString());
+        snapshot_synthesizer_.start(snapshot_thread_cfg);
+        running_ = true;
+        thread_ = Common::createAndStartThread(thread_cfg, [this]() { run(); });
+        ASSERT(thread_.joinable(), "Failed to start market data publisher thread. " + thread_cfg.toString());
+    }
+
+    auto MarketDataPublisher::stop() -> void {
+        running_ = false;
+        if(thread_.joinable()) {
+            thread_.join();
+            logger_.log("%:% %() % stopped %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                        stats_.toString());
+        }
+        snapshot_synthesizer_.stop();
+    }
+
+    auto MarketDataPublisher::run() noexcept -> void {
+        while(running_.load(memory_order_relaxed)) {
+            poll();
+        }
+    }
+
+    auto MarketDataPublisher::poll() noexcept -> size_t {
+        size_t published = 0;
+        for(auto batch = market_updates_->getNextToRead(Common::McastBatchSize); !batch.empty();
+            batch = market_updates_->getNextToRead(Common::McastBatchSize)) {
+            for(const auto &update : batch) {
+                const MDPMarketUpdate mdp_update{next_inc_seq_num_++, update};
+                // the ring holds many batches, it is only full while the kernel is refusing packets
+                while(UNLIKELY(!incremental_socket_.send(&mdp_update, sizeof(mdp_update)))) {
+                    incremental_socket_.sendPending();
+                }
+
+                // the synthesizer keeps up with the stream on its own thread, waiting for it is the rare case
+                LATENCY_PROBE_START(handoff);
+                auto next = snapshot_updates_.getNextToWriteTo();
+                while(UNLIKELY(!next)) {
+                    next = snapshot_updates_.getNextToWriteTo();
+                }
+                *next = mdp_update;
+                snapshot_updates_.updateWriteIndex();
+                LATENCY_PROBE_END(handoff, "MarketDataPublisher::sendSnapshotUpdate");
+            }
+            market_updates_->updateReadIndex(batch.size());
+
+            incremental_socket_.sendPending();
+            published += batch.size();
+            ++stats_.send_batches_;
+        }
+        stats_.updates_published_ += published;
+        return published;
+    }
+}
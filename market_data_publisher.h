@@ -0,0 +1,110 @@
+#pragma once
+
+#include "mcast_socket.h"
+#include "thread_utils.h"
+#include "exchange_types.h"
+#include "snapshot_synthesizer.h"
+
+using namespace std;
+
+namespace Exchange {
+    struct MarketDataPublisherCfg {
+        string iface_ = "lo";
+        string incremental_ip_ = "239.255.14.1";
+        int incremental_port_ = 20000;
+        Common::McastCfg mcast_cfg_;
+        // capacity of the queue handing sent increments to the snapshot synthesizer
+        size_t snapshot_queue_size_ = ME_MAX_MARKET_UPDATES;
+        SnapshotSynthesizerCfg snapshot_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MarketDataPublisherCfg[iface:" << iface_
+            << " incremental:" << incremental_ip_ << ":" << incremental_port_
+            << " mcast:" << mcast_cfg_.toString()
+            << " snapshot_queue_size:" << snapshot_queue_size_
+            << " snapshot:" << snapshot_cfg_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // kept by the publisher thread, read them once it is stopped
+    struct MarketDataPublisherStats {
+        uint64_t updates_published_ = 0;
+        // sendmmsg() rounds, each takes up to McastBatchSize updates
+        uint64_t send_batches_ = 0;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MarketDataPublisherStats[updates_published:" << updates_published_
+            << " send_batches:" << send_batches_
+            << " updates_per_batch:" << (send_batches_ ? static_cast<double>(updates_published_) / static_cast<double>(send_batches_) : 0)
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // publishes the matching engine's market updates: takes them off the engine's queue in batches, numbers them and sends
+    // them on the incremental group, one datagram each and one sendmmsg() per batch, and hands every update it sent to the
+    // SnapshotSynthesizer it owns, which serves the snapshot group from its own thread
+    class MarketDataPublisher final {
+        public:
+        MarketDataPublisher(MEMarketUpdateLFQueue *market_updates, Common::Logger &logger, const MarketDataPublisherCfg &cfg);
+
+        ~MarketDataPublisher();
+
+        // runs poll() on its own thread and starts the snapshot synthesizer on another, set up with the "md_publisher"
+        // and "md_snapshot" roles of the cpu layout by default
+        auto start(const Common::ThreadCfg &thread_cfg =
+                       Common::CpuLayout::instance().threadCfg("md_publisher", "Exchange/MDPublisher"),
+                   const Common::ThreadCfg &snapshot_thread_cfg =
+                       Common::CpuLayout::instance().threadCfg("md_snapshot", "Exchange/MDSnapshot")) -> void;
+
+        auto stop() -> void;
+
+        // publishes everything queued by the engine so far, returns the number of updates sent
+        auto poll() noexcept -> size_t;
+
+        auto stats() const noexcept -> const MarketDataPublisherStats & {
+            return stats_;
+        }
+
+        // driven by the caller through its poll() when the publisher is not start()ed
+        auto snapshotSynthesizer() noexcept -> SnapshotSynthesizer & {
+            return snapshot_synthesizer_;
+        }
+
+        MarketDataPublisher() = delete;
+
+        MarketDataPublisher(const MarketDataPublisher &) = delete;
+
+        MarketDataPublisher(const MarketDataPublisher &&) = delete;
+
+        MarketDataPublisher &operator=(const MarketDataPublisher &) = delete;
+
+        MarketDataPublisher &operator=(const MarketDataPublisher &&) = delete;
+
+        private:
+        auto run() noexcept -> void;
+
+        const MarketDataPublisherCfg cfg_;
+        MEMarketUpdateLFQueue *market_updates_ = nullptr;
+        uint64_t next_inc_seq_num_ = 1;
+
+        Common::McastSocket incremental_socket_;
+
+        MDPMarketUpdateLFQueue snapshot_updates_;
+        SnapshotSynthesizer snapshot_synthesizer_;
+
+        MarketDataPublisherStats stats_;
+
+        jthread thread_;
+        atomic<bool> running_ = {false};
+
+        string time_str_;
+        Common::Logger &logger_;
+    };
+}
@@ -0,0 +1,87 @@
+#include "matching_engine.h"
+
+using namespace std;
+
+namespace Exchange {
+    // requests taken off the queue per pass, the read index is published once per batch instead of once per request
+    constexpr size_t ME_REQUEST_BATCH_SIZE = 64;
+
+    MatchingEngine::MatchingEngine(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses,
+                                   MEMarketUpdateLFQueue *market_updates, Common::Logger &logger, const MatchingEngineCfg &cfg) :
+        cfg_(cfg), client_requests_(client_requests), client_responses_(client_responses), market_updates_(market_updates),
+        logger_(logger) {
+        for(TickerId ticker_id = 0; ticker_id < cfg_.num_tickers_; ++ticker_id) {
+            order_books_.push_back(make_unique<MEOrderBook>(ticker_id, cfg_.book_cfg_, client_responses_, market_updates_, logger_));
+        }
+    }
+
+    MatchingEngine::~MatchingEngine() {
+        stop();
+    }
+
+    auto MatchingEngine::start(const Common::ThreadCfg &thread_cfg) -> void {
+        logger_.log("%:% %() % starting %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                    cfg_.toString());
+        running_ = true;
+        thread_ = Common::createAndStartThread(thread_cfg, [this]() { run(); });
+        ASSERT(thread_.joinable(), "Failed to start matching engine thread. " + thread_cfg.toString());
+    }
+
+    auto MatchingEngine::stop() -> void {
+        running_ = false;
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    auto MatchingEngine::processClientRequest(const MEClientRequest &request) noexcept -> void {
+        LATENCY_PROBE_SCOPE("MatchingEngine::processClientRequest");
+        auto order_book = orderBook(request.ticker_id_);
+        if(UNLIKELY(!order_book)) {
+            logger_.log("%:% %() % unknown ticker %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                        request.toString());
+            reject(request);
+            return;
+        }
+
+        switch(request.type_) {
+            case ClientRequestType::NEW:
+                order_book->add(request.client_id_, request.order_id_, request.side_, request.price_, request.qty_);
+                break;
+            case ClientRequestType::CANCEL:
+                order_book->cancel(request.client_id_, request.order_id_);
+                break;
+            default:
+                // requests come off the network, one the gateway let through must not take the engine down
+                logger_.log("%:% %() % invalid request type %\n", __FILE__, __LINE__, __FUNCTION__,
+                            Common::getCurrentTimeStr(&time_str_), request.toString());
+                reject(request);
+                break;
+        }
+    }
+
+    auto MatchingEngine::reject(const MEClientRequest &request) noexcept -> void {
+        LATENCY_PROBE_START(handoff);
+        auto next = client_responses_->getNextToWriteTo();
+        while(UNLIKELY(!next)) {
+            next = client_responses_->getNextToWriteTo();
+        }
+        *next = {(request.type_ == ClientRequestType::CANCEL ? ClientResponseType::CANCEL_REJECTED : ClientResponseType::REJECTED),
+                 request.client_id_, request.ticker_id_, request.order_id_, OrderId_INVALID, request.side_, request.price_, 0, 0};
+        client_responses_->updateWriteIndex();
+        LATENCY_PROBE_END(handoff, "MatchingEngine::reject");
+    }
+
+    auto MatchingEngine::run() noexcept -> void {
+        logger_.log("%:% %() % running\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_));
+        while(running_.load(memory_order_relaxed)) {
+            const auto requests = client_requests_->getNextToRead(ME_REQUEST_BATCH_SIZE);
+            for(const auto &request : requests) {
+                processClientRequest(request);
+            }
+            if(!requests.empty()) {
+                client_requests_->updateReadIndex(requests.size());
+            }
+        }
+    }
+}
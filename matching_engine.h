@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+
+#include "thread_utils.h"
+#include "lf_queue.h"
+#include "logging.h"
+#include "me_order_book.h"
+
+using namespace std;
+
+namespace Exchange {
+    struct MatchingEngineCfg {
+        // tickers 0 .. num_tickers_ - 1 are traded, each with its own book
+        size_t num_tickers_ = 8;
+        MEOrderBookCfg book_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MatchingEngineCfg[num_tickers:" << num_tickers_
+            << " book:" << book_cfg_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // owns every ticker's order book and runs them on one thread, the only one that ever touches them, so the books need
+    // no locks and orders are matched strictly in the order the gateway queued them
+    // reads client requests from one queue, and writes client responses and market updates to two others
+    class MatchingEngine final {
+        public:
+        MatchingEngine(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses,
+                       MEMarketUpdateLFQueue *market_updates, Common::Logger &logger, const MatchingEngineCfg &cfg = {});
+
+        ~MatchingEngine();
+
+        // spins on the request queue on its own thread, set up with the "engine" role of the cpu layout by default
+        auto start(const Common::ThreadCfg &thread_cfg =
+                       Common::CpuLayout::instance().threadCfg("engine", "Exchange/MatchingEngine")) -> void;
+
+        auto stop() -> void;
+
+        // what the engine thread does with each request, callable directly when there is no engine thread
+        auto processClientRequest(const MEClientRequest &request) noexcept -> void;
+
+        auto orderBook(TickerId ticker_id) noexcept -> MEOrderBook * {
+            return (ticker_id < order_books_.size() ? order_books_[ticker_id].get() : nullptr);
+        }
+
+        MatchingEngine() = delete;
+
+        MatchingEngine(const MatchingEngine &) = delete;
+
+        MatchingEngine(const MatchingEngine &&) = delete;
+
+        MatchingEngine &operator=(const MatchingEngine &) = delete;
+
+        MatchingEngine &operator=(const MatchingEngine &&) = delete;
+
+        private:
+        // a REJECTED, or CANCEL_REJECTED for a cancel, to a request no book can act on
+        auto reject(const MEClientRequest &request) noexcept -> void;
+
+        auto run() noexcept -> void;
+
+        const MatchingEngineCfg cfg_;
+        ClientRequestLFQueue *client_requests_ = nullptr;
+        ClientResponseLFQueue *client_responses_ = nullptr;
+        MEMarketUpdateLFQueue *market_updates_ = nullptr;
+
+        vector<unique_ptr<MEOrderBook>> order_books_;
+
+        jthread thread_;
+        atomic<bool> running_ = {false};
+
+        string time_str_;
+        Common::Logger &logger_;
+    };
+}
@@ -0,0 +1,147 @@
+#include "mcast_socket.h"
+using namespace std;
+
+namespace Common {
+    McastSocket::McastSocket(Logger &logger, const McastCfg &cfg):
+        cfg_(cfg), ring_mask_(cfg.ring_packets_ - 1),
+        inbound_packets_(cfg.ring_packets_, StorageAllocator<McastPacket>(cfg.storage_cfg_)), inbound_iovs_(cfg.ring_packets_), inbound_msgs_(cfg.ring_packets_),
+        outbound_packets_(cfg.ring_packets_, StorageAllocator<McastPacket>(cfg.storage_cfg_)), outbound_iovs_(cfg.ring_packets_), outbound_msgs_(cfg.ring_packets_),
+        logger_(logger) {
+        ASSERT(cfg.ring_packets_ >= McastBatchSize && !(cfg.ring_packets_ & ring_mask_),
+               "McastSocket ring_packets must be a power of two of at least McastBatchSize. " + cfg.toString());
+
+        // slot i always reads into and sends from packet i, only the lengths change from one batch to the next
+        for(size_t i = 0; i < cfg.ring_packets_; ++i) {
+            auto &in = inbound_packets_[i];
+            inbound_iovs_[i] = {in.data_, sizeof(in.data_)};
+            inbound_msgs_[i].msg_hdr = {nullptr, 0, &inbound_iovs_[i], 1, in.ctrl_, sizeof(in.ctrl_), 0};
+
+            outbound_iovs_[i] = {outbound_packets_[i].data_, 0};
+            outbound_msgs_[i].msg_hdr = {&dest_addr_, sizeof(dest_addr_), &outbound_iovs_[i], 1, nullptr, 0, 0};
+        }
+    }
+
+    auto McastSocket::init(const string &ip, const string &iface, int port, bool is_listening) -> int {
+        const SocketCfg socket_cfg{ip, iface, port, true, is_listening, false, false, false};
+        socket_fd_ = createSocket(logger_, socket_cfg);
+        iface_ip_ = getIfaceIP(iface);
+        dest_addr_ = {AF_INET, htons(static_cast<uint16_t>(port)), {inet_addr(ip.c_str())}, {}};
+        logger_.log("%:% %() % socket:% iface_ip:% cfg:%\n", __FILE__, __LINE__, __FUNCTION__,
+                    Common::getCurrentTimeStr(&time_str_), socket_fd_, iface_ip_, cfg_.toString());
+
+        if(is_listening) {
+            ASSERT(setSOTimestampNS(socket_fd_), "setSOTimestampNS() failed. errno:" + string(strerror(errno)));
+            if(cfg_.rcvbuf_size_) {
+                const auto actual = setRcvBuf(socket_fd_, cfg_.rcvbuf_size_);
+                ASSERT(actual >= 0, "setRcvBuf() failed. errno:" + string(strerror(errno)));
+                logger_.log("%:% %() % socket:% SO_RCVBUF asked:% got:%\n", __FILE__, __LINE__, __FUNCTION__,
+                            Common::getCurrentTimeStr(&time_str_), socket_fd_, cfg_.rcvbuf_size_, actual);
+            }
+            if(cfg_.busy_poll_usecs_) {
+                ASSERT(setBusyPoll(socket_fd_, cfg_.busy_poll_usecs_), "setBusyPoll() failed. errno:" + string(strerror(errno)));
+            }
+        } else {
+            ASSERT(setMcastLoop(socket_fd_, cfg_.loopback_) && setMcastTTL(socket_fd_, cfg_.ttl_),
+                   "setsockopt() IP_MULTICAST_LOOP / IP_MULTICAST_TTL failed. errno:" + string(strerror(errno)));
+            if(!iface_ip_.empty()) {
+                ASSERT(setMcastInterface(socket_fd_, iface_ip_), "setMcastInterface() failed. errno:" + string(strerror(errno)));
+            }
+        }
+        return socket_fd_;
+    }
+
+    auto McastSocket::join(const string &ip) -> bool {
+        const auto joined = Common::join(socket_fd_, ip, iface_ip_);
+        logger_.log("%:% %() % socket:% group:% joined:%\n", __FILE__, __LINE__, __FUNCTION__,
+                    Common::getCurrentTimeStr(&time_str_), socket_fd_, ip, joined);
+        return joined;
+    }
+
+    auto McastSocket::leave(const string &ip) -> bool {
+        const auto left = Common::leave(socket_fd_, ip, iface_ip_);
+        logger_.log("%:% %() % socket:% group:% left:%\n", __FILE__, __LINE__, __FUNCTION__,
+                    Common::getCurrentTimeStr(&time_str_), socket_fd_, ip, left);
+        return left;
+    }
+
+    auto McastSocket::sendAndRecv() noexcept -> bool {
+        const auto start = inbound_tail_;
+        // batches up to the end of the ring or the oldest unconsumed packet, until the kernel has nothing left
+        while(true) {
+            const auto slot = inbound_tail_ & ring_mask_;
+            const auto batch = min({McastBatchSize, cfg_.ring_packets_ - packetsReadable(), cfg_.ring_packets_ - slot});
+            if(!batch) {
+                break;
+            }
+            for(size_t i = slot; i < slot + batch; ++i) {
+                inbound_msgs_[i].msg_hdr.msg_controllen = sizeof(McastPacket::ctrl_);
+            }
+            const auto n = recvmmsg(socket_fd_, &inbound_msgs_[slot], static_cast<unsigned int>(batch), MSG_DONTWAIT, nullptr);
+            if(n <= 0) {
+                break;
+            }
+
+            const auto user_time = getTSCNanos();
+            for(auto i = slot; i < slot + static_cast<size_t>(n); ++i) {
+                auto &packet = inbound_packets_[i];
+                const auto &msg = inbound_msgs_[i];
+                packet.len_ = msg.msg_len;
+                packet.flags_ = msg.msg_hdr.msg_flags;
+                packet.user_time_ = user_time;
+                packet.kernel_time_ = 0;
+                for(auto cmsg = CMSG_FIRSTHDR(&msg.msg_hdr); cmsg; cmsg = CMSG_NXTHDR(const_cast<msghdr *>(&msg.msg_hdr), cmsg)) {
+                    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                        timespec ts;
+                        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                        packet.kernel_time_ = ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+                    }
+                }
+                packets_truncated_ += ((packet.flags_ & MSG_TRUNC) != 0);
+            }
+            inbound_tail_ += n;
+            if(static_cast<size_t>(n) < batch) {
+                break;
+            }
+        }
+
+        const auto read = (inbound_tail_ != start);
+        if(read && recv_callback_) {
+            recv_callback_(this);
+        }
+
+        sendPending();
+        return read;
+    }
+
+    auto McastSocket::send(const void *data, size_t len) noexcept -> bool {
+        if(UNLIKELY(packetsPending() == cfg_.ring_packets_ || len > McastPacketSize)) {
+            return false;
+        }
+        const auto slot = outbound_tail_ & ring_mask_;
+        memcpy(outbound_packets_[slot].data_, data, len);
+        outbound_iovs_[slot].iov_len = len;
+        ++outbound_tail_;
+        return true;
+    }
+
+    auto McastSocket::sendPending() noexcept -> bool {
+        while(packetsPending()) {
+            const auto slot = outbound_head_ & ring_mask_;
+            const auto batch = min({McastBatchSize, packetsPending(), cfg_.ring_packets_ - slot});
+            const auto n = sendmmsg(socket_fd_, &outbound_msgs_[slot], static_cast<unsigned int>(batch), MSG_DONTWAIT);
+            if(n > 0) {
+                outbound_head_ += n;
+                continue;
+            }
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == EINTR) {
+                break;
+            }
+            // the datagram at the head was refused, e.g. an ICMP error reported on the connected socket, so we skip it
+            ++packets_dropped_;
+            ++outbound_head_;
+            logger_.log("%:% %() % socket:% sendmmsg() failed, dropped a packet. error:%\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), socket_fd_, strerror(errno));
+        }
+        return !packetsPending();
+    }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "logging.h"
+#include "socket_utils.h"
+#include "mem_utils.h"
+#include "tsc_clock.h"
+
+using namespace std;
+
+namespace Common {
+    // largest datagram we handle, anything bigger is truncated (MSG_TRUNC is set on the packet)
+    constexpr size_t McastPacketSize = 2048;
+
+    // datagrams moved per recvmmsg() / sendmmsg()
+    constexpr size_t McastBatchSize = 64;
+
+    // default number of packets in each of a socket's inbound and outbound rings
+    constexpr size_t McastRingPackets = 4096;
+
+    struct McastPacket {
+        // software receive timestamp from the kernel, and when the batch it came in was read
+        Nanos kernel_time_ = 0;
+        Nanos user_time_ = 0;
+        size_t len_ = 0;
+        // MSG_TRUNC when the datagram did not fit
+        int flags_ = 0;
+        char data_[McastPacketSize];
+        // control messages the kernel fills on receive
+        alignas(cmsghdr) char ctrl_[CMSG_SPACE(sizeof(timespec))];
+    };
+
+    struct McastCfg {
+        // SO_RCVBUF in bytes, 0 keeps the system default
+        int rcvbuf_size_ = 0;
+        // SO_BUSY_POLL in microseconds, 0 turns busy polling off
+        int busy_poll_usecs_ = 0;
+        // our own packets are delivered to members on this host, what makes loopback testing work
+        bool loopback_ = true;
+        int ttl_ = 1;
+        // power of two
+        size_t ring_packets_ = McastRingPackets;
+        StorageCfg storage_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "McastCfg[rcvbuf_size:" << rcvbuf_size_
+            << " busy_poll_usecs:" << busy_poll_usecs_
+            << " loopback:" << loopback_
+            << " ttl:" << ttl_
+            << " ring_packets:" << ring_packets_
+            << " storage:" << storage_cfg_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // UDP multicast socket, single threaded
+    // datagrams are read in batches with recvmmsg() straight into a preallocated ring of packets and written in batches
+    // with sendmmsg() from another, the mmsghdr / iovec of every slot are set up once so a batch costs one syscall and no
+    // per-packet setup beyond resetting the lengths the kernel overwrites
+    struct McastSocket {
+        explicit McastSocket(Logger &logger, const McastCfg &cfg = {});
+
+        ~McastSocket() {
+            if(socket_fd_ >= 0) {
+                close(socket_fd_);
+            }
+        }
+
+        // a receiver (is_listening) binds to port and joins groups with join(), a publisher sends to ip:port
+        // iface is the interface multicast is joined on and sent from
+        auto init(const string &ip, const string &iface, int port, bool is_listening) -> int;
+
+        // group membership can change at any time, e.g. to leave a feed and rejoin it later
+        auto join(const string &ip) -> bool;
+
+        auto leave(const string &ip) -> bool;
+
+        // reads what the kernel has queued into the inbound ring, invokes recv_callback_ if anything arrived, then
+        // publishes pending outbound packets, returns true if something was read
+        auto sendAndRecv() noexcept -> bool;
+
+        // queues one datagram, false if the outbound ring is full or len is over McastPacketSize
+        auto send(const void *data, size_t len) noexcept -> bool;
+
+        // publishes as many queued datagrams as the kernel takes, returns true once nothing is left
+        auto sendPending() noexcept -> bool;
+
+        // received packets, oldest first, recv_callback_ pops what it has handled
+        auto packetsReadable() const noexcept {
+            return inbound_tail_ - inbound_head_;
+        }
+
+        auto frontPacket() const noexcept -> const McastPacket & {
+            return inbound_packets_[inbound_head_ & ring_mask_];
+        }
+
+        auto popPacket() noexcept {
+            if(UNLIKELY(inbound_head_ == inbound_tail_)) {
+                FATAL("McastSocket popPacket on an empty ring.");
+            }
+            ++inbound_head_;
+        }
+
+        auto packetsPending() const noexcept {
+            return outbound_tail_ - outbound_head_;
+        }
+
+        McastSocket() = delete;
+
+        McastSocket(const McastSocket &) = delete;
+
+        McastSocket(const McastSocket &&) = delete;
+
+        McastSocket &operator=(const McastSocket &) = delete;
+
+        McastSocket &operator=(const McastSocket &&) = delete;
+
+        int socket_fd_ = -1;
+
+        McastCfg cfg_;
+
+        // iface's address, the groups are joined on it
+        string iface_ip_;
+        // where a publisher's packets go, given with every datagram so the route is looked up after IP_MULTICAST_IF is set
+        sockaddr_in dest_addr_{};
+
+        function<void(McastSocket *s)> recv_callback_ = nullptr;
+
+        // datagrams the kernel reported as truncated, and sends it refused other than for lack of buffer space
+        size_t packets_truncated_ = 0;
+        size_t packets_dropped_ = 0;
+
+        private:
+        // slots are used modulo ring_packets_, head_ / tail_ are running counts
+        size_t ring_mask_;
+
+        vector<McastPacket, StorageAllocator<McastPacket>> inbound_packets_;
+        vector<iovec> inbound_iovs_;
+        vector<mmsghdr> inbound_msgs_;
+        size_t inbound_head_ = 0;
+        size_t inbound_tail_ = 0;
+
+        vector<McastPacket, StorageAllocator<McastPacket>> outbound_packets_;
+        vector<iovec> outbound_iovs_;
+        vector<mmsghdr> outbound_msgs_;
+        size_t outbound_head_ = 0;
+        size_t outbound_tail_ = 0;
+
+        string time_str_;
+        Logger &logger_;
+    };
+}
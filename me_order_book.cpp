@@ -0,0 +1,185 @@
+#include "me_order_book.h"
+
+using namespace std;
+
+namespace Exchange {
+    MEOrderBook::MEOrderBook(TickerId ticker_id, const MEOrderBookCfg &cfg, ClientResponseLFQueue *client_responses,
+                             MEMarketUpdateLFQueue *market_updates, Common::Logger &logger) :
+        ticker_id_(ticker_id), cfg_(cfg), client_responses_(client_responses), market_updates_(market_updates),
+        price_levels_(cfg.price_levels_, nullptr), level_mask_(cfg.price_levels_ - 1),
+        // a slot holds one level at a time, so there never are more levels than slots
+        level_pool_(cfg.price_levels_, cfg.storage_cfg_), order_pool_(cfg.max_orders_, cfg.storage_cfg_),
+        orders_(cfg.max_orders_, cfg.storage_cfg_), logger_(logger) {
+        ASSERT(has_single_bit(cfg_.price_levels_), "Price levels have to be a power of two. " + cfg_.toString());
+    }
+
+    auto MEOrderBook::add(ClientId client_id, OrderId client_order_id, Side side, Price price, Qty qty) noexcept -> void {
+        // an order that does not cross is only ever going to rest, if it cannot it is turned away before it is accepted
+        const auto marketable = (side == Side::BUY ? (asks_by_price_ && price >= asks_by_price_->price_) :
+                                 (bids_by_price_ && price <= bids_by_price_->price_));
+        if(UNLIKELY(side == Side::INVALID || !qty || price == Price_INVALID || orders_.find(client_id, client_order_id) ||
+                    (!marketable && !canRest(price)))) {
+            logger_.log("%:% %() % rejected client:% oid:% side:% price:% qty:% resting:%\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), client_id, client_order_id, sideToString(side), price, qty,
+                        order_pool_.size());
+            sendClientResponse({ClientResponseType::REJECTED, client_id, ticker_id_, client_order_id, OrderId_INVALID, side,
+                                price, 0, 0});
+            return;
+        }
+
+        const auto market_order_id = next_market_order_id_++;
+        sendClientResponse({ClientResponseType::ACCEPTED, client_id, ticker_id_, client_order_id, market_order_id, side, price,
+                            0, qty});
+
+        auto leaves_qty = qty;
+        if(side == Side::BUY) {
+            while(leaves_qty && asks_by_price_ && price >= asks_by_price_->price_) {
+                leaves_qty = match(client_id, client_order_id, market_order_id, side, leaves_qty, asks_by_price_);
+            }
+        } else {
+            while(leaves_qty && bids_by_price_ && price <= bids_by_price_->price_) {
+                leaves_qty = match(client_id, client_order_id, market_order_id, side, leaves_qty, bids_by_price_);
+            }
+        }
+
+        if(!leaves_qty) {
+            return;
+        }
+        if(UNLIKELY(!canRest(price))) {
+            // a sweep priced far through the book filled what it could, the rest has no level to go to
+            logger_.log("%:% %() % canceled remainder client:% oid:% side:% price:% leaves:% resting:%\n", __FILE__, __LINE__,
+                        __FUNCTION__, Common::getCurrentTimeStr(&time_str_), client_id, client_order_id, sideToString(side),
+                        price, leaves_qty, order_pool_.size());
+            sendClientResponse({ClientResponseType::CANCELED, client_id, ticker_id_, client_order_id, market_order_id, side,
+                                price, Qty_INVALID, leaves_qty});
+            return;
+        }
+        restOrder(order_pool_.allocate(MEOrder{ticker_id_, client_id, client_order_id, market_order_id, side, price,
+                                               leaves_qty, Priority_INVALID, nullptr, nullptr}));
+    }
+
+    auto MEOrderBook::match(ClientId client_id, OrderId client_order_id, OrderId market_order_id, Side side, Qty leaves_qty,
+                            MEOrdersAtPrice *level) noexcept -> Qty {
+        auto passive = level->first_me_order_;
+        const auto fill_qty = min(leaves_qty, passive->qty_);
+        leaves_qty -= fill_qty;
+        passive->qty_ -= fill_qty;
+
+        sendClientResponse({ClientResponseType::FILLED, client_id, ticker_id_, client_order_id, market_order_id, side,
+                            passive->price_, fill_qty, leaves_qty});
+        sendClientResponse({ClientResponseType::FILLED, passive->client_id_, ticker_id_, passive->client_order_id_,
+                            passive->market_order_id_, passive->side_, passive->price_, fill_qty, passive->qty_});
+        sendMarketUpdate({MarketUpdateType::TRADE, OrderId_INVALID, ticker_id_, side, passive->price_, fill_qty,
+                          Priority_INVALID});
+
+        if(!passive->qty_) {
+            sendMarketUpdate({MarketUpdateType::CANCEL, passive->market_order_id_, ticker_id_, passive->side_, passive->price_,
+                              0, passive->priority_});
+            removeOrder(passive);
+        } else {
+            sendMarketUpdate({MarketUpdateType::MODIFY, passive->market_order_id_, ticker_id_, passive->side_, passive->price_,
+                              passive->qty_, passive->priority_});
+        }
+
+        return leaves_qty;
+    }
+
+    auto MEOrderBook::restOrder(MEOrder *order) noexcept -> void {
+        auto &slot = price_levels_[levelSlot(order->price_)];
+        if(LIKELY(slot)) {
+            auto first = slot->first_me_order_;
+            auto last = first->prev_order_;
+            order->priority_ = last->priority_ + 1;
+            order->prev_order_ = last;
+            order->next_order_ = first;
+            last->next_order_ = order;
+            first->prev_order_ = order;
+        } else {
+            order->priority_ = 1;
+            order->prev_order_ = order->next_order_ = order;
+            slot = level_pool_.allocate(MEOrdersAtPrice{order->side_, order->price_, order, nullptr, nullptr});
+
+            // new levels mostly open at or near the top, so the walk from the best level is short
+            auto &best = (order->side_ == Side::BUY ? bids_by_price_ : asks_by_price_);
+            const auto better = [side = order->side_](Price lhs, Price rhs) {
+                return (side == Side::BUY ? lhs > rhs : lhs < rhs);
+            };
+            MEOrdersAtPrice *prev = nullptr;
+            auto next = best;
+            while(next && better(next->price_, order->price_)) {
+                prev = next;
+                next = next->next_entry_;
+            }
+            slot->prev_entry_ = prev;
+            slot->next_entry_ = next;
+            (prev ? prev->next_entry_ : best) = slot;
+            if(next) {
+                next->prev_entry_ = slot;
+            }
+        }
+
+        orders_.insert(order);
+        sendMarketUpdate({MarketUpdateType::ADD, order->market_order_id_, ticker_id_, order->side_, order->price_, order->qty_,
+                          order->priority_});
+    }
+
+    auto MEOrderBook::removeOrder(MEOrder *order) noexcept -> void {
+        auto &slot = price_levels_[levelSlot(order->price_)];
+        if(order->next_order_ == order) {
+            auto &best = (order->side_ == Side::BUY ? bids_by_price_ : asks_by_price_);
+            (slot->prev_entry_ ? slot->prev_entry_->next_entry_ : best) = slot->next_entry_;
+            if(slot->next_entry_) {
+                slot->next_entry_->prev_entry_ = slot->prev_entry_;
+            }
+            level_pool_.deallocate(slot);
+            slot = nullptr;
+        } else {
+            order->prev_order_->next_order_ = order->next_order_;
+            order->next_order_->prev_order_ = order->prev_order_;
+            if(slot->first_me_order_ == order) {
+                slot->first_me_order_ = order->next_order_;
+            }
+        }
+
+        orders_.erase(order);
+        order_pool_.deallocate(order);
+    }
+
+    auto MEOrderBook::cancel(ClientId client_id, OrderId client_order_id) noexcept -> void {
+        auto order = orders_.find(client_id, client_order_id);
+        // routinely a cancel that crossed a fill on the way in, not worth a log line
+        if(UNLIKELY(!order)) {
+            sendClientResponse({ClientResponseType::CANCEL_REJECTED, client_id, ticker_id_, client_order_id, OrderId_INVALID,
+                                Side::INVALID, Price_INVALID, Qty_INVALID, Qty_INVALID});
+            return;
+        }
+
+        sendClientResponse({ClientResponseType::CANCELED, client_id, ticker_id_, client_order_id, order->market_order_id_,
+                            order->side_, order->price_, Qty_INVALID, order->qty_});
+        sendMarketUpdate({MarketUpdateType::CANCEL, order->market_order_id_, ticker_id_, order->side_, order->price_, 0,
+                          order->priority_});
+        removeOrder(order);
+    }
+
+    auto MEOrderBook::toString() const -> string {
+        stringstream ss;
+        ss << "MEOrderBook[ticker:" << ticker_id_ << " orders:" << order_pool_.size() << "\n";
+        for(auto side : {Side::SELL, Side::BUY}) {
+            ss << " " << sideToString(side) << "\n";
+            for(auto level = (side == Side::BUY ? bids_by_price_ : asks_by_price_); level; level = level->next_entry_) {
+                size_t num_orders = 0;
+                uint64_t qty = 0;
+                auto order = level->first_me_order_;
+                do {
+                    ++num_orders;
+                    qty += order->qty_;
+                    order = order->next_order_;
+                } while(order != level->first_me_order_);
+                ss << "  price:" << level->price_ << " orders:" << num_orders << " qty:" << qty << "\n";
+            }
+        }
+        ss << "]";
+
+        return ss.str();
+    }
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <vector>
+#include <bit>
+
+#include "exchange_types.h"
+#include "mem_pool.h"
+#include "logging.h"
+
+using namespace std;
+
+namespace Exchange {
+    // a resting order, linked into the FIFO queue of its price level
+    struct MEOrder {
+        TickerId ticker_id_ = TickerId_INVALID;
+        ClientId client_id_ = ClientId_INVALID;
+        OrderId client_order_id_ = OrderId_INVALID;
+        OrderId market_order_id_ = OrderId_INVALID;
+        Side side_ = Side::INVALID;
+        Price price_ = Price_INVALID;
+        Qty qty_ = Qty_INVALID;
+        Priority priority_ = Priority_INVALID;
+
+        // circular, the first order's prev_order_ is the last one so appending is O(1)
+        MEOrder *prev_order_ = nullptr;
+        MEOrder *next_order_ = nullptr;
+    };
+
+    // the orders at one price on one side, oldest first, and the neighbouring levels on that side
+    struct MEOrdersAtPrice {
+        Side side_ = Side::INVALID;
+        Price price_ = Price_INVALID;
+        MEOrder *first_me_order_ = nullptr;
+
+        // best to worst: descending prices for bids, ascending for asks, nullptr at either end
+        MEOrdersAtPrice *prev_entry_ = nullptr;
+        MEOrdersAtPrice *next_entry_ = nullptr;
+    };
+
+    struct MEOrderBookCfg {
+        // resting orders the book holds at most, orders that would rest beyond that are rejected, or the unfilled rest of a
+        // marketable one canceled
+        size_t max_orders_ = 64 * 1024;
+        // width of the window of prices the book can hold at once, in ticks, a power of two
+        size_t price_levels_ = 4096;
+        Common::StorageCfg storage_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "MEOrderBookCfg[max_orders:" << max_orders_
+            << " price_levels:" << price_levels_
+            << " storage:" << storage_cfg_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // (client id, client order id) -> resting order, open addressing with linear probing over a flat array sized to twice
+    // the book's capacity, so a lookup is a hash and usually a single cache line
+    // erase() shifts later entries of the probe run back instead of leaving tombstones, so the table never degrades
+    class MEOrderTable final {
+        public:
+        explicit MEOrderTable(size_t max_orders, const Common::StorageCfg &storage_cfg = {}) :
+            slots_(bit_ceil(2 * max_orders), nullptr, Common::StorageAllocator<MEOrder *>(storage_cfg)), mask_(slots_.size() - 1) {
+        }
+
+        auto find(ClientId client_id, OrderId client_order_id) const noexcept -> MEOrder * {
+            for(auto slot = home(client_id, client_order_id);; slot = (slot + 1) & mask_) {
+                auto order = slots_[slot];
+                if(!order || (order->client_id_ == client_id && order->client_order_id_ == client_order_id)) {
+                    return order;
+                }
+            }
+        }
+
+        // the table is never more than half full, so there always is a free slot
+        auto insert(MEOrder *order) noexcept {
+            auto slot = home(order->client_id_, order->client_order_id_);
+            while(slots_[slot]) {
+                slot = (slot + 1) & mask_;
+            }
+            slots_[slot] = order;
+        }
+
+        auto erase(const MEOrder *order) noexcept {
+            auto slot = home(order->client_id_, order->client_order_id_);
+            while(slots_[slot] != order) {
+                slot = (slot + 1) & mask_;
+            }
+            // moves back every later entry of the run whose home is at or before the hole
+            for(auto next = (slot + 1) & mask_; slots_[next]; next = (next + 1) & mask_) {
+                const auto next_home = home(slots_[next]->client_id_, slots_[next]->client_order_id_);
+                if(((next - next_home) & mask_) >= ((next - slot) & mask_)) {
+                    slots_[slot] = slots_[next];
+                    slot = next;
+                }
+            }
+            slots_[slot] = nullptr;
+        }
+
+        MEOrderTable() = delete;
+
+        MEOrderTable(const MEOrderTable &) = delete;
+
+        MEOrderTable(const MEOrderTable &&) = delete;
+
+        MEOrderTable &operator=(const MEOrderTable &) = delete;
+
+        MEOrderTable &operator=(const MEOrderTable &&) = delete;
+
+        private:
+        auto home(ClientId client_id, OrderId client_order_id) const noexcept -> size_t {
+            const auto key = (client_order_id ^ (static_cast<uint64_t>(client_id) << 40)) * 0x9E3779B97F4A7C15ULL;
+            return static_cast<size_t>(key >> 32) & mask_;
+        }
+
+        vector<MEOrder *, Common::StorageAllocator<MEOrder *>> slots_;
+        const size_t mask_;
+    };
+
+    // price-time priority limit order book for one instrument, used only from the matching engine thread
+    // price levels sit in a flat array indexed by price tick modulo MEOrderBookCfg::price_levels_, so finding the level of
+    // a price is an index; each side also links its levels best to worst, so the top of book and the next level to match
+    // against are a pointer away; orders and levels come from FreeListMemPools, nothing is allocated while trading
+    // responses and market updates are written straight into the engine's outbound queues
+    class MEOrderBook final {
+        public:
+        MEOrderBook(TickerId ticker_id, const MEOrderBookCfg &cfg, ClientResponseLFQueue *client_responses,
+                    MEMarketUpdateLFQueue *market_updates, Common::Logger &logger);
+
+        // matches against the opposite side as far as price allows and rests what is left
+        // the rest is canceled if the book cannot hold it: its price slot belongs to another price or the book is full, an
+        // order that would not match at all is rejected for the same reasons
+        auto add(ClientId client_id, OrderId client_order_id, Side side, Price price, Qty qty) noexcept -> void;
+
+        auto cancel(ClientId client_id, OrderId client_order_id) noexcept -> void;
+
+        auto bestBid() const noexcept {
+            return (bids_by_price_ ? bids_by_price_->price_ : Price_INVALID);
+        }
+
+        auto bestAsk() const noexcept {
+            return (asks_by_price_ ? asks_by_price_->price_ : Price_INVALID);
+        }
+
+        auto numOrders() const noexcept {
+            return order_pool_.size();
+        }
+
+        // every resting order, bids then asks, best price first and oldest first within a price
+        template<typename F>
+        auto forEachOrder(F &&f) const noexcept {
+            for(auto level : {bids_by_price_, asks_by_price_}) {
+                for(; level; level = level->next_entry_) {
+                    auto order = level->first_me_order_;
+                    do {
+                        f(*order);
+                        order = order->next_order_;
+                    } while(order != level->first_me_order_);
+                }
+            }
+        }
+
+        auto toString() const -> string;
+
+        MEOrderBook() = delete;
+
+        MEOrderBook(const MEOrderBook &) = delete;
+
+        MEOrderBook(const MEOrderBook &&) = delete;
+
+        MEOrderBook &operator=(const MEOrderBook &) = delete;
+
+        MEOrderBook &operator=(const MEOrderBook &&) = delete;
+
+        private:
+        auto levelSlot(Price price) const noexcept {
+            return static_cast<size_t>(price) & level_mask_;
+        }
+
+        // a price whose slot is taken by another price is further from the resting orders than the window reaches
+        auto canRest(Price price) const noexcept {
+            const auto slot_level = price_levels_[levelSlot(price)];
+            return (!slot_level || slot_level->price_ == price) && order_pool_.size() < order_pool_.capacity();
+        }
+
+        // executes against the oldest order of level, returns what is left of the aggressor
+        auto match(ClientId client_id, OrderId client_order_id, OrderId market_order_id, Side side, Qty leaves_qty,
+                   MEOrdersAtPrice *level) noexcept -> Qty;
+
+        auto restOrder(MEOrder *order) noexcept -> void;
+
+        // unlinks order, drops its level if it was the last one there, and frees it
+        auto removeOrder(MEOrder *order) noexcept -> void;
+
+        auto sendClientResponse(const MEClientResponse &response) noexcept {
+            // the gateway drains this queue, a full queue means it is behind and waiting for it is all we can do
+            LATENCY_PROBE_START(handoff);
+            MEClientResponse *next;
+            while(UNLIKELY(!(next = client_responses_->getNextToWriteTo()))) {
+            }
+            *next = response;
+            client_responses_->updateWriteIndex();
+            LATENCY_PROBE_END(handoff, "MEOrderBook::sendClientResponse");
+        }
+
+        auto sendMarketUpdate(const MEMarketUpdate &update) noexcept {
+            LATENCY_PROBE_START(handoff);
+            MEMarketUpdate *next;
+            while(UNLIKELY(!(next = market_updates_->getNextToWriteTo()))) {
+            }
+            *next = update;
+            market_updates_->updateWriteIndex();
+            LATENCY_PROBE_END(handoff, "MEOrderBook::sendMarketUpdate");
+        }
+
+        const TickerId ticker_id_;
+        const MEOrderBookCfg cfg_;
+        ClientResponseLFQueue *client_responses_ = nullptr;
+        MEMarketUpdateLFQueue *market_updates_ = nullptr;
+
+        // best level of each side
+        MEOrdersAtPrice *bids_by_price_ = nullptr;
+        MEOrdersAtPrice *asks_by_price_ = nullptr;
+
+        vector<MEOrdersAtPrice *> price_levels_;
+        const size_t level_mask_;
+
+        Common::FreeListMemPool<MEOrdersAtPrice> level_pool_;
+        Common::FreeListMemPool<MEOrder> order_pool_;
+        MEOrderTable orders_;
+
+        OrderId next_market_order_id_ = 1;
+
+        string time_str_;
+        Common::Logger &logger_;
+    };
+}
@@ -3,20 +3,29 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
 
 #include "macros.h"
+#include "thread_utils.h"
+#include "mem_utils.h"
+#include "latency_probe.h"
 
 namespace Common {
   template<typename T>
   class MemPool final {
   public:
-    explicit MemPool(std::size_t num_elems) :
-        store_(num_elems, {T(), true}) /* pre-allocation of vector storage. */ {
+    explicit MemPool(std::size_t num_elems, const StorageCfg &storage_cfg = {}) :
+        store_(num_elems, {T(), true}, StorageAllocator<ObjectBlock>(storage_cfg)) /* pre-allocation of vector storage. */ {
       ASSERT(reinterpret_cast<const ObjectBlock *>(&(store_[0].object_)) == &(store_[0]), "T object should be first member of ObjectBlock.");
     }
 
     template<typename... Args>
     T *allocate(Args... args) noexcept {
+      LATENCY_PROBE_SCOPE("MemPool::allocate");
       auto obj_block = &(store_[next_free_index_]);
       ASSERT(obj_block->is_free_, "Expected free ObjectBlock at index:" + std::to_string(next_free_index_));
       T *ret = &(obj_block->object_);
@@ -35,6 +44,10 @@ namespace Common {
       store_[elem_index].is_free_ = true;
     }
 
+    auto storageInfo() const noexcept -> StorageInfo {
+      return store_.get_allocator().info();
+    }
+
     // Deleted default, copy & move constructors and assignment-operators.
     MemPool() = delete;
 
@@ -70,8 +83,329 @@ namespace Common {
     // We could've chosen to use a std::array that would allocate the memory on the stack instead of the heap.
     // We would have to measure to see which one yields better performance.
     // It is good to have objects on the stack but performance starts getting worse as the size of the pool increases.
-    std::vector<ObjectBlock> store_;
+    std::vector<ObjectBlock, StorageAllocator<ObjectBlock>> store_;
 
     size_t next_free_index_ = 0;
   };
+
+  // O(1) pool: freed blocks are chained into an intrusive singly linked free list that reuses the object's own storage.
+  // Blocks are raw uninitialized storage, so T does not need a default constructor and constructing the pool does not touch the
+  // memory; blocks never used before are handed out by bumping next_unused_index_ so pages are only faulted in on first use.
+  // Alignment lets callers put each block on its own cache line (e.g. CACHE_LINE_SIZE) for objects written by different threads.
+  template<typename T, std::size_t Alignment = alignof(T)>
+  class FreeListMemPool final {
+  public:
+    explicit FreeListMemPool(std::size_t num_elems, const StorageCfg &storage_cfg = {}) :
+        allocator_(storage_cfg), store_(allocator_.allocate(num_elems)) /* raw storage, the blocks are left untouched. */, capacity_(num_elems) {
+      ASSERT(num_elems > 0, "FreeListMemPool needs a non zero capacity.");
+    }
+
+    ~FreeListMemPool() {
+      allocator_.deallocate(store_, capacity_);
+    }
+
+    template<typename... Args>
+    T *allocate(Args &&... args) noexcept {
+      ObjectBlock *obj_block = free_list_head_;
+      if (LIKELY(obj_block)) {
+        free_list_head_ = obj_block->next_free_;
+      } else {
+        if (UNLIKELY(next_unused_index_ == capacity_)) {
+          FATAL("Memory Pool out of space.");
+        }
+        obj_block = &store_[next_unused_index_++];
+      }
+      ++num_allocated_;
+      return new(obj_block->object_) T(std::forward<Args>(args)...); // placement new.
+    }
+
+    auto deallocate(const T *elem) noexcept {
+      auto obj_block = reinterpret_cast<ObjectBlock *>(const_cast<T *>(elem));
+      if (UNLIKELY(obj_block < store_ || obj_block >= store_ + next_unused_index_)) {
+        FATAL("Element being deallocated does not belong to this Memory pool.");
+      }
+      elem->~T();
+      obj_block->next_free_ = free_list_head_;
+      free_list_head_ = obj_block;
+      --num_allocated_;
+    }
+
+    auto size() const noexcept {
+      return num_allocated_;
+    }
+
+    auto capacity() const noexcept {
+      return capacity_;
+    }
+
+    auto storageInfo() const noexcept -> StorageInfo {
+      return allocator_.info();
+    }
+
+    // Deleted default, copy & move constructors and assignment-operators.
+    FreeListMemPool() = delete;
+
+    FreeListMemPool(const FreeListMemPool &) = delete;
+
+    FreeListMemPool(const FreeListMemPool &&) = delete;
+
+    FreeListMemPool &operator=(const FreeListMemPool &) = delete;
+
+    FreeListMemPool &operator=(const FreeListMemPool &&) = delete;
+
+  private:
+    // A block holds either a live T or, while free, the link to the next free block - no separate is_free_ flag.
+    union alignas(std::max({Alignment, alignof(T), alignof(void *)})) ObjectBlock {
+      ObjectBlock *next_free_;
+      std::byte object_[sizeof(T)];
+    };
+
+    StorageAllocator<ObjectBlock> allocator_;
+    ObjectBlock *store_;
+    const std::size_t capacity_;
+
+    ObjectBlock *free_list_head_ = nullptr;
+    std::size_t next_unused_index_ = 0;
+    std::size_t num_allocated_ = 0;
+  };
+
+  // Pool for objects allocated on one thread and released on another (e.g. orders created by the gateway and retired by the
+  // matching engine), so pointers can be handed across an LFQueue instead of copying the objects.
+  // - every thread allocates from its own local free list, no atomics on the fast path.
+  // - a block freed by a thread other than the one that allocated it is pushed onto the allocating thread's remote free list,
+  //   a lock-free stack the owner takes over in one exchange() when its local list runs dry.
+  // - a local list that grows past 2 * batch_size_ drains batch_size_ blocks into the shared depot, and an empty one refills a
+  //   whole batch from it, so threads that only free (or only allocate) settle into one depot operation per batch.
+  // - once no block is left unused, a thread that finds its own lists and the depot empty takes over another thread's remote
+  //   free list, and allocate() returns nullptr only when every free block sits in some thread's local list.
+  // Threads are identified by getThreadIndex(), the first MaxThreads get a cache each and any later ones share one more cache
+  // behind a mutex. Meant for our long-lived pinned threads: up to 2 * batch_size_ blocks cached by a thread that exits are
+  // not given back.
+  template<typename T, std::size_t Alignment = alignof(T), std::size_t MaxThreads = 64>
+  class ConcurrentMemPool final {
+  public:
+    explicit ConcurrentMemPool(std::size_t num_elems, std::size_t batch_size = 64, const StorageCfg &storage_cfg = {}) :
+        allocator_(storage_cfg), store_(allocator_.allocate(num_elems)) /* raw storage, the blocks are left untouched. */,
+        capacity_(num_elems), batch_size_(std::min(batch_size, num_elems)) {
+      ASSERT(num_elems > 0 && batch_size > 0, "ConcurrentMemPool needs a non zero capacity and batch size.");
+      ASSERT(num_elems < UINT32_MAX, "ConcurrentMemPool indexes blocks with 32 bits.");
+    }
+
+    ~ConcurrentMemPool() {
+      allocator_.deallocate(store_, capacity_);
+    }
+
+    // nullptr when the pool is out of free blocks this thread can reach.
+    template<typename... Args>
+    T *allocate(Args &&... args) noexcept {
+      const auto slot = getSlot();
+      ObjectBlock *obj_block;
+      if (LIKELY(slot != SHARED_SLOT)) {
+        obj_block = takeBlock(slot);
+      } else {
+        std::lock_guard<std::mutex> lock(shared_mutex_);
+        obj_block = takeBlock(slot);
+      }
+      if (UNLIKELY(!obj_block)) {
+        return nullptr;
+      }
+      return new(obj_block->object_) T(std::forward<Args>(args)...); // placement new.
+    }
+
+    auto deallocate(const T *elem) noexcept {
+      auto obj_block = reinterpret_cast<ObjectBlock *>(const_cast<T *>(elem));
+      if (UNLIKELY(obj_block < store_ || obj_block >= store_ + capacity_)) {
+        FATAL("Element being deallocated does not belong to this Memory pool.");
+      }
+      elem->~T();
+
+      const auto slot = getSlot();
+      if (LIKELY(obj_block->owner_ == slot)) {
+        if (LIKELY(slot != SHARED_SLOT)) {
+          freeLocal(caches_[slot], obj_block);
+        } else {
+          std::lock_guard<std::mutex> lock(shared_mutex_);
+          freeLocal(caches_[slot], obj_block);
+        }
+        return;
+      }
+
+      // remote free, hand the block back to the thread that allocated it.
+      auto &owner = caches_[obj_block->owner_];
+      auto head = owner.remote_head_.load(std::memory_order_relaxed);
+      do {
+        obj_block->link_.next_free_ = head;
+      } while (!owner.remote_head_.compare_exchange_weak(head, obj_block, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    auto capacity() const noexcept {
+      return capacity_;
+    }
+
+    auto storageInfo() const noexcept -> StorageInfo {
+      return allocator_.info();
+    }
+
+    // Deleted default, copy & move constructors and assignment-operators.
+    ConcurrentMemPool() = delete;
+
+    ConcurrentMemPool(const ConcurrentMemPool &) = delete;
+
+    ConcurrentMemPool(const ConcurrentMemPool &&) = delete;
+
+    ConcurrentMemPool &operator=(const ConcurrentMemPool &) = delete;
+
+    ConcurrentMemPool &operator=(const ConcurrentMemPool &&) = delete;
+
+  private:
+    // While a block is free its storage holds the free list link, and for the first block of a depot batch also the batch
+    // size and the index + 1 of the next batch's first block.
+    struct ObjectBlock;
+
+    struct FreeLink {
+      ObjectBlock *next_free_;
+      uint32_t next_batch_;
+      uint32_t batch_count_;
+    };
+
+    struct ObjectBlock {
+      union alignas(std::max({Alignment, alignof(T), alignof(void *)})) {
+        std::byte object_[sizeof(T)];
+        FreeLink link_;
+      };
+      uint32_t owner_;
+    };
+
+    struct ThreadCache {
+      // owner only.
+      alignas(CACHE_LINE_SIZE) ObjectBlock *local_head_ = nullptr;
+      std::size_t local_count_ = 0;
+
+      // pushed to by every other thread.
+      alignas(CACHE_LINE_SIZE) std::atomic<ObjectBlock *> remote_head_ = {nullptr};
+    };
+
+    // cache of every thread past the first MaxThreads, used under shared_mutex_.
+    static constexpr uint32_t SHARED_SLOT = MaxThreads;
+
+    static auto getSlot() noexcept -> uint32_t {
+      return static_cast<uint32_t>(std::min<std::size_t>(getThreadIndex(), SHARED_SLOT));
+    }
+
+    auto takeBlock(uint32_t slot) noexcept -> ObjectBlock * {
+      auto &cache = caches_[slot];
+      if (UNLIKELY(!cache.local_head_ && !refill(cache))) {
+        return nullptr;
+      }
+      auto obj_block = cache.local_head_;
+      cache.local_head_ = obj_block->link_.next_free_;
+      --cache.local_count_;
+      obj_block->owner_ = slot;
+      return obj_block;
+    }
+
+    auto freeLocal(ThreadCache &cache, ObjectBlock *obj_block) noexcept {
+      obj_block->link_.next_free_ = cache.local_head_;
+      cache.local_head_ = obj_block;
+      if (UNLIKELY(++cache.local_count_ > 2 * batch_size_)) {
+        drain(cache);
+      }
+    }
+
+    // takes over a remote free list as the local one.
+    static auto adoptRemote(ThreadCache &cache, ThreadCache &from) noexcept {
+      auto head = from.remote_head_.exchange(nullptr, std::memory_order_acquire);
+      if (!head) {
+        return false;
+      }
+      cache.local_head_ = head;
+      for (cache.local_count_ = 0; head; head = head->link_.next_free_) {
+        ++cache.local_count_;
+      }
+      return true;
+    }
+
+    auto refill(ThreadCache &cache) noexcept -> bool {
+      // 1. blocks other threads freed back to us.
+      if (adoptRemote(cache, cache)) {
+        return true;
+      }
+
+      // 2. a batch drained into the depot by some thread.
+      if (auto batch = popBatch()) {
+        cache.local_head_ = batch;
+        cache.local_count_ = batch->link_.batch_count_;
+        return true;
+      }
+
+      // 3. a batch of blocks nobody has used yet, checked first so failed attempts do not keep moving the index.
+      if (next_unused_index_.load(std::memory_order_relaxed) < capacity_) {
+        const auto first = next_unused_index_.fetch_add(batch_size_, std::memory_order_relaxed);
+        if (LIKELY(first < capacity_)) {
+          const auto last = std::min(first + batch_size_, capacity_);
+          for (auto i = first; i < last; ++i) {
+            store_[i].link_.next_free_ = (i + 1 < last ? &store_[i + 1] : nullptr);
+          }
+          cache.local_head_ = &store_[first];
+          cache.local_count_ = last - first;
+          return true;
+        }
+      }
+
+      // 4. blocks freed back to other threads that have not needed them yet.
+      for (auto &other : caches_) {
+        if (adoptRemote(cache, other)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    auto drain(ThreadCache &cache) noexcept {
+      auto batch = cache.local_head_;
+      auto tail = batch;
+      for (std::size_t i = 1; i < batch_size_; ++i) {
+        tail = tail->link_.next_free_;
+      }
+      cache.local_head_ = tail->link_.next_free_;
+      cache.local_count_ -= batch_size_;
+      tail->link_.next_free_ = nullptr;
+      batch->link_.batch_count_ = static_cast<uint32_t>(batch_size_);
+      pushBatch(batch);
+    }
+
+    // The depot is a Treiber stack of batches. The head packs the first block's index + 1 in the low 32 bits and a counter
+    // bumped on every update in the high 32 bits, so a batch popped and pushed back in between cannot fool a stale CAS (ABA).
+    auto pushBatch(ObjectBlock *batch) noexcept {
+      const auto index = static_cast<uint64_t>(batch - store_) + 1;
+      auto head = depot_head_.load(std::memory_order_relaxed);
+      do {
+        std::atomic_ref<uint32_t>(batch->link_.next_batch_).store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+      } while (!depot_head_.compare_exchange_weak(head, index | (((head >> 32) + 1) << 32), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    auto popBatch() noexcept -> ObjectBlock * {
+      auto head = depot_head_.load(std::memory_order_acquire);
+      while (static_cast<uint32_t>(head)) {
+        auto batch = &store_[static_cast<uint32_t>(head) - 1];
+        // batch may be popped and handed out concurrently, the value read is then stale and the CAS below fails.
+        const uint64_t next = std::atomic_ref<uint32_t>(batch->link_.next_batch_).load(std::memory_order_relaxed);
+        if (depot_head_.compare_exchange_weak(head, next | (((head >> 32) + 1) << 32), std::memory_order_acquire, std::memory_order_acquire)) {
+          return batch;
+        }
+      }
+      return nullptr;
+    }
+
+    StorageAllocator<ObjectBlock> allocator_;
+    ObjectBlock *store_;
+    const std::size_t capacity_;
+    const std::size_t batch_size_;
+
+    ThreadCache caches_[MaxThreads + 1];
+    std::mutex shared_mutex_;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> depot_head_ = {0};
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> next_unused_index_ = {0};
+  };
 }
\ No newline at end of file
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <memory>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+
+#include "macros.h"
+
+using namespace std;
+
+// backing storage for the big preallocated structures (pools, queues, socket buffers)
+// by default they come from the heap like any vector, a StorageCfg can instead ask for an anonymous mapping that is:
+// - backed by explicit huge pages (MAP_HUGETLB) or transparent huge pages (madvise(MADV_HUGEPAGE)) to save TLB entries
+// - bound to a NUMA node, or that of the core the owning thread is pinned to with setThreadCore(), so memory is local to it
+// - pre-faulted (MAP_POPULATE) so the page faults happen at startup and not on the first message
+// - locked (mlock) so it is never paged out
+// every step falls back quietly when the system does not allow it, StorageInfo records what was actually obtained
+
+namespace Common {
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // bind to the NUMA node of the core the calling thread is running on
+    constexpr int NUMA_NODE_LOCAL = -2;
+
+    struct StorageCfg {
+        bool use_huge_pages_ = false;
+        bool use_transparent_huge_pages_ = false;
+        bool lock_ = false;
+        bool prefault_ = false;
+        int numa_node_ = -1;
+        // bind to the NUMA node of this core instead, e.g. the one the owning thread gets pinned to once it starts, when
+        // the storage is allocated by another thread (where NUMA_NODE_LOCAL would pick that thread's node)
+        int core_id_ = -1;
+
+        auto isHeap() const noexcept {
+            return !use_huge_pages_ && !use_transparent_huge_pages_ && !lock_ && !prefault_ && numa_node_ == -1 && core_id_ == -1;
+        }
+
+        auto toString() const {
+            stringstream ss;
+            ss << "StorageCfg[huge_pages:" << use_huge_pages_
+            << " transparent_huge_pages:" << use_transparent_huge_pages_
+            << " lock:" << lock_
+            << " prefault:" << prefault_
+            << " numa_node:" << numa_node_
+            << " core_id:" << core_id_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    enum class StorageMode : int8_t {
+        HEAP = 0,
+        PAGES = 1,
+        TRANSPARENT_HUGE_PAGES = 2,
+        HUGE_PAGES = 3
+    };
+
+    inline auto storageModeToString(StorageMode mode) -> string {
+        switch (mode) {
+            case StorageMode::HEAP:
+                return "HEAP";
+            case StorageMode::PAGES:
+                return "PAGES";
+            case StorageMode::TRANSPARENT_HUGE_PAGES:
+                return "TRANSPARENT_HUGE_PAGES";
+            case StorageMode::HUGE_PAGES:
+                return "HUGE_PAGES";
+        }
+        return "UNKNOWN";
+    }
+
+    struct StorageInfo {
+        StorageMode mode_ = StorageMode::HEAP;
+        size_t bytes_ = 0;
+        bool locked_ = false;
+        bool prefaulted_ = false;
+        int numa_node_ = -1;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "StorageInfo[mode:" << storageModeToString(mode_)
+            << " bytes:" << bytes_
+            << " locked:" << locked_
+            << " prefaulted:" << prefaulted_
+            << " numa_node:" << numa_node_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // NUMA node of the core the calling thread is currently running on, -1 if unknown
+    inline auto getCurrentNumaNode() noexcept -> int {
+        unsigned cpu = 0, node = 0;
+        return (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? static_cast<int>(node) : -1);
+    }
+
+    // NUMA node the given core belongs to, found through the nodeN link sysfs keeps in every cpu directory
+    inline auto getNumaNodeOfCore(int core_id) noexcept -> int {
+        for (int node = 0; node < 1024; ++node) {
+            const auto path = "/sys/devices/system/cpu/cpu" + to_string(core_id) + "/node" + to_string(node);
+            if (access(path.c_str(), F_OK) == 0) {
+                return node;
+            }
+        }
+        return -1;
+    }
+
+    // NUMA node the storage is to be bound to, -1 for none
+    inline auto getNumaNode(const StorageCfg &cfg) noexcept -> int {
+        if (cfg.core_id_ >= 0) {
+            return getNumaNodeOfCore(cfg.core_id_);
+        }
+        return (cfg.numa_node_ == NUMA_NODE_LOCAL ? getCurrentNumaNode() : cfg.numa_node_);
+    }
+
+    // mapped storage is always sized in whole huge pages so allocate and free agree on the length whatever mode we got
+    inline auto mappedLength(size_t bytes) noexcept {
+        return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    // binds a fresh mapping to numa_node (if >= 0), then pre-faults and locks it as cfg asks
+    inline auto placeStorage(void *ptr, size_t length, int numa_node, const StorageCfg &cfg, StorageInfo *info) noexcept {
+        info->numa_node_ = -1;
+        if (numa_node >= 0) {
+            unsigned long node_mask = 1UL << numa_node;
+            if (syscall(SYS_mbind, ptr, length, MPOL_BIND, &node_mask, sizeof(node_mask) * 8, MPOL_MF_MOVE) == 0) {
+                info->numa_node_ = numa_node;
+            }
+        }
+
+        if (cfg.prefault_ && !info->prefaulted_) {
+            // touch one byte per page so the faults (and transparent huge page collapses) happen now
+            const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            for (size_t i = 0; i < length; i += page_size) {
+                static_cast<volatile char *>(ptr)[i] = 0;
+            }
+            info->prefaulted_ = true;
+        }
+
+        info->locked_ = (cfg.lock_ && mlock(ptr, length) == 0);
+    }
+
+    inline auto allocateStorage(size_t bytes, size_t alignment, const StorageCfg &cfg, StorageInfo *info) -> void * {
+        info->bytes_ = bytes;
+        if (cfg.isHeap()) {
+            info->mode_ = StorageMode::HEAP;
+            return ::operator new(bytes, align_val_t(alignment));
+        }
+
+        const auto length = mappedLength(bytes);
+        // with a NUMA node to bind to, the pages have to be faulted in after mbind() and not by MAP_POPULATE
+        const auto numa_node = getNumaNode(cfg);
+        const int populate = (cfg.prefault_ && numa_node < 0 ? MAP_POPULATE : 0);
+
+        void *ptr = MAP_FAILED;
+        if (cfg.use_huge_pages_) {
+            ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+            info->mode_ = StorageMode::HUGE_PAGES;
+            info->prefaulted_ = (populate != 0);
+        }
+        if (ptr == MAP_FAILED) { // no huge pages reserved, or not asked for.
+            // regular pages, madvise()'d into transparent huge pages when any kind of huge page was asked for,
+            // which has to happen before they are faulted in
+            const auto want_thp = (cfg.use_huge_pages_ || cfg.use_transparent_huge_pages_);
+            ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | (want_thp ? 0 : populate), -1, 0);
+            if (ptr == MAP_FAILED) {
+                throw bad_alloc();
+            }
+            info->mode_ = (want_thp && madvise(ptr, length, MADV_HUGEPAGE) == 0 ? StorageMode::TRANSPARENT_HUGE_PAGES : StorageMode::PAGES);
+            info->prefaulted_ = (!want_thp && populate != 0);
+        }
+
+        placeStorage(ptr, length, numa_node, cfg, info);
+        return ptr;
+    }
+
+    inline auto freeStorage(void *ptr, size_t bytes, size_t alignment, const StorageCfg &cfg) noexcept {
+        if (cfg.isHeap()) {
+            ::operator delete(ptr, align_val_t(alignment));
+            return;
+        }
+        munmap(ptr, mappedLength(bytes));
+    }
+
+    // std allocator handing out storage according to a StorageCfg, so vectors inside our structures can be placed on huge
+    // pages without changing how they are used
+    // copies share the StorageInfo of the last allocation, which is what the owning structure reports
+    template<typename T>
+    class StorageAllocator {
+        public:
+        using value_type = T;
+
+        StorageAllocator() : info_(make_shared<StorageInfo>()) {}
+
+        explicit StorageAllocator(const StorageCfg &cfg) : cfg_(cfg), info_(make_shared<StorageInfo>()) {}
+
+        template<typename U>
+        StorageAllocator(const StorageAllocator<U> &other) noexcept : cfg_(other.cfg()), info_(other.infoPtr()) {}
+
+        auto allocate(size_t n) -> T * {
+            return static_cast<T *>(allocateStorage(n * sizeof(T), alignof(T), cfg_, info_.get()));
+        }
+
+        auto deallocate(T *ptr, size_t n) noexcept -> void {
+            freeStorage(ptr, n * sizeof(T), alignof(T), cfg_);
+        }
+
+        auto cfg() const noexcept -> const StorageCfg & {
+            return cfg_;
+        }
+
+        auto info() const noexcept -> const StorageInfo & {
+            return *info_;
+        }
+
+        auto infoPtr() const noexcept -> const shared_ptr<StorageInfo> & {
+            return info_;
+        }
+
+        template<typename U>
+        auto operator==(const StorageAllocator<U> &other) const noexcept {
+            return info_ == other.infoPtr();
+        }
+
+        private:
+        StorageCfg cfg_;
+        shared_ptr<StorageInfo> info_;
+    };
+}
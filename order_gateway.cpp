@@ -0,0 +1,189 @@
+#include "order_gateway.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace Exchange {
+    // requests one poll round is expected to read at most, a burst beyond it grows the list once
+    constexpr size_t OG_PENDING_REQUESTS = 64 * 1024;
+    // engine responses taken off the queue per batch, the read index is published once per batch
+    constexpr size_t OG_RESPONSE_BATCH_SIZE = 64;
+
+    OrderGateway::OrderGateway(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses,
+                               Common::Logger &logger, const OrderGatewayCfg &cfg) :
+        cfg_(cfg), client_requests_(client_requests), client_responses_(client_responses),
+        server_(logger, cfg.max_connections_, cfg.server_cfg_), sessions_(cfg.max_clients_), bindings_(cfg.max_connections_),
+        logger_(logger) {
+        pending_.reserve(OG_PENDING_REQUESTS);
+    }
+
+    OrderGateway::~OrderGateway() {
+        stop();
+    }
+
+    auto OrderGateway::listen() -> void {
+        server_.listen(cfg_.iface_, cfg_.port_);
+        logger_.log("%:% %() % listening %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                    cfg_.toString());
+    }
+
+    auto OrderGateway::start(const Common::ThreadCfg &thread_cfg) -> void {
+        listen();
+        running_ = true;
+        thread_ = Common::createAndStartThread(thread_cfg, [this]() { run(); });
+        ASSERT(thread_.joinable(), "Failed to start order gateway thread. " + thread_cfg.toString());
+    }
+
+    auto OrderGateway::stop() -> void {
+        running_ = false;
+        if(thread_.joinable()) {
+            thread_.join();
+            logger_.log("%:% %() % stopped %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                        stats_.toString());
+        }
+    }
+
+    auto OrderGateway::run() noexcept -> void {
+        while(running_.load(memory_order_relaxed)) {
+            poll();
+        }
+    }
+
+    auto OrderGateway::poll() noexcept -> void {
+        server_.poll();
+        sendResponses();
+        server_.sendAndRecv(handler_);
+    }
+
+    auto OrderGateway::onRecv(Common::TCPSocket *socket, Common::Nanos rx_time) noexcept -> void {
+        // without a kernel timestamp the time we got to the data is the best there is
+        if(UNLIKELY(!rx_time)) {
+            rx_time = Common::getTSCNanos();
+        }
+        const auto valid = OrderGatewayProtocol::decode(socket, Common::FrameHandlers{
+            [this, socket, rx_time](const OMClientRequest &request) {
+                if(LIKELY(validate(socket, request))) {
+                    pending_.push_back({rx_time, next_arrival_++, request.request_});
+                } else {
+                    ++stats_.requests_dropped_;
+                }
+            },
+            [this](const OMClientResponse &) {
+                ++stats_.requests_dropped_;
+            }
+        });
+        if(UNLIKELY(!valid)) {
+            logger_.log("%:% %() % closing connection:% sending a malformed stream %\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), socket->connection_id_, socket->frames_.toString());
+            ++stats_.malformed_streams_;
+            server_.markDisconnected(socket);
+        }
+    }
+
+    auto OrderGateway::validate(Common::TCPSocket *socket, const OMClientRequest &request) noexcept -> bool {
+        const auto client_id = request.request_.client_id_;
+        if(UNLIKELY(client_id >= sessions_.size())) {
+            logger_.log("%:% %() % unknown client on connection:% %\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), socket->connection_id_, request.request_.toString());
+            return false;
+        }
+
+        auto &binding = bindings_[static_cast<uint32_t>(socket->connection_id_)];
+        auto &session = sessions_[client_id];
+        if(UNLIKELY(binding.connection_id_ != socket->connection_id_)) {
+            // the connection's first request, it opens the client's session unless the client is connected elsewhere
+            if(UNLIKELY(server_.connection(session.connection_id_))) {
+                logger_.log("%:% %() % client:% already connected, connection:% refused\n", __FILE__, __LINE__, __FUNCTION__,
+                            Common::getCurrentTimeStr(&time_str_), client_id, socket->connection_id_);
+                return false;
+            }
+            binding = {socket->connection_id_, client_id};
+            session = {socket->connection_id_, 1};
+        }
+
+        if(UNLIKELY(binding.client_id_ != client_id)) {
+            logger_.log("%:% %() % connection:% of client:% sent a request for another client %\n", __FILE__, __LINE__,
+                        __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket->connection_id_, binding.client_id_,
+                        request.request_.toString());
+            return false;
+        }
+        if(UNLIKELY(request.header_.seq_num_ != session.next_recv_seq_num_)) {
+            logger_.log("%:% %() % client:% expected seq:% received:% %\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), client_id, session.next_recv_seq_num_, request.header_.seq_num_,
+                        request.request_.toString());
+            return false;
+        }
+        ++session.next_recv_seq_num_;
+
+        // in sequence but not something the engine can act on, it would otherwise reach the engine's request switch
+        const auto &me_request = request.request_;
+        const auto known_type = (me_request.type_ == ClientRequestType::NEW || me_request.type_ == ClientRequestType::CANCEL);
+        const auto valid_side = (me_request.side_ == Side::BUY || me_request.side_ == Side::SELL);
+        if(UNLIKELY(!known_type || (me_request.type_ == ClientRequestType::NEW && !valid_side))) {
+            logger_.log("%:% %() % client:% invalid request %\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), client_id, me_request.toString());
+            return false;
+        }
+        return true;
+    }
+
+    auto OrderGateway::onRecvFinished() noexcept -> void {
+        if(pending_.empty()) {
+            return;
+        }
+        sort(pending_.begin(), pending_.end(), [](const PendingRequest &lhs, const PendingRequest &rhs) {
+            return (lhs.rx_time_ != rhs.rx_time_ ? lhs.rx_time_ < rhs.rx_time_ : lhs.arrival_ < rhs.arrival_);
+        });
+
+        // the engine drains its queue on its own thread, a full queue only means waiting for it to catch up
+        LATENCY_PROBE_START(handoff);
+        for(size_t forwarded = 0; forwarded < pending_.size();) {
+            auto slots = client_requests_->getNextToWriteTo(pending_.size() - forwarded);
+            for(size_t i = 0; i < slots.size(); ++i) {
+                slots[i] = pending_[forwarded + i].request_;
+            }
+            client_requests_->updateWriteIndex(slots.size());
+            forwarded += slots.size();
+        }
+        LATENCY_PROBE_END(handoff, "OrderGateway::forwardRequests");
+
+        const auto now = Common::getTSCNanos();
+        for(const auto &pending : pending_) {
+            stats_.rx_to_forward_.record(now - pending.rx_time_);
+        }
+        stats_.requests_forwarded_ += pending_.size();
+        pending_.clear();
+    }
+
+    auto OrderGateway::sendResponses() noexcept -> void {
+        for(auto batch = client_responses_->getNextToRead(OG_RESPONSE_BATCH_SIZE); !batch.empty();
+            batch = client_responses_->getNextToRead(OG_RESPONSE_BATCH_SIZE)) {
+            for(const auto &response : batch) {
+                auto socket = (LIKELY(response.client_id_ < sessions_.size()) ?
+                               server_.connection(sessions_[response.client_id_].connection_id_) : nullptr);
+                if(UNLIKELY(!socket)) {
+                    ++stats_.responses_dropped_;
+                    continue;
+                }
+                auto msg = OrderGatewayProtocol::getNextToWriteTo<OMClientResponse>(socket);
+                if(UNLIKELY(!msg)) {
+                    // the client is not reading: holding the response back would hold up every other client's behind it
+                    // and skipping it would leave the client a gap it cannot see, so the connection goes, and the rest of
+                    // its responses are dropped until the client reconnects
+                    logger_.log("%:% %() % client:% connection:% outbound ring full, disconnecting\n", __FILE__, __LINE__,
+                                __FUNCTION__, Common::getCurrentTimeStr(&time_str_), response.client_id_,
+                                socket->connection_id_);
+                    server_.markDisconnected(socket);
+                    ++stats_.slow_clients_disconnected_;
+                    ++stats_.responses_dropped_;
+                    continue;
+                }
+                msg->response_ = response;
+                OrderGatewayProtocol::updateWriteIndex<OMClientResponse>(socket);
+                ++stats_.responses_sent_;
+            }
+            client_responses_->updateReadIndex(batch.size());
+        }
+    }
+}
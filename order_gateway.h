@@ -0,0 +1,196 @@
+#pragma once
+
+#include <vector>
+
+#include "tcp_server.h"
+#include "tcp_framing.h"
+#include "thread_utils.h"
+#include "exchange_types.h"
+
+using namespace std;
+
+namespace Exchange {
+#pragma pack(push, 1)
+    // what clients send the gateway, one frame per request
+    // header_.seq_num_ is the client's session sequence number, 1 for the first request on a connection
+    struct OMClientRequest {
+        static constexpr uint16_t MSG_TYPE = 1;
+
+        Common::FrameHeader header_;
+        MEClientRequest request_;
+    };
+
+    // what the gateway sends back, sequenced per connection the same way
+    struct OMClientResponse {
+        static constexpr uint16_t MSG_TYPE = 2;
+
+        Common::FrameHeader header_;
+        MEClientResponse response_;
+    };
+#pragma pack(pop)
+
+    typedef Common::FrameCodec<OMClientRequest, OMClientResponse> OrderGatewayProtocol;
+
+    struct OrderGatewayCfg {
+        string iface_;
+        int port_ = 0;
+        // client ids are 0 .. max_clients_ - 1, requests naming any other are dropped
+        size_t max_clients_ = 64 * 1024;
+        size_t max_connections_ = Common::TCP_SERVER_MAX_CONNECTIONS;
+        Common::TCPServerCfg server_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "OrderGatewayCfg[iface:" << iface_
+            << " port:" << port_
+            << " max_clients:" << max_clients_
+            << " max_connections:" << max_connections_
+            << " backend:" << Common::tcpServerBackendToString(server_cfg_.backend_)
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // kept by the gateway thread, read them once it is stopped
+    struct OrderGatewayStats {
+        uint64_t requests_forwarded_ = 0;
+        // out of sequence, for another client than the connection's or one already connected elsewhere, unknown ids, and
+        // requests of an unknown type or new orders without a side
+        uint64_t requests_dropped_ = 0;
+        uint64_t responses_sent_ = 0;
+        // for clients that are not connected, including the ones disconnected for a full outbound ring
+        uint64_t responses_dropped_ = 0;
+        // connections closed since their outbound ring was full, the client stopped reading its responses
+        uint64_t slow_clients_disconnected_ = 0;
+        // connections closed for sending a stream that is not frames
+        uint64_t malformed_streams_ = 0;
+        // kernel receive timestamp to the request being queued to the matching engine
+        Common::LatencyStat rx_to_forward_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "OrderGatewayStats[requests_forwarded:" << requests_forwarded_
+            << " requests_dropped:" << requests_dropped_
+            << " responses_sent:" << responses_sent_
+            << " responses_dropped:" << responses_dropped_
+            << " slow_clients_disconnected:" << slow_clients_disconnected_
+            << " malformed_streams:" << malformed_streams_
+            << " rx_to_forward:" << rx_to_forward_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // the exchange's order entry: accepts client connections on a TCPServer, decodes OMClientRequest frames in place,
+    // checks each client's session sequence numbers and hands the requests to the matching engine, and routes the engine's
+    // responses back to the connection of the client they are for
+    // a connection belongs to the client id its first request names, a client has one connection at a time
+    // requests read in the same poll round are queued to the engine in kernel receive timestamp order, not in the order the
+    // sockets happened to be read in, so no client gains priority from where its socket sits in the ready list
+    class OrderGateway final {
+        public:
+        OrderGateway(ClientRequestLFQueue *client_requests, ClientResponseLFQueue *client_responses, Common::Logger &logger,
+                     const OrderGatewayCfg &cfg);
+
+        ~OrderGateway();
+
+        // listens before returning, then runs poll() on its own thread, set up with the "gateway" role of the cpu layout
+        auto start(const Common::ThreadCfg &thread_cfg =
+                       Common::CpuLayout::instance().threadCfg("gateway", "Exchange/OrderGateway")) -> void;
+
+        auto stop() -> void;
+
+        // listens without starting a thread, poll() is then driven by the caller
+        auto listen() -> void;
+
+        // one round: accepts, writes queued engine responses, reads and forwards requests, flushes
+        // responses go out in the same round they are written in, one send per connection
+        auto poll() noexcept -> void;
+
+        auto stats() const noexcept -> const OrderGatewayStats & {
+            return stats_;
+        }
+
+        auto server() noexcept -> Common::TCPServer & {
+            return server_;
+        }
+
+        OrderGateway() = delete;
+
+        OrderGateway(const OrderGateway &) = delete;
+
+        OrderGateway(const OrderGateway &&) = delete;
+
+        OrderGateway &operator=(const OrderGateway &) = delete;
+
+        OrderGateway &operator=(const OrderGateway &&) = delete;
+
+        private:
+        // where a client's responses go and the sequence number its next request has to carry
+        struct ClientSession {
+            uint64_t connection_id_ = 0;
+            uint64_t next_recv_seq_num_ = 1;
+        };
+
+        // the client a connection slot was bound to, valid while connection_id_ is the connection's id
+        struct ConnectionBinding {
+            uint64_t connection_id_ = 0;
+            ClientId client_id_ = ClientId_INVALID;
+        };
+
+        // a request read this round, waiting for the round to end to be queued in receive order
+        struct PendingRequest {
+            Common::Nanos rx_time_ = 0;
+            // read order, ties between equal timestamps keep it
+            uint64_t arrival_ = 0;
+            MEClientRequest request_;
+        };
+
+        struct Handler {
+            OrderGateway &gateway_;
+
+            auto onRecv(Common::TCPSocket *socket, Common::Nanos rx_time) noexcept {
+                gateway_.onRecv(socket, rx_time);
+            }
+
+            auto onRecvFinished() noexcept {
+                gateway_.onRecvFinished();
+            }
+        } handler_{*this};
+
+        auto onRecv(Common::TCPSocket *socket, Common::Nanos rx_time) noexcept -> void;
+
+        auto onRecvFinished() noexcept -> void;
+
+        // checks the request against the connection's session and that the engine can act on it, true if it is to be forwarded
+        // a request dropped for its contents still uses up its sequence number
+        auto validate(Common::TCPSocket *socket, const OMClientRequest &request) noexcept -> bool;
+
+        auto sendResponses() noexcept -> void;
+
+        auto run() noexcept -> void;
+
+        const OrderGatewayCfg cfg_;
+        ClientRequestLFQueue *client_requests_ = nullptr;
+        ClientResponseLFQueue *client_responses_ = nullptr;
+
+        Common::TCPServer server_;
+
+        // indexed by client id and by connection slot, so both directions are a single lookup
+        vector<ClientSession> sessions_;
+        vector<ConnectionBinding> bindings_;
+
+        vector<PendingRequest> pending_;
+        uint64_t next_arrival_ = 0;
+
+        OrderGatewayStats stats_;
+
+        jthread thread_;
+        atomic<bool> running_ = {false};
+
+        string time_str_;
+        Common::Logger &logger_;
+    };
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <bit>
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "macros.h"
+#include "mem_utils.h"
+
+using namespace std;
+
+// byte ring for socket I/O, single threaded
+// the same memory is mapped twice back to back (a "magic" ring), so the readable bytes and the free space are each one
+// contiguous span even when they wrap: recv() and send() work straight on the ring and callers parse frames in place,
+// with no copying to unwrap and no compaction
+// capacity is rounded up to a power of two of at least one page (one huge page with use_huge_pages_), pages are only
+// faulted in when touched unless the StorageCfg asks for pre-faulting
+
+namespace Common {
+    class MirroredRingBuffer final {
+        public:
+        explicit MirroredRingBuffer(size_t min_capacity, const StorageCfg &storage_cfg = {}) {
+            const auto numa_node = getNumaNode(storage_cfg);
+            if(storage_cfg.use_huge_pages_) {
+                capacity_ = bit_ceil(max(min_capacity, HUGE_PAGE_SIZE));
+                data_ = map(MFD_HUGETLB);
+                info_.mode_ = StorageMode::HUGE_PAGES;
+            }
+            if(!data_) { // no huge pages reserved, or not asked for.
+                capacity_ = bit_ceil(max(min_capacity, static_cast<size_t>(sysconf(_SC_PAGESIZE))));
+                data_ = map(0);
+                ASSERT(data_, "MirroredRingBuffer could not map " + to_string(capacity_) + " bytes error:" + string(strerror(errno)));
+                const auto want_thp = (storage_cfg.use_huge_pages_ || storage_cfg.use_transparent_huge_pages_);
+                info_.mode_ = (want_thp && madvise(data_, capacity_, MADV_HUGEPAGE) == 0 ? StorageMode::TRANSPARENT_HUGE_PAGES : StorageMode::PAGES);
+            }
+            mask_ = capacity_ - 1;
+            info_.bytes_ = capacity_;
+            // both views share the pages, so placing the first places the second
+            placeStorage(data_, capacity_, numa_node, storage_cfg, &info_);
+        }
+
+        ~MirroredRingBuffer() {
+            munmap(data_, 2 * capacity_);
+        }
+
+        // the readable bytes, oldest first
+        auto readPtr() const noexcept -> const char * {
+            return data_ + (head_ & mask_);
+        }
+
+        auto readable() const noexcept {
+            return tail_ - head_;
+        }
+
+        auto consume(size_t n) noexcept {
+            if(UNLIKELY(n > readable())) {
+                FATAL("MirroredRingBuffer consume past readable bytes.");
+            }
+            head_ += n;
+        }
+
+        // the free space, filled through writePtr() and published with commit()
+        auto writePtr() noexcept -> char * {
+            return data_ + (tail_ & mask_);
+        }
+
+        auto writable() const noexcept {
+            return capacity_ - readable();
+        }
+
+        auto commit(size_t n) noexcept {
+            if(UNLIKELY(n > writable())) {
+                FATAL("MirroredRingBuffer commit past writable bytes.");
+            }
+            tail_ += n;
+        }
+
+        // copies all of data in, or nothing if it does not fit
+        auto write(const void *data, size_t len) noexcept {
+            if(UNLIKELY(len > writable())) {
+                return false;
+            }
+            memcpy(writePtr(), data, len);
+            tail_ += len;
+            return true;
+        }
+
+        auto empty() const noexcept {
+            return head_ == tail_;
+        }
+
+        auto full() const noexcept {
+            return readable() == capacity_;
+        }
+
+        auto capacity() const noexcept {
+            return capacity_;
+        }
+
+        auto storageInfo() const noexcept -> const StorageInfo & {
+            return info_;
+        }
+
+        MirroredRingBuffer() = delete;
+
+        MirroredRingBuffer(const MirroredRingBuffer &) = delete;
+
+        MirroredRingBuffer(const MirroredRingBuffer &&) = delete;
+
+        MirroredRingBuffer &operator=(const MirroredRingBuffer &) = delete;
+
+        MirroredRingBuffer &operator=(const MirroredRingBuffer &&) = delete;
+
+        private:
+        // reserves 2 * capacity_ of address space and maps one memfd of capacity_ bytes into both halves, nullptr on failure
+        auto map(unsigned int memfd_flags) noexcept -> char * {
+            const auto fd = memfd_create("ring_buffer", MFD_CLOEXEC | memfd_flags);
+            if(fd < 0) {
+                return nullptr;
+            }
+            char *base = nullptr;
+            if(ftruncate(fd, static_cast<off_t>(capacity_)) == 0) {
+                // huge page mappings have to start on a huge page boundary, reserve enough to align and trim the slack
+                const size_t alignment = ((memfd_flags & MFD_HUGETLB) ? HUGE_PAGE_SIZE : 0);
+                auto reserved = mmap(nullptr, 2 * capacity_ + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if(reserved != MAP_FAILED) {
+                    base = static_cast<char *>(reserved);
+                    if(alignment) {
+                        const auto aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(base) + alignment - 1) & ~(alignment - 1));
+                        if(aligned != base) {
+                            munmap(base, aligned - base);
+                        }
+                        munmap(aligned + 2 * capacity_, base + alignment - aligned);
+                        base = aligned;
+                    }
+                    if(mmap(base, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+                       mmap(base + capacity_, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                        munmap(base, 2 * capacity_);
+                        base = nullptr;
+                    }
+                }
+            }
+            close(fd); // the mappings keep the memory alive.
+            return base;
+        }
+
+        char *data_ = nullptr;
+        size_t capacity_ = 0;
+        size_t mask_ = 0;
+
+        // running totals of bytes consumed and committed, their difference is what is buffered
+        size_t head_ = 0;
+        size_t tail_ = 0;
+
+        StorageInfo info_;
+    };
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <memory>
+
+#include "tcp_server.h"
+#include "lf_queue.h"
+#include "thread_utils.h"
+
+using namespace std;
+
+namespace Common {
+    struct ShardedTCPServerCfg {
+        string iface_;
+        int port_ = 0;
+        // one reactor per entry, pinned to that core, -1 leaves a reactor unpinned
+        vector<int> reactor_cores_;
+        size_t max_connections_per_shard_ = TCP_SERVER_MAX_CONNECTIONS;
+        // capacity of each shard's request and response queues
+        size_t queue_size_ = 64 * 1024;
+        // backend and io_uring settings for every shard's TCPServer
+        TCPServerCfg server_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "ShardedTCPServerCfg[iface:" << iface_
+            << " port:" << port_
+            << " reactors:" << reactor_cores_.size()
+            << " max_connections_per_shard:" << max_connections_per_shard_
+            << " queue_size:" << queue_size_
+            << " backend:" << tcpServerBackendToString(server_cfg_.backend_)
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // one TCPServer per core, each with its own SO_REUSEPORT listener on the same port and its own epoll / io_uring instance,
+    // driven by a reactor thread pinned to that core
+    // the kernel spreads incoming connections over the listeners and a connection is read, parsed and written on the core
+    // that accepted it for its whole life, reactors share nothing with each other
+    // reactors hand parsed requests to a single business logic thread through an SPSC queue per shard, and the business
+    // logic thread hands responses back through another, Response carries the connection_id_ of the request it answers
+    template<typename Request, typename Response>
+    class ShardedTCPServer final {
+        public:
+        // parses what arrived on a socket into requests, on the reactor thread, see TCPRecvHandler
+        // when the queue is full it stops and leaves the rest in inbound_data_, it is called again on the next read
+        using ParseCallback = function<void(TCPSocket *socket, Nanos rx_time, SPSCLFQueue<Request> &requests)>;
+        // writes a response to the connection it is for, on the reactor thread, responses to closed connections are dropped
+        using WriteCallback = function<void(TCPSocket *socket, const Response &response)>;
+
+        ShardedTCPServer(Logger &logger, const ShardedTCPServerCfg &cfg, ParseCallback parse_callback, WriteCallback write_callback):
+            cfg_(cfg), parse_callback_(std::move(parse_callback)), write_callback_(std::move(write_callback)), logger_(logger) {
+            ASSERT(!cfg_.reactor_cores_.empty(), "ShardedTCPServer needs at least one reactor. " + cfg_.toString());
+            for(size_t i = 0; i < cfg_.reactor_cores_.size(); ++i) {
+                shards_.push_back(make_unique<Shard>(*this, i));
+            }
+        }
+
+        ~ShardedTCPServer() {
+            stop();
+        }
+
+        // every shard listens before any reactor starts, so no connection reaches a port that is only partly served
+        auto start() -> void {
+            for(auto &shard : shards_) {
+                shard->server_.listen(cfg_.iface_, cfg_.port_, true);
+            }
+            logger_.log("%:% %() % listening %\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), cfg_.toString());
+
+            running_ = true;
+            for(auto &shard : shards_) {
+                auto &shard_ref = *shard;
+                shard->thread_ = createAndStartThread(cfg_.reactor_cores_[shard->index_], "Reactor" + to_string(shard->index_),
+                                                      [this, &shard_ref]() { runReactor(shard_ref); });
+                ASSERT(shard->thread_.joinable(), "Failed to start reactor " + to_string(shard->index_) + ". " + cfg_.toString());
+            }
+        }
+
+        auto stop() -> void {
+            running_ = false;
+            for(auto &shard : shards_) {
+                if(shard->thread_.joinable()) {
+                    shard->thread_.join();
+                }
+            }
+        }
+
+        // business logic thread, hands every queued request to handler(shard, request), which returns false to leave it
+        // queued, e.g. when that shard's response queue is full, returns the number of requests handled
+        template<typename Handler>
+        auto poll(Handler &&handler) noexcept -> size_t {
+            size_t handled = 0;
+            for(auto &shard : shards_) {
+                while(auto request = shard->requests_.getNextToRead()) {
+                    if(!handler(shard->index_, *request)) {
+                        break;
+                    }
+                    shard->requests_.updateReadIndex();
+                    ++handled;
+                }
+            }
+            return handled;
+        }
+
+        // business logic thread, queues a response for the reactor the request came from, false when its queue is full
+        auto respond(size_t shard, const Response &response) noexcept -> bool {
+            auto &responses = shards_[shard]->responses_;
+            auto next = responses.getNextToWriteTo();
+            if(UNLIKELY(!next)) {
+                return false;
+            }
+            *next = response;
+            responses.updateWriteIndex();
+            return true;
+        }
+
+        auto numShards() const noexcept {
+            return shards_.size();
+        }
+
+        // only safe to look into from its reactor thread, or once stopped
+        auto shard(size_t index) noexcept -> TCPServer & {
+            return shards_[index]->server_;
+        }
+
+        ShardedTCPServer() = delete;
+
+        ShardedTCPServer(const ShardedTCPServer &) = delete;
+
+        ShardedTCPServer(const ShardedTCPServer &&) = delete;
+
+        ShardedTCPServer &operator=(const ShardedTCPServer &) = delete;
+
+        ShardedTCPServer &operator=(const ShardedTCPServer &&) = delete;
+
+        private:
+        struct Shard {
+            Shard(ShardedTCPServer &owner, size_t index):
+                index_(index), server_(owner.logger_, owner.cfg_.max_connections_per_shard_, owner.cfg_.server_cfg_),
+                requests_(owner.cfg_.queue_size_), responses_(owner.cfg_.queue_size_), handler_{owner, *this} {
+            }
+
+            const size_t index_;
+            TCPServer server_;
+            // reactor -> business logic, business logic -> reactor
+            SPSCLFQueue<Request> requests_;
+            SPSCLFQueue<Response> responses_;
+            // the reactor reads through the template TCPServer::sendAndRecv(), straight into parse_callback_
+            struct Handler {
+                ShardedTCPServer &owner_;
+                Shard &shard_;
+
+                auto onRecv(TCPSocket *socket, Nanos rx_time) {
+                    owner_.parse_callback_(socket, rx_time, shard_.requests_);
+                }
+
+                auto onRecvFinished() {
+                }
+            } handler_;
+            jthread thread_;
+        };
+
+        // writes queued responses between accepting / reading and flushing, so a response goes out in the same pass
+        auto runReactor(Shard &shard) noexcept -> void {
+            auto &server = shard.server_;
+            while(running_.load(memory_order_relaxed)) {
+                server.poll();
+                while(auto response = shard.responses_.getNextToRead()) {
+                    if(auto socket = server.connection(response->connection_id_)) {
+                        write_callback_(socket, *response);
+                    }
+                    shard.responses_.updateReadIndex();
+                }
+                server.sendAndRecv(shard.handler_);
+            }
+        }
+
+        const ShardedTCPServerCfg cfg_;
+        ParseCallback parse_callback_;
+        WriteCallback write_callback_;
+
+        vector<unique_ptr<Shard>> shards_;
+        atomic<bool> running_ = {false};
+
+        string time_str_;
+        Logger &logger_;
+    };
+}
@@ -0,0 +1,128 @@
+#include "snapshot_synthesizer.h"
+
+using namespace std;
+
+namespace Exchange {
+    // incremental updates applied per batch, the read index is published once per batch
+    constexpr size_t SS_UPDATE_BATCH_SIZE = 64;
+
+    SnapshotSynthesizer::SnapshotSynthesizer(MDPMarketUpdateLFQueue *market_updates, Common::Logger &logger,
+                                             const SnapshotSynthesizerCfg &cfg) :
+        cfg_(cfg), market_updates_(market_updates), ticker_orders_(cfg.num_tickers_), snapshot_socket_(logger, cfg.mcast_cfg_),
+        logger_(logger) {
+        ASSERT(snapshot_socket_.init(cfg_.ip_, cfg_.iface_, cfg_.port_, false) >= 0,
+               "Unable to create snapshot multicast socket. error:" + string(strerror(errno)) + " " + cfg_.toString());
+    }
+
+    SnapshotSynthesizer::~SnapshotSynthesizer() {
+        stop();
+    }
+
+    auto SnapshotSynthesizer::start(const Common::ThreadCfg &thread_cfg) -> void {
+        logger_.log("%:% %() % starting %\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_),
+                    cfg_.toString());
+        running_ = true;
+        thread_ = Common::createAndStartThread(thread_cfg, [this]() { run(); });
+        ASSERT(thread_.joinable(), "Failed to start snapshot synthesizer thread. " + thread_cfg.toString());
+    }
+
+    auto SnapshotSynthesizer::stop() -> void {
+        running_ = false;
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    auto SnapshotSynthesizer::run() noexcept -> void {
+        while(running_.load(memory_order_relaxed)) {
+            poll();
+        }
+    }
+
+    auto SnapshotSynthesizer::poll() noexcept -> void {
+        for(auto batch = market_updates_->getNextToRead(SS_UPDATE_BATCH_SIZE); !batch.empty();
+            batch = market_updates_->getNextToRead(SS_UPDATE_BATCH_SIZE)) {
+            for(const auto &update : batch) {
+                apply(update);
+            }
+            market_updates_->updateReadIndex(batch.size());
+        }
+
+        const auto now = Common::getCurrentNanos();
+        if(now - last_snapshot_time_ >= cfg_.interval_) {
+            last_snapshot_time_ = now;
+            publishSnapshot();
+        }
+    }
+
+    auto SnapshotSynthesizer::apply(const MDPMarketUpdate &update) noexcept -> void {
+        // the publisher hands over every increment it sends, in order, a gap is a bug on this host
+        ASSERT(update.seq_num_ == last_inc_seq_num_ + 1, "Expected incremental seq:" + to_string(last_inc_seq_num_ + 1) +
+                                                         " received " + update.toString());
+        last_inc_seq_num_ = update.seq_num_;
+
+        const auto &me_update = update.me_market_update_;
+        if(UNLIKELY(me_update.ticker_id_ >= ticker_orders_.size())) {
+            return;
+        }
+        auto &orders = ticker_orders_[me_update.ticker_id_];
+        switch(me_update.type_) {
+            case MarketUpdateType::ADD:
+                orders[me_update.order_id_] = me_update;
+                break;
+            case MarketUpdateType::MODIFY: {
+                const auto order = orders.find(me_update.order_id_);
+                if(LIKELY(order != orders.end())) {
+                    order->second.qty_ = me_update.qty_;
+                    order->second.priority_ = me_update.priority_;
+                }
+            }
+                break;
+            case MarketUpdateType::CANCEL:
+                orders.erase(me_update.order_id_);
+                break;
+            case MarketUpdateType::CLEAR:
+                orders.clear();
+                break;
+            case MarketUpdateType::TRADE:
+            case MarketUpdateType::SNAPSHOT_START:
+            case MarketUpdateType::SNAPSHOT_END:
+            case MarketUpdateType::INVALID:
+                break;
+        }
+    }
+
+    auto SnapshotSynthesizer::send(const MDPMarketUpdate &update) noexcept -> void {
+        while(UNLIKELY(!snapshot_socket_.send(&update, sizeof(update)))) {
+            snapshot_socket_.sendPending();
+        }
+    }
+
+    auto SnapshotSynthesizer::publishSnapshot() noexcept -> void {
+        uint64_t seq_num = 0;
+        MEMarketUpdate marker;
+        marker.type_ = MarketUpdateType::SNAPSHOT_START;
+        marker.order_id_ = last_inc_seq_num_;
+        send({seq_num++, marker});
+
+        for(TickerId ticker_id = 0; ticker_id < ticker_orders_.size(); ++ticker_id) {
+            MEMarketUpdate clear;
+            clear.type_ = MarketUpdateType::CLEAR;
+            clear.ticker_id_ = ticker_id;
+            send({seq_num++, clear});
+
+            for(const auto &[order_id, order] : ticker_orders_[ticker_id]) {
+                send({seq_num++, order});
+            }
+        }
+
+        marker.type_ = MarketUpdateType::SNAPSHOT_END;
+        send({seq_num++, marker});
+        while(!snapshot_socket_.sendPending()) {
+        }
+
+        ++snapshots_published_;
+        logger_.log("%:% %() % published snapshot:% messages:% last_inc_seq:% orders:%\n", __FILE__, __LINE__, __FUNCTION__,
+                    Common::getCurrentTimeStr(&time_str_), snapshots_published_, seq_num, last_inc_seq_num_, numOrders());
+    }
+}
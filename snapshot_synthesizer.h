@@ -0,0 +1,107 @@
+#pragma once
+
+#include <map>
+
+#include "mcast_socket.h"
+#include "thread_utils.h"
+#include "exchange_types.h"
+
+using namespace std;
+
+namespace Exchange {
+    struct SnapshotSynthesizerCfg {
+        string iface_ = "lo";
+        string ip_ = "239.255.14.3";
+        int port_ = 20001;
+        // how often the whole book goes out
+        Common::Nanos interval_ = 1000 * 1000 * 1000;
+        // tickers 0 .. num_tickers_ - 1, each gets its CLEAR in every snapshot even when empty
+        size_t num_tickers_ = 8;
+        Common::McastCfg mcast_cfg_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "SnapshotSynthesizerCfg[iface:" << iface_
+            << " group:" << ip_ << ":" << port_
+            << " interval:" << interval_
+            << " num_tickers:" << num_tickers_
+            << " mcast:" << mcast_cfg_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // keeps a shadow of every order book from the incremental stream the publisher hands it, and periodically publishes
+    // all of it on the snapshot group, so a consumer that joins late or lost packets can rebuild its books and then pick
+    // up the incremental stream right after the snapshot's last sequence number
+    // a snapshot is SNAPSHOT_START, per ticker a CLEAR and an ADD for every resting order, then SNAPSHOT_END
+    // it runs on a thread of its own, off the publisher's path, so a snapshot of a big book never delays an increment
+    class SnapshotSynthesizer final {
+        public:
+        SnapshotSynthesizer(MDPMarketUpdateLFQueue *market_updates, Common::Logger &logger, const SnapshotSynthesizerCfg &cfg);
+
+        ~SnapshotSynthesizer();
+
+        // runs poll() on its own thread, set up with the "md_snapshot" role of the cpu layout by default
+        auto start(const Common::ThreadCfg &thread_cfg =
+                       Common::CpuLayout::instance().threadCfg("md_snapshot", "Exchange/MDSnapshot")) -> void;
+
+        auto stop() -> void;
+
+        // applies the queued incremental updates and publishes a snapshot if one is due
+        auto poll() noexcept -> void;
+
+        // sends the shadow books now
+        auto publishSnapshot() noexcept -> void;
+
+        auto numOrders() const noexcept {
+            size_t num_orders = 0;
+            for(const auto &orders : ticker_orders_) {
+                num_orders += orders.size();
+            }
+            return num_orders;
+        }
+
+        auto snapshotsPublished() const noexcept {
+            return snapshots_published_;
+        }
+
+        SnapshotSynthesizer() = delete;
+
+        SnapshotSynthesizer(const SnapshotSynthesizer &) = delete;
+
+        SnapshotSynthesizer(const SnapshotSynthesizer &&) = delete;
+
+        SnapshotSynthesizer &operator=(const SnapshotSynthesizer &) = delete;
+
+        SnapshotSynthesizer &operator=(const SnapshotSynthesizer &&) = delete;
+
+        private:
+        auto apply(const MDPMarketUpdate &update) noexcept -> void;
+
+        // queues one snapshot message, flushing the socket while its ring is full
+        auto send(const MDPMarketUpdate &update) noexcept -> void;
+
+        auto run() noexcept -> void;
+
+        const SnapshotSynthesizerCfg cfg_;
+        MDPMarketUpdateLFQueue *market_updates_ = nullptr;
+
+        // resting orders per ticker keyed by market order id, which the engine hands out in increasing order, so walking a
+        // map lists the orders of each price level in their priority order
+        // the node allocations are on this thread, which is not on any latency path
+        vector<map<OrderId, MEMarketUpdate>> ticker_orders_;
+        uint64_t last_inc_seq_num_ = 0;
+        Common::Nanos last_snapshot_time_ = 0;
+        size_t snapshots_published_ = 0;
+
+        Common::McastSocket snapshot_socket_;
+
+        jthread thread_;
+        atomic<bool> running_ = {false};
+
+        string time_str_;
+        Common::Logger &logger_;
+    };
+}
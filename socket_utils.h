@@ -14,6 +14,7 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <fcntl.h>
+#include <linux/net_tstamp.h>
 #include <string>
 
 #include "logging.h"
@@ -21,6 +22,10 @@
 
 using namespace std;
 
+#ifndef SOF_TIMESTAMPING_OPT_ID_TCP
+#define SOF_TIMESTAMPING_OPT_ID_TCP (1 << 15)
+#endif
+
 namespace Common {
     struct SocketCfg {
         string ip_;
@@ -29,6 +34,10 @@ namespace Common {
         bool is_udp_ = false;
         bool is_listening_ = false;
         bool needs_so_timestamp_ = false;
+        // TCP only, the kernel reports when the peer acknowledged the data of each send, see setSOTimestamping()
+        bool needs_tx_timestamp_ = false;
+        // listening sockets only, several sockets bind the same port and the kernel spreads connections across them
+        bool reuse_port_ = false;
 
         auto toString() const {
             stringstream ss;
@@ -38,6 +47,8 @@ namespace Common {
             << " is_udp:" << is_udp_
             << " is_listening:" << is_listening_
             << " needs_SO_timestamp:" << needs_so_timestamp_
+            << " needs_tx_timestamp:" << needs_tx_timestamp_
+            << " reuse_port:" << reuse_port_
             << "]";
 
             return ss.str();
@@ -88,13 +99,74 @@ namespace Common {
         return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, reinterpret_cast<void *>(&one), sizeof(one))!=-1);
     }
 
-    inline auto join(int fd, const string& ip) -> bool {
+    // nanosecond software receive timestamps delivered as SCM_TIMESTAMPING, with tx_ack also a timestamp on the error queue
+    // when the peer has acknowledged the last byte of each send, keyed by that byte's offset in the stream (OPT_ID)
+    // OPT_ID_TCP (linux 6.2) counts from the next byte written, which makes the offset of the first byte 0 whatever the
+    // connection state, older kernels count from the oldest unacknowledged byte
+    inline auto setSOTimestamping(int fd, bool tx_ack) -> bool {
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if(tx_ack) {
+            flags |= SOF_TIMESTAMPING_TX_ACK | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+            int with_id_tcp = flags | SOF_TIMESTAMPING_OPT_ID_TCP;
+            if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, reinterpret_cast<void *>(&with_id_tcp), sizeof(with_id_tcp)) == 0) {
+                return true;
+            }
+        }
+        return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, reinterpret_cast<void *>(&flags), sizeof(flags))!=-1);
+    }
+
+    // nanosecond software receive timestamps, delivered as SCM_TIMESTAMPNS
+    inline auto setSOTimestampNS(int fd) -> bool {
+        int one = 1;
+        return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, reinterpret_cast<void *>(&one), sizeof(one))!=-1);
+    }
+
+    inline auto join(int fd, const string& ip, const string &iface_ip = "") -> bool {
         // mreq has two fields
         // the multicast ip you want to join and the interface you want to join it from
-        const ip_mreq mreq{{inet_addr(ip.c_str())}, {htonl(INADDR_ANY)}};
+        const ip_mreq mreq{{inet_addr(ip.c_str())}, {iface_ip.empty() ? htonl(INADDR_ANY) : inet_addr(iface_ip.c_str())}};
         return (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))!=-1);
     }
 
+    inline auto leave(int fd, const string& ip, const string &iface_ip = "") -> bool {
+        const ip_mreq mreq{{inet_addr(ip.c_str())}, {iface_ip.empty() ? htonl(INADDR_ANY) : inet_addr(iface_ip.c_str())}};
+        return (setsockopt(fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq))!=-1);
+    }
+
+    // interface outgoing multicast leaves from, and whether our own packets are looped back to local members
+    inline auto setMcastInterface(int fd, const string &iface_ip) -> bool {
+        const in_addr addr{inet_addr(iface_ip.c_str())};
+        return (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr))!=-1);
+    }
+
+    inline auto setMcastLoop(int fd, bool loop) -> bool {
+        const unsigned char value = loop;
+        return (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &value, sizeof(value))!=-1);
+    }
+
+    inline auto setMcastTTL(int fd, int ttl) -> bool {
+        const unsigned char value = static_cast<unsigned char>(ttl);
+        return (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof(value))!=-1);
+    }
+
+    // kernel receive buffer, SO_RCVBUFFORCE goes past net.core.rmem_max when we are privileged
+    // returns the size the kernel actually uses (twice what was asked for, for its bookkeeping), -1 on failure
+    inline auto setRcvBuf(int fd, int bytes) -> int {
+        if(setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) == -1 &&
+           setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) == -1) {
+            return -1;
+        }
+        int actual = 0;
+        socklen_t len = sizeof(actual);
+        return (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len) == 0 ? actual : -1);
+    }
+
+    // microseconds a read spins polling the device queue before it sleeps or returns, raising it above
+    // net.core.busy_read needs CAP_NET_ADMIN
+    inline auto setBusyPoll(int fd, int usecs) -> bool {
+        return (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs))!=-1);
+    }
+
     [[nodiscard]] inline auto createSocket (Logger& logger, const SocketCfg& socket_cfg) -> int {
         string time_str;
 
@@ -134,6 +206,9 @@ namespace Common {
             if (socket_cfg.is_listening_) { // allow re-using the address in the call to bind()
                 // multiple addresses can bind to same port
                 ASSERT(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&one), sizeof(one)) == 0, "setsockopt() SO_REUSEADDR failed. errno:" + string(strerror(errno)));
+                if (socket_cfg.reuse_port_) {
+                    ASSERT(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char *>(&one), sizeof(one)) == 0, "setsockopt() SO_REUSEPORT failed. errno:" + string(strerror(errno)));
+                }
             }
 
             // for the client the port is assigned to by the OS
@@ -148,8 +223,9 @@ namespace Common {
                 ASSERT(listen(socket_fd, MaxTCPServerBacklog) == 0, "listen() failed. errno:" + string(strerror(errno)));
             }
 
-            if (socket_cfg.needs_so_timestamp_) { // enable software receive timestamps.
-                ASSERT(setSOTimestamp(socket_fd), "setSOTimestamp() failed. errno:" + string(strerror(errno)));
+            if (socket_cfg.needs_so_timestamp_) { // enable software receive timestamps, and ack timestamps if asked for.
+                ASSERT(setSOTimestamping(socket_fd, socket_cfg.needs_tx_timestamp_ && !socket_cfg.is_udp_ && !socket_cfg.is_listening_),
+                       "setSOTimestamping() failed. errno:" + string(strerror(errno)));
             }
         }
         return socket_fd;
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include "tcp_socket.h"
+
+using namespace std;
+
+// length-prefixed binary framing on top of TCPSocket
+// every message is a packed, fixed layout struct that starts with a FrameHeader and names its type in MSG_TYPE, so a
+// complete frame in inbound_data_ can be handed to its handler as a const Msg & pointing straight into the ring, with no
+// copy and no unwrapping since the ring is mirrored, and a message is encoded in place in outbound_data_
+
+namespace Common {
+#pragma pack(push, 1)
+    struct FrameHeader {
+        // the whole frame, header included
+        uint32_t length_ = 0;
+        uint16_t type_ = 0;
+        uint64_t seq_num_ = 0;
+    };
+#pragma pack(pop)
+
+    // packed so it can sit at any offset in the ring, and trivially copyable so viewing it in place is all decoding takes
+    template<typename Msg>
+    concept FrameMessage = is_trivially_copyable_v<Msg> && is_standard_layout_v<Msg> && alignof(Msg) == 1 &&
+                           is_same_v<decltype(Msg::header_), FrameHeader> && requires { { Msg::MSG_TYPE } -> convertible_to<uint16_t>; };
+
+    // builds a decode() handler out of one lambda per message type, FrameHandlers{[](const A &) {...}, [](const B &) {...}}
+    template<typename... Fs>
+    struct FrameHandlers : Fs... {
+        using Fs::operator()...;
+    };
+
+    // the protocol made of Msgs, stateless, per connection sequencing lives in TCPSocket::frames_
+    template<FrameMessage... Msgs>
+    struct FrameCodec final {
+        static_assert(sizeof...(Msgs) > 0, "FrameCodec needs at least one message type.");
+        static_assert(((offsetof(Msgs, header_) == 0) && ...), "FrameHeader should be first member of every message.");
+
+        // dispatches every complete frame in inbound_data_ to handler(const Msg &) and consumes it, a partial frame stays
+        // for the next read
+        // a handler that returns bool can refuse a frame by returning false, e.g. when its queue is full, decoding stops
+        // and the frame is offered again on the next call
+        // frames longer than their message are accepted, the extra bytes are skipped, frames of unknown types are skipped
+        // returns false if the stream is malformed: a length shorter than its message or one the ring can never hold,
+        // the connection cannot be resynchronized and should be closed
+        template<typename Handler>
+        static auto decode(TCPSocket *socket, Handler &&handler) noexcept -> bool {
+            auto &inbound = socket->inbound_data_;
+            // walks a local cursor and counters, the handler's stores could alias them and force a reload per frame,
+            // the ring and socket->frames_ are updated once at the end
+            auto frame = inbound.readPtr();
+            const auto end = frame + inbound.readable();
+            auto frames = socket->frames_;
+            auto valid = true;
+            while(end - frame >= static_cast<ptrdiff_t>(sizeof(FrameHeader))) {
+                const auto &header = *reinterpret_cast<const FrameHeader *>(frame);
+                if(UNLIKELY(header.length_ < sizeof(FrameHeader) || header.length_ > inbound.capacity())) {
+                    valid = false;
+                    break;
+                }
+                if(end - frame < static_cast<ptrdiff_t>(header.length_)) {
+                    break;
+                }
+
+                const auto result = dispatch(header, frame, handler);
+                if(UNLIKELY(result == Dispatch::MALFORMED)) {
+                    valid = false;
+                    break;
+                }
+                if(UNLIKELY(result == Dispatch::REFUSED)) {
+                    break;
+                }
+                frames.unknown_frames_ += (result == Dispatch::UNKNOWN);
+                frames.sequence_gaps_ += (header.seq_num_ != frames.next_recv_seq_num_);
+                frames.next_recv_seq_num_ = header.seq_num_ + 1;
+                ++frames.frames_received_;
+                frame += header.length_;
+            }
+            inbound.consume(static_cast<size_t>(frame - inbound.readPtr()));
+            socket->frames_.next_recv_seq_num_ = frames.next_recv_seq_num_;
+            socket->frames_.frames_received_ = frames.frames_received_;
+            socket->frames_.unknown_frames_ = frames.unknown_frames_;
+            socket->frames_.sequence_gaps_ = frames.sequence_gaps_;
+            return valid;
+        }
+
+        // encoder side, the next Msg in outbound_data_ with its header filled in, nullptr if the ring does not have room
+        // the caller fills in the body and queues it with updateWriteIndex<Msg>()
+        template<typename Msg>
+        static auto getNextToWriteTo(TCPSocket *socket) noexcept -> Msg * {
+            static_assert((is_same_v<Msg, Msgs> || ...), "Msg is not part of this protocol.");
+            auto msg = reinterpret_cast<Msg *>(socket->reserve(sizeof(Msg)));
+            if(LIKELY(msg)) {
+                msg->header_ = {static_cast<uint32_t>(sizeof(Msg)), Msg::MSG_TYPE, socket->frames_.next_send_seq_num_};
+            }
+            return msg;
+        }
+
+        template<typename Msg>
+        static auto updateWriteIndex(TCPSocket *socket) noexcept {
+            ++socket->frames_.next_send_seq_num_;
+            ++socket->frames_.frames_sent_;
+            socket->commit(sizeof(Msg));
+        }
+
+        // copies msg's body into the next frame, its header is ignored, false if the ring does not have room
+        template<typename Msg>
+        static auto send(TCPSocket *socket, const Msg &msg) noexcept -> bool {
+            auto next = getNextToWriteTo<Msg>(socket);
+            if(UNLIKELY(!next)) {
+                return false;
+            }
+            memcpy(reinterpret_cast<char *>(next) + sizeof(FrameHeader), reinterpret_cast<const char *>(&msg) + sizeof(FrameHeader),
+                   sizeof(Msg) - sizeof(FrameHeader));
+            updateWriteIndex<Msg>(socket);
+            return true;
+        }
+
+        private:
+        enum class Dispatch : int8_t { DISPATCHED, REFUSED, UNKNOWN, MALFORMED };
+
+        static constexpr auto uniqueTypes() {
+            const uint16_t types[] = {Msgs::MSG_TYPE...};
+            for(size_t i = 0; i < sizeof...(Msgs); ++i) {
+                for(size_t j = i + 1; j < sizeof...(Msgs); ++j) {
+                    if(types[i] == types[j]) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+        static_assert(uniqueTypes(), "Every message in a protocol needs a MSG_TYPE of its own.");
+
+        // the type compares fold into a chain the compiler turns into a jump table or a few branches
+        template<typename Handler>
+        static auto dispatch(const FrameHeader &header, const char *frame, Handler &handler) noexcept -> Dispatch {
+            auto result = Dispatch::UNKNOWN;
+            ((header.type_ == Msgs::MSG_TYPE ? (result = dispatchAs<Msgs>(header, frame, handler), true) : false) || ...);
+            return result;
+        }
+
+        template<typename Msg, typename Handler>
+        static auto dispatchAs(const FrameHeader &header, const char *frame, Handler &handler) noexcept -> Dispatch {
+            if(UNLIKELY(header.length_ < sizeof(Msg))) {
+                return Dispatch::MALFORMED;
+            }
+            const auto &msg = *reinterpret_cast<const Msg *>(frame);
+            if constexpr (is_same_v<invoke_result_t<Handler &, const Msg &>, bool>) {
+                return (handler(msg) ? Dispatch::DISPATCHED : Dispatch::REFUSED);
+            } else {
+                handler(msg);
+                return Dispatch::DISPATCHED;
+            }
+        }
+    };
+}
@@ -1,8 +1,9 @@
 #include "tcp_server.h"
+#include <thread>
 using namespace std;
 
 namespace Common {
-    auto TCPServer::addToEpollList(TCPSocket *socket) {
+    auto TCPServer::addToEpollList(TCPSocket *socket, uint32_t events) {
         // tells epoll to monitor a given socket for incoming data
         // struct epoll_event {
         //     uint32_t events;     
@@ -10,37 +11,87 @@ namespace Common {
         // };
         // EPOLLET: notify only when new events happen
         // EPOLLIN: data is ready to be read
-        epoll_event ev{EPOLLET | EPOLLIN, {reinterpret_cast<void *>(socket)}};
+        // EPOLLOUT: the kernel send buffer has room again, after a send() returned EAGAIN
+        epoll_event ev{events, {reinterpret_cast<void *>(socket)}};
         return !epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket->socket_fd_, &ev);
     }
 
-    auto TCPServer::listen(const string &iface, int port) -> void {
+    auto TCPServer::listen(const string &iface, int port, bool reuse_port) -> void {
         // server socker set up to listen
+        ASSERT(listener_socket_.connect("", iface, port, true, reuse_port) >= 0,
+            "Listener socket failed to connect. iface:" + iface + " port:" + to_string(port) + " error:" +
+            string(strerror(errno)));
+
+        if(cfg_.backend_ == TCPServerBackend::IO_URING) {
+            if(setupIOURing()) {
+                logger_.log("%:% %() % listening on io_uring sqpoll:%\n", __FILE__, __LINE__, __FUNCTION__,
+                    Common::getCurrentTimeStr(&time_str_), uring_->isSQPoll());
+                return;
+            }
+            logger_.log("%:% %() % io_uring unavailable, falling back to epoll. error:%\n", __FILE__, __LINE__, __FUNCTION__,
+                Common::getCurrentTimeStr(&time_str_), strerror(errno));
+        }
+
         // registers it with epoll monitoring
         epoll_fd_ = epoll_create(1);
         ASSERT(epoll_fd_ >= 0, "epoll_create() failed error:" + string(strerror(errno)));
 
-        ASSERT(listener_socket_.connect("", iface, port, true) >= 0,
-            "Listener socket failed to connect. iface:" + iface + " port:" + to_string(port) + " error:" +
-            string(strerror(errno)));
+        ASSERT(addToEpollList(&listener_socket_, EPOLLET | EPOLLIN), "epoll_ctl() failed. error:" + string(std::strerror(errno)));
+    }
 
-        ASSERT(addToEpollList(&listener_socket_), "epoll_ctl() failed. error:" + string(std::strerror(errno)));
+    TCPServer::~TCPServer() {
+        // tearing the ring down cancels everything the kernel still holds for our sockets
+        uring_.reset();
+        while(!connections_.empty()) {
+            releaseConnection(connections_.back());
+        }
+        if(epoll_fd_ >= 0) {
+            close(epoll_fd_);
+        }
     }
 
     auto TCPServer::sendAndRecv() noexcept -> void{
-        auto recv = false;
+        ServerCallbackHandler handler{*this};
+        sendAndRecv(handler);
+    }
 
-        // calls sendAndRecv on all the available receiving sockets
-        for_each(receive_sockets_.begin(), receive_sockets_.end(), [&recv](auto socket){
-            socket->sendAndRecv();
-        });
+    auto TCPServer::sendEpoll() noexcept -> void {
+        // flushes sockets that were sent to since the last call, recv callbacks above may have added more
+        // a socket the kernel cannot take everything from waits for EPOLLOUT to come back into the list
+        for(auto socket : send_sockets_) {
+            socket->in_send_list_ = false;
+            if(!socket->disconnected_) {
+                socket->sendPending();
+                if(UNLIKELY(socket->disconnected_ && !socket->in_receive_list_)) {
+                    // the next read reports the error and the receive pass closes it.
+                    socket->in_receive_list_ = true;
+                    receive_sockets_.push_back(socket);
+                }
+            }
+        }
+        send_sockets_.clear();
+    }
+
+    auto TCPServer::closeDisconnected() noexcept -> void {
+        // only now, so no ready list holds a socket that went back to the pool
+        for(auto socket : closing_sockets_) {
+            closeConnection(socket);
+        }
+        closing_sockets_.clear();
     }
 
     auto TCPServer::poll() noexcept -> void {
-        const int max_events = 1 + send_sockets_.size() + receive_sockets_.size();
+        LATENCY_PROBE_SCOPE("TCPServer::poll");
+
+        if(uring_) {
+            // submits what sendAndRecv() queued and collects whatever completed, accepts and receives included
+            uring_->submit(true);
+            uring_->reap([this](const io_uring_cqe &cqe) { onCompletion(cqe); });
+            return;
+        }
 
         // ask epoll for ready events and store them in events_
-        const int n  = epoll_wait(epoll_fd_, events_, max_events, 0);
+        const int n  = epoll_wait(epoll_fd_, events_.data(), static_cast<int>(events_.size()), 0);
         bool have_new_connection = false;
         for(int i=0; i<n; ++i){
             const auto &event = events_[i];
@@ -63,7 +114,8 @@ namespace Common {
                 Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
 
                 // if not already in receive_sockets_ add it
-                if(find(receive_sockets_.begin(), receive_sockets_.end(), socket)==receive_sockets_.end()){
+                if(!socket->in_receive_list_){
+                    socket->in_receive_list_ = true;
                     receive_sockets_.push_back(socket);
                 }
             }
@@ -71,24 +123,42 @@ namespace Common {
                 // writeable socket
                 logger_.log("%:% %() % EPOLLOUT socket:%\n", __FILE__, __LINE__, __FUNCTION__,
                     Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
-                // add to send sockets if not already there
-                if (std::find(send_sockets_.begin(), send_sockets_.end(), socket) == send_sockets_.end()){
+                // add to send sockets if not already there and it has something left to send
+                socket->awaiting_writable_ = false;
+                if((!socket->outbound_data_.empty() || socket->isSendBackpressured()) && !socket->in_send_list_){
+                    socket->in_send_list_ = true;
                     send_sockets_.push_back(socket);
                 }
             }
 
+            if ((event.events & EPOLLERR) && !(event.events & EPOLLHUP) && socket->errorQueuePending()) {
+                // EPOLLERR also signals MSG_ZEROCOPY completions and ack timestamps waiting on the error queue, not
+                // necessarily a failure
+                socket->reapErrorQueue();
+                if(!socket->socketError()) {
+                    continue;
+                }
+            }
             if (event.events & (EPOLLERR | EPOLLHUP)) {
                 // in case of error or hangup
                 logger_.log("%:% %() % EPOLLERR socket:%\n", __FILE__, __LINE__, __FUNCTION__,
                 Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
-                // sent to receive sockets for graceful handling of disconnects or errors
-                if (std::find(receive_sockets_.begin(), receive_sockets_.end(), socket) == receive_sockets_.end()){
+                // closed at the end of the next sendAndRecv(), after whatever the peer sent before hanging up has been read
+                socket->disconnected_ = true;
+                if(!socket->in_receive_list_){
+                    socket->in_receive_list_ = true;
                     receive_sockets_.push_back(socket);
                 }
             }
             // we have figured which socketrs need io work
         }
-        while(have_new_connection){
+        if(have_new_connection){
+            acceptConnections();
+        }
+    }
+
+    auto TCPServer::acceptConnections() noexcept -> void {
+        while(true){
             // enter this in case of readable listener
             logger_.log("%:% %() % have_new_connection\n", __FILE__, __LINE__, __FUNCTION__,
             Common::getCurrentTimeStr(&time_str_));
@@ -101,22 +171,293 @@ namespace Common {
             if(fd == -1){
                 break;
             }
-            // make the new fd non-blocking and disable nagle
-            ASSERT(setNonBlocking(fd) && disableNagle(fd), "Failed to set non-blocking and no-delay on socket:"+to_string(fd));
-            logger_.log("%:% %() % accepted socket:%\n", __FILE__, __LINE__, __FUNCTION__,
-            Common::getCurrentTimeStr(&time_str_), fd);
-
-            // create new socket for the fd and fire its callback
-            auto socket = new TCPSocket(logger_);
-            socket->socket_fd_ = fd;
-            socket->recv_callback_ = recv_callback_;
-            // register the client socket with epoll
-            ASSERT(addToEpollList(socket), "Unable to add socket. error:" + string(strerror(errno)));
-
-            // mark it for read handling
-            if (find(receive_sockets_.begin(), receive_sockets_.end(), socket) == receive_sockets_.end()){
-                receive_sockets_.push_back(socket);
+            addConnection(fd);
+        }
+    }
+
+    auto TCPServer::addConnection(int fd) noexcept -> void {
+        if(UNLIKELY(socket_pool_.size() == socket_pool_.capacity())) {
+            logger_.log("%:% %() % rejected socket:% max connections:% reached\n", __FILE__, __LINE__, __FUNCTION__,
+            Common::getCurrentTimeStr(&time_str_), fd, socket_pool_.capacity());
+            close(fd);
+            return;
+        }
+        // make the new fd non-blocking and disable nagle, io_uring does not need it non-blocking
+        ASSERT((uring_ || setNonBlocking(fd)) && disableNagle(fd), "Failed to set non-blocking and no-delay on socket:"+to_string(fd));
+        logger_.log("%:% %() % accepted socket:%\n", __FILE__, __LINE__, __FUNCTION__,
+        Common::getCurrentTimeStr(&time_str_), fd);
+
+        // create new socket for the fd and fire its callback
+        auto socket = socket_pool_.allocate(logger_, socket_storage_cfg_, socket_buffer_size_);
+        socket->socket_fd_ = fd;
+        socket->recv_callback_ = recv_callback_;
+        socket->send_list_ = &send_sockets_;
+        socket->connection_index_ = connections_.size();
+        connections_.push_back(socket);
+        // there is a slot for every pooled socket
+        const auto slot = free_slots_.back();
+        free_slots_.pop_back();
+        slots_[slot] = socket;
+        socket->connection_id_ = (++next_generation_ << 32) | slot;
+
+        if(uring_) {
+            socket->io_uring_.fixed_file_ = static_cast<int>(slot);
+            socket->io_uring_.overflow_ = make_unique<MirroredRingBuffer>(cfg_.recv_overflow_size_);
+            // a multishot receive hands over everything the kernel has buffered at once, keep that well within the overflow
+            ASSERT(setRcvBuf(fd, static_cast<int>(cfg_.recv_overflow_size_ / 4)) > 0,
+                "Unable to set SO_RCVBUF on socket:" + to_string(fd) + " error:" + string(strerror(errno)));
+            ASSERT(uring_->updateFile(socket->io_uring_.fixed_file_, fd), "Unable to register socket:" + to_string(fd) + " error:" + string(strerror(errno)));
+            armRecv(socket);
+            return;
+        }
+
+        if(cfg_.tx_timestamps_) {
+            // set on the connection itself, a listener cannot have them
+            ASSERT(setSOTimestamping(fd, true), "setSOTimestamping() failed. errno:" + string(strerror(errno)));
+            socket->tx_timestamps_ = true;
+        }
+
+        // register the client socket with epoll
+        ASSERT(addToEpollList(socket, EPOLLET | EPOLLIN | EPOLLOUT), "Unable to add socket. error:" + string(strerror(errno)));
+
+        // mark it for read handling, data may have arrived before it was registered
+        socket->in_receive_list_ = true;
+        receive_sockets_.push_back(socket);
+    }
+
+    auto TCPServer::closeConnection(TCPSocket *socket) noexcept -> void {
+        logger_.log("%:% %() % closing socket:%\n", __FILE__, __LINE__, __FUNCTION__,
+        Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
+        if(uring_) {
+            if(socket->io_uring_.ops_in_flight_) {
+                // completes the multishot receive and any send in flight, the last completion releases the socket
+                socket->io_uring_.closing_ = true;
+                shutdown(socket->socket_fd_, SHUT_RDWR);
+                return;
+            }
+        } else {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket->socket_fd_, nullptr);
+        }
+        releaseConnection(socket);
+    }
+
+    auto TCPServer::releaseConnection(TCPSocket *socket) noexcept -> void {
+        if(socket->io_uring_.fixed_file_ >= 0 && uring_) {
+            uring_->updateFile(socket->io_uring_.fixed_file_, -1);
+        }
+        const auto slot = static_cast<uint32_t>(socket->connection_id_);
+        slots_[slot] = nullptr;
+        free_slots_.push_back(slot);
+
+        // swap the last connection into its place
+        auto last = connections_.back();
+        last->connection_index_ = socket->connection_index_;
+        connections_[socket->connection_index_] = last;
+        connections_.pop_back();
+
+        socket_pool_.deallocate(socket); // the destructor closes the fd.
+    }
+
+    auto TCPServer::setupIOURing() noexcept -> bool {
+        uring_ = make_unique<IOURing>(cfg_.uring_entries_, cfg_.sqpoll_, cfg_.sqpoll_cpu_);
+        if(!uring_->isValid() || !uring_->registerFiles(static_cast<unsigned>(socket_pool_.capacity())) ||
+           !uring_->registerBuffers(cfg_.num_recv_buffers_, cfg_.recv_buffer_size_, cfg_.recv_buffers_storage_cfg_)) {
+            uring_.reset();
+            return false;
+        }
+        armAccept();
+        return true;
+    }
+
+    auto TCPServer::getSqe() noexcept -> io_uring_sqe * {
+        auto sqe = uring_->getSqe();
+        // a full ring was just handed to the poll thread, which frees entries as it picks them up
+        while(UNLIKELY(!sqe && uring_->isSQPoll())) {
+            this_thread::yield();
+            sqe = uring_->getSqe();
+        }
+        if(UNLIKELY(!sqe)) {
+            FATAL("io_uring submission ring full, raise TCPServerCfg::uring_entries_.");
+        }
+        return sqe;
+    }
+
+    auto TCPServer::armAccept() noexcept -> void {
+        // one request keeps accepting until the kernel ends it
+        auto sqe = getSqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listener_socket_.socket_fd_;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = reinterpret_cast<uint64_t>(&listener_socket_) | URING_ACCEPT;
+    }
+
+    auto TCPServer::armRecv(TCPSocket *socket) noexcept -> void {
+        // one request delivers every receive into a buffer the kernel picks from the provided ring
+        auto sqe = getSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = socket->io_uring_.fixed_file_;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->buf_group = 0;
+        sqe->user_data = reinterpret_cast<uint64_t>(socket) | URING_RECV;
+        ++socket->io_uring_.ops_in_flight_;
+        socket->io_uring_.recv_armed_ = true;
+    }
+
+    auto TCPServer::pauseRecv(TCPSocket *socket) noexcept -> void {
+        logger_.log("%:% %() % socket:% pausing receives, overflow:% bytes\n", __FILE__, __LINE__, __FUNCTION__,
+            Common::getCurrentTimeStr(&time_str_), socket->socket_fd_, socket->io_uring_.overflow_->readable());
+        socket->io_uring_.recv_paused_ = true;
+        if(socket->io_uring_.recv_armed_) {
+            // completions posted before the kernel gets to the cancel still arrive, the last one without F_MORE
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<uint64_t>(socket) | URING_RECV;
+            sqe->user_data = reinterpret_cast<uint64_t>(socket) | URING_CANCEL;
+            ++socket->io_uring_.ops_in_flight_;
+            // now rather than at the next poll(), the receive keeps taking what arrives until the kernel sees it
+            uring_->submit(false);
+        }
+    }
+
+    auto TCPServer::resumeRecv(TCPSocket *socket) noexcept -> void {
+        socket->io_uring_.recv_paused_ = false;
+        if(!socket->io_uring_.recv_armed_ && !socket->io_uring_.closing_ && !socket->disconnected_) {
+            armRecv(socket);
+        }
+    }
+
+    auto TCPServer::markDisconnected(TCPSocket *socket) noexcept -> void {
+        if(socket->disconnected_) {
+            return;
+        }
+        logger_.log("%:% %() % disconnected socket:%\n", __FILE__, __LINE__, __FUNCTION__,
+            Common::getCurrentTimeStr(&time_str_), socket->socket_fd_);
+        // closed at the end of the next sendAndRecv(), after recv_callback_ has seen what arrived before
+        socket->disconnected_ = true;
+        if(!socket->in_receive_list_) {
+            socket->in_receive_list_ = true;
+            receive_sockets_.push_back(socket);
+        }
+    }
+
+    auto TCPServer::onCompletion(const io_uring_cqe &cqe) noexcept -> void {
+        const auto op = cqe.user_data & URING_OP_MASK;
+        auto socket = reinterpret_cast<TCPSocket *>(cqe.user_data & ~URING_OP_MASK);
+        // a multishot request without F_MORE has ended and has to be armed again
+        const bool more = (cqe.flags & IORING_CQE_F_MORE);
+        auto &state = socket->io_uring_;
+
+        switch(op) {
+            case URING_ACCEPT: {
+                if(cqe.res >= 0) {
+                    addConnection(cqe.res);
+                } else {
+                    logger_.log("%:% %() % accept failed. error:%\n", __FILE__, __LINE__, __FUNCTION__,
+                        Common::getCurrentTimeStr(&time_str_), strerror(-cqe.res));
+                }
+                if(!more) {
+                    armAccept();
+                }
+                return;
+            }
+            case URING_RECV: {
+                if(cqe.flags & IORING_CQE_F_BUFFER) {
+                    const auto buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                    if(cqe.res > 0 && !state.closing_) {
+                        // into the socket's ring so recv_callback_ parses it in place as on epoll, what does not fit waits
+                        // in overflow_ until the callback has consumed enough
+                        auto data = uring_->buffer(buffer_id);
+                        auto len = static_cast<size_t>(cqe.res);
+                        auto &overflow = *state.overflow_;
+                        if(overflow.empty()) {
+                            const auto n = min(len, socket->inbound_data_.writable());
+                            socket->inbound_data_.write(data, n);
+                            data += n;
+                            len -= n;
+                        }
+                        if(UNLIKELY(!overflow.write(data, len))) {
+                            logger_.log("%:% %() % socket:% receive overflow full, % bytes do not fit\n", __FILE__, __LINE__,
+                                __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket->socket_fd_, len);
+                            markDisconnected(socket);
+                        } else if(UNLIKELY(!state.recv_paused_ && !overflow.empty())) {
+                            pauseRecv(socket);
+                        }
+                        state.rx_time_ = getTSCNanos();
+                        ++socket->stats_.reads_;
+                        socket->stats_.bytes_read_ += static_cast<size_t>(cqe.res);
+                        if(!socket->in_receive_list_) {
+                            socket->in_receive_list_ = true;
+                            receive_sockets_.push_back(socket);
+                        }
+                    }
+                    uring_->recycleBuffer(buffer_id);
+                }
+                // ENOBUFS only means the provided ring ran dry, the request is armed again below, ECANCELED is pauseRecv()
+                if(cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)) {
+                    markDisconnected(socket);
+                }
+                if(!more) {
+                    --state.ops_in_flight_;
+                    state.recv_armed_ = false;
+                    if(!state.closing_ && !socket->disconnected_ && !state.recv_paused_) {
+                        armRecv(socket);
+                    }
+                }
+                break;
+            }
+            case URING_CANCEL: {
+                // -ENOENT / -EALREADY when the receive had ended or was ending anyway
+                --state.ops_in_flight_;
+                break;
+            }
+            case URING_SEND: {
+                --state.ops_in_flight_;
+                state.send_bytes_ = 0;
+                if(cqe.res > 0) {
+                    socket->sentToKernel(static_cast<size_t>(cqe.res));
+                    socket->sent(static_cast<size_t>(cqe.res));
+                } else if(cqe.res < 0) {
+                    markDisconnected(socket);
+                }
+                // a short send goes out again with the rest, after anything queued while it was in flight
+                if(!state.closing_ && !socket->disconnected_ && !socket->outbound_data_.empty() && !socket->in_send_list_) {
+                    socket->in_send_list_ = true;
+                    send_sockets_.push_back(socket);
+                }
+                break;
+            }
+            default:
+                return;
+        }
+
+        if(UNLIKELY(state.closing_ && !state.ops_in_flight_)) {
+            releaseConnection(socket);
+        }
+    }
+
+    auto TCPServer::sendIOURing() noexcept -> void {
+        // one send per socket covering all of its pending data, every SQE goes to the kernel together on the next poll()
+        // a socket with a send in flight is queued again when it completes
+        for(auto socket : send_sockets_) {
+            socket->in_send_list_ = false;
+            auto &state = socket->io_uring_;
+            if(socket->disconnected_ || state.send_bytes_ || socket->outbound_data_.empty()) {
+                continue;
             }
+            state.send_bytes_ = socket->outbound_data_.readable();
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = state.fixed_file_;
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->addr = reinterpret_cast<uint64_t>(socket->outbound_data_.readPtr());
+            sqe->len = static_cast<uint32_t>(state.send_bytes_);
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = reinterpret_cast<uint64_t>(socket) | URING_SEND;
+            ++state.ops_in_flight_;
         }
+        send_sockets_.clear();
     }
-}
\ No newline at end of file
+}
@@ -1,35 +1,266 @@
 #pragma once 
 
+#include <memory>
+
 #include "tcp_socket.h"
+#include "mem_pool.h"
+#include "uring.h"
 
 using namespace std;
 
 namespace Common{
+    constexpr size_t TCP_SERVER_MAX_CONNECTIONS = 1024;
+
+    enum class TCPServerBackend : int8_t {
+        EPOLL = 0,
+        // completion based: multishot accept and receive into provided buffers, batched sends, registered files
+        IO_URING = 1
+    };
+
+    inline auto tcpServerBackendToString(TCPServerBackend backend) -> string {
+        switch(backend) {
+            case TCPServerBackend::EPOLL:
+                return "EPOLL";
+            case TCPServerBackend::IO_URING:
+                return "IO_URING";
+        }
+        return "UNKNOWN";
+    }
+
+    struct TCPServerCfg {
+        TCPServerBackend backend_ = TCPServerBackend::EPOLL;
+        // ack timestamps on accepted connections, recorded in TCPSocketStats::send_to_ack_, epoll backend only
+        bool tx_timestamps_ = false;
+
+        // io_uring only
+        // a kernel thread polls the submission ring so steady state submissions make no syscall, it spins on a core of
+        // its own, sqpoll_cpu_ pins it
+        bool sqpoll_ = false;
+        int sqpoll_cpu_ = -1;
+        unsigned uring_entries_ = 4096;
+        // receive buffers shared by all connections, the kernel picks one per completion, num_recv_buffers_ is a power of two
+        unsigned num_recv_buffers_ = 1024;
+        size_t recv_buffer_size_ = 16 * 1024;
+        StorageCfg recv_buffers_storage_cfg_;
+        // received bytes a connection holds beyond its inbound ring while recv_callback_ catches up: once its inbound ring
+        // is full the connection stops receiving, so the kernel's receive window pushes back on the client, until they
+        // are consumed, the overflow only takes what the kernel had already received by then
+        // it also caps the connection's SO_RCVBUF at a quarter of it (the kernel doubles that) so that fits, a connection
+        // whose receives in flight still do not is closed
+        size_t recv_overflow_size_ = 1024 * 1024;
+    };
+
+    // a TCPRecvHandler that is also told once a pass that read anything is done, e.g. to process what onRecv() queued
+    template<typename Handler>
+    concept TCPServerHandler = TCPRecvHandler<Handler> && requires(Handler &handler) {
+        handler.onRecvFinished();
+    };
+
     struct TCPServer {
-        explicit TCPServer(Logger &logger): listener_socket_(logger), logger_(logger){
+        // max_connections bounds the accepted sockets, which come from a pool sized for it, further clients are turned away
+        // an io_uring backend the kernel does not support falls back to epoll, see backend()
+        explicit TCPServer(Logger &logger, size_t max_connections = TCP_SERVER_MAX_CONNECTIONS, const TCPServerCfg &cfg = {}):
+            listener_socket_(logger), events_(max_connections + 1), socket_pool_(max_connections), cfg_(cfg), logger_(logger){
+            connections_.reserve(max_connections);
+            receive_sockets_.reserve(max_connections);
+            send_sockets_.reserve(max_connections);
+            closing_sockets_.reserve(max_connections);
+            slots_.resize(max_connections, nullptr);
+            for(auto slot = static_cast<uint32_t>(max_connections); slot > 0; --slot) {
+                free_slots_.push_back(slot - 1);
+            }
         }
 
-        auto listen(const string &iface, int port) ->void;
+        ~TCPServer();
+
+        // reuse_port: other servers may listen on the same port, e.g. one per core, see ShardedTCPServer
+        auto listen(const string &iface, int port, bool reuse_port = false) ->void;
 
         auto poll() noexcept -> void;
 
+        // reads what arrived, hands it to recv_callback_ (the copy in each socket) and calls recv_finished_callback_ once
+        // after a pass that read anything, then flushes outbound data and closes disconnected sockets
         auto sendAndRecv() noexcept -> void;
 
+        // the same with the handler called directly instead of through the std::functions, so it can be inlined
+        template<TCPServerHandler Handler>
+        auto sendAndRecv(Handler &handler) noexcept -> void {
+            const auto recv = (uring_ ? recvIOURing(handler) : recvEpoll(handler));
+            if(recv) {
+                handler.onRecvFinished();
+            }
+            if(uring_) {
+                sendIOURing();
+            } else {
+                sendEpoll();
+            }
+            closeDisconnected();
+        }
+
+        // the live connection with this TCPSocket::connection_id_, nullptr once it has disconnected or been closed
+        auto connection(uint64_t connection_id) const noexcept -> TCPSocket * {
+            const auto slot = static_cast<uint32_t>(connection_id);
+            if(UNLIKELY(slot >= slots_.size())) {
+                return nullptr;
+            }
+            auto socket = slots_[slot];
+            return ((socket && socket->connection_id_ == connection_id && !socket->disconnected_) ? socket : nullptr);
+        }
+
+        // drops the connection, e.g. a client that does not keep up with what we send it: connection() stops finding it at
+        // once and it is closed at the end of the next sendAndRecv()
+        auto markDisconnected(TCPSocket *socket) noexcept -> void;
+
+        // the backend in use, valid after listen()
+        auto backend() const noexcept {
+            return (uring_ ? TCPServerBackend::IO_URING : TCPServerBackend::EPOLL);
+        }
+
         private:
-            auto addToEpollList(TCPSocket *socket);
+            auto addToEpollList(TCPSocket *socket, uint32_t events);
+
+            auto acceptConnections() noexcept -> void;
+
+            // sets up a socket for a freshly accepted fd on either backend, or closes the fd if we are at capacity
+            auto addConnection(int fd) noexcept -> void;
+
+            // deregisters the socket from epoll, closes it and gives it back to the pool
+            // on io_uring a socket the kernel still holds requests for is shut down and only released once they complete
+            auto closeConnection(TCPSocket *socket) noexcept -> void;
+
+            auto releaseConnection(TCPSocket *socket) noexcept -> void;
+
+            // io_uring backend
+            // requests carry the socket pointer with the operation in its low bits
+            enum URingOp : uint64_t { URING_RECV = 1, URING_SEND = 2, URING_ACCEPT = 3, URING_CANCEL = 4 };
+            static constexpr uint64_t URING_OP_MASK = 7;
+
+            auto setupIOURing() noexcept -> bool;
+
+            auto getSqe() noexcept -> io_uring_sqe *;
+
+            auto armAccept() noexcept -> void;
+
+            auto armRecv(TCPSocket *socket) noexcept -> void;
+
+            // cancels the socket's multishot receive and keeps it from being armed again until resumeRecv()
+            auto pauseRecv(TCPSocket *socket) noexcept -> void;
+
+            auto resumeRecv(TCPSocket *socket) noexcept -> void;
+
+            auto onCompletion(const io_uring_cqe &cqe) noexcept -> void;
+
+            // reads every socket epoll reported readable, a socket stays in the list until a read comes back empty since
+            // with EPOLLET there is no new event for data that was already there, and while its inbound ring is full
+            template<TCPRecvHandler Handler>
+            auto recvEpoll(Handler &handler) noexcept -> bool {
+                auto recv = false;
+                size_t kept = 0;
+                for(auto socket : receive_sockets_) {
+                    const auto read = socket->sendAndRecv(handler);
+                    recv |= read;
+                    if((read || socket->inbound_data_.full()) && !socket->disconnected_) {
+                        receive_sockets_[kept++] = socket;
+                    } else {
+                        socket->in_receive_list_ = false;
+                        if(UNLIKELY(socket->disconnected_)) {
+                            closing_sockets_.push_back(socket);
+                        }
+                    }
+                }
+                receive_sockets_.resize(kept);
+                return recv;
+            }
+
+            // the receive list holds sockets whose completions delivered data since the last call
+            template<TCPRecvHandler Handler>
+            auto recvIOURing(Handler &handler) noexcept -> bool {
+                auto recv = false;
+                size_t kept = 0;
+                for(auto socket : receive_sockets_) {
+                    auto &overflow = *socket->io_uring_.overflow_;
+                    if(UNLIKELY(!overflow.empty())) {
+                        const auto n = min(overflow.readable(), socket->inbound_data_.writable());
+                        socket->inbound_data_.write(overflow.readPtr(), n);
+                        overflow.consume(n);
+                    }
+                    if(!socket->inbound_data_.empty()) {
+                        recv = true;
+                        handler.onRecv(socket, socket->io_uring_.rx_time_);
+                    }
+                    if(UNLIKELY(socket->io_uring_.recv_paused_ && overflow.empty())) {
+                        resumeRecv(socket);
+                    }
+                    if(UNLIKELY(!overflow.empty() && !socket->disconnected_)) {
+                        receive_sockets_[kept++] = socket;
+                    } else {
+                        socket->in_receive_list_ = false;
+                        if(UNLIKELY(socket->disconnected_)) {
+                            closing_sockets_.push_back(socket);
+                        }
+                    }
+                }
+                receive_sockets_.resize(kept);
+                return recv;
+            }
+
+            // flushes the sockets that were sent to since the last call
+            auto sendEpoll() noexcept -> void;
+
+            auto sendIOURing() noexcept -> void;
+
+            auto closeDisconnected() noexcept -> void;
 
         public:
             int epoll_fd_ = -1;
             TCPSocket listener_socket_;
 
-            epoll_event events_[1024];
+            // one slot per connection plus the listener, so a single epoll_wait() can report every socket
+            vector<epoll_event> events_;
+
+            // accepted sockets, and the ready lists: sockets with data to read (until a read comes back empty) and sockets
+            // with outbound data, TCPSocket::in_receive_list_ / in_send_list_ flag membership
+            vector<TCPSocket *> connections_;
             vector<TCPSocket *> receive_sockets_, send_sockets_;
+            // sockets found disconnected, closed once the ready lists are done with them
+            vector<TCPSocket *> closing_sockets_;
+            FreeListMemPool<TCPSocket> socket_pool_;
 
             function<void(TCPSocket *s, Nanos rx_time)> recv_callback_ = nullptr;
 
             function <void()> recv_finished_callback_ = nullptr;
 
+            // backing storage for the buffers of accepted sockets
+            StorageCfg socket_storage_cfg_;
+            // size of each of their inbound and outbound rings
+            size_t socket_buffer_size_ = TCPBufferSize;
+
+            TCPServerCfg cfg_;
+            // every connection has a slot, the low half of its connection id and its registered file on io_uring
+            vector<TCPSocket *> slots_;
+            vector<uint32_t> free_slots_;
+            // high half of connection ids, so an id is not reused when its slot is
+            uint64_t next_generation_ = 0;
+
+            // set when the io_uring backend is in use
+            unique_ptr<IOURing> uring_;
+
             string time_str_;
             Logger &logger_;
     };
+
+    // the std::function flavour of TCPServerHandler
+    struct ServerCallbackHandler {
+        TCPServer &server_;
+
+        auto onRecv(TCPSocket *socket, Nanos rx_time) {
+            socket->recv_callback_(socket, rx_time);
+        }
+
+        auto onRecvFinished() {
+            if(server_.recv_finished_callback_) {
+                server_.recv_finished_callback_();
+            }
+        }
+    };
 }
\ No newline at end of file
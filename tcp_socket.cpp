@@ -1,10 +1,11 @@
 #include "tcp_socket.h"
+#include <linux/errqueue.h>
 using namespace std;
 
 namespace Common {
 
-    auto TCPSocket::connect(const string &ip, const string &iface, int port, bool is_listening)->int{
-        const SocketCfg socket_cfg{ip, iface, port, false, is_listening, true};
+    auto TCPSocket::connect(const string &ip, const string &iface, int port, bool is_listening, bool reuse_port)->int{
+        const SocketCfg socket_cfg{ip, iface, port, false, is_listening, true, tx_timestamps_, reuse_port};
         socket_fd_ = createSocket(logger_, socket_cfg);
 
         // telling the server to listen on all interfaces
@@ -20,15 +21,20 @@ namespace Common {
     // cmsghdr is the header for each of the ancillary block
 
     auto TCPSocket::sendAndRecv() noexcept -> bool {
-        // the size of the buffer it timeval, because an ancillary data will be timestamps
-        char ctrl[CMSG_SPACE(sizeof(struct timeval))];
-        // cmsghdr has fields: len, level (protocol level) and type (type of control message)
-        auto cmsg = reinterpret_cast<struct cmsghdr *>(&ctrl);
+        RecvCallbackHandler handler;
+        return sendAndRecv(handler);
+    }
+
+    auto TCPSocket::readInbound(Nanos *kernel_time) noexcept -> ssize_t {
+        // room for the ancillary data a read can carry: the SO_TIMESTAMPING receive timestamp (or SO_TIMESTAMPNS /
+        // SO_TIMESTAMP on a socket set up by hand)
+        alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(scm_timestamping)) + CMSG_SPACE(sizeof(timespec))];
 
         // used for scatter gather io
         // reading or writing to multiple non contiguous memory buffers in a single system call
         // fields: starting address, length of buffer
-        iovec iov{inbound_data_.data() + next_rcv_valid_index_, TCPBufferSize-next_rcv_valid_index_};
+        // the free space of the ring is one contiguous span, so one iovec always covers it
+        iovec iov{inbound_data_.writePtr(), inbound_data_.writable()};
         // store data in inbound_data_, and the timestamp in ctrl
         msghdr msg{&socket_attrib_, sizeof(socket_attrib_), &iov, 1, ctrl, sizeof(ctrl), 0};
 
@@ -45,41 +51,268 @@ namespace Common {
         //     int           msg_flags;      
         // };
 
-        const auto read_size = recvmsg(socket_fd_, &msg, MSG_DONTWAIT);
+        // a full ring reads nothing until the handler consumes some of it, the owner keeps the socket ready meanwhile
+        const auto read_size = (iov.iov_len ? recvmsg(socket_fd_, &msg, MSG_DONTWAIT) : 0);
         if(read_size > 0){
-            //  updating next valid read index
-            next_rcv_valid_index_ += read_size;
-
-            // *
-            Nanos kernel_time = 0;
-            timeval time_kernel;
-            if(cmsg->cmsg_level == SOL_SOCKET && 
-                cmsg->cmsg_type == SCM_TIMESTAMP &&
-                cmsg->cmsg_len == CMSG_LEN(sizeof(time_kernel))) {
-                    // value of cmsg is put in time_kernel
-                    memcpy(&time_kernel, CMSG_DATA(cmsg), sizeof(time_kernel));
-                    // final time
-                    kernel_time = time_kernel.tv_sec * NANOS_TO_SECS + time_kernel.tv_usec * NANOS_TO_MICROS;
+            inbound_data_.commit(read_size);
+
+            // cmsghdr has fields: len, level (protocol level) and type (type of control message), there can be several
+            for(auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+                if(cmsg->cmsg_level != SOL_SOCKET){
+                    continue;
+                }
+                if(cmsg->cmsg_type == SCM_TIMESTAMPING){
+                    // software timestamp in ts[0], ts[2] would be the hardware one
+                    scm_timestamping ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    *kernel_time = ts.ts[0].tv_sec * NANOS_TO_SECS + ts.ts[0].tv_nsec;
+                } else if(cmsg->cmsg_type == SCM_TIMESTAMPNS){
+                    timespec ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    *kernel_time = ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+                } else if(cmsg->cmsg_type == SCM_TIMESTAMP){
+                    timeval tv;
+                    memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+                    *kernel_time = tv.tv_sec * NANOS_TO_SECS + tv.tv_usec * NANOS_TO_MICROS;
+                }
+            }
+
+            ++stats_.reads_;
+            stats_.bytes_read_ += read_size;
+            if(*kernel_time){
+                stats_.kernel_to_user_.record(getTSCNanos() - *kernel_time);
+            }
+        } else if((read_size == 0 && iov.iov_len) || (read_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            // orderly shutdown by the peer, or a reset / error
+            disconnected_ = true;
+        }
+        return read_size;
+    }
+
+    auto TCPSocket::sendv(const iovec *iov, size_t iov_count) noexcept -> TCPSendResult {
+        TCPSendResult result;
+        size_t total = 0;
+        for(size_t i = 0; i < iov_count; ++i){
+            total += iov[i].iov_len;
+        }
+        if(io_uring_.fixed_file_ >= 0){ // the server sends it, all or nothing through the ring.
+            if(outbound_data_.writable() >= total){
+                for(size_t i = 0; i < iov_count; ++i){
+                    outbound_data_.write(iov[i].iov_base, iov[i].iov_len);
                 }
-            const auto user_time = getCurrentNanos();
+                result.accepted_ = total;
+            }
+            if(result.accepted_ && send_list_ && !in_send_list_){
+                in_send_list_ = true;
+                send_list_->push_back(this);
+            }
+            if(!result.accepted_ || outbound_data_.readable() >= send_high_watermark_){
+                send_backpressured_ = true;
+            }
+            return result;
+        }
+        if(!outbound_data_.empty()){
+            sendPending();
+        }
 
-            logger_.log("%:% %() % read socket:% len:% utime:% ktime:% diff:%\n", __FILE__, __LINE__, __FUNCTION__,
-                    Common::getCurrentTimeStr(&time_str_), socket_fd_, next_rcv_valid_index_, user_time, kernel_time, (user_time - kernel_time));
-            recv_callback_(this, kernel_time);
+        size_t sent = 0;
+        if(outbound_data_.empty() && !disconnected_){
+            auto zerocopy = (total >= zerocopy_threshold_);
+            if(zerocopy && zerocopy_enabled_ < 0){
+                const int one = 1;
+                zerocopy_enabled_ = (setsockopt(socket_fd_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+            }
+            zerocopy = (zerocopy && zerocopy_enabled_ > 0);
+
+            msghdr msg{};
+            msg.msg_iov = const_cast<iovec *>(iov);
+            msg.msg_iovlen = min<size_t>(iov_count, IOV_MAX);
+            ssize_t n;
+            while(true){
+                n = sendmsg(socket_fd_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+                if(n < 0 && errno == EINTR){
+                    continue;
+                }
+                if(n < 0 && zerocopy && errno == ENOBUFS){ // out of option memory to track the pinned pages, copy instead.
+                    zerocopy = false;
+                    continue;
+                }
+                break;
+            }
+            if(n >= 0){
+                sent = n;
+                sentToKernel(sent);
+                if(zerocopy){
+                    result.zerocopy_ = true;
+                    result.zerocopy_id_ = next_zerocopy_id_++;
+                    ++zerocopy_in_flight_;
+                }
+            } else if(errno == EAGAIN || errno == EWOULDBLOCK){
+                awaiting_writable_ = true;
+            } else {
+                disconnected_ = true;
+            }
+        }
+        result.accepted_ = sent;
+        if(sent < total && !disconnected_){ // the kernel send buffer is full.
+            awaiting_writable_ = true;
         }
 
-        // send pending outbound data if any
-        if(next_send_valid_index_ > 0){
-            const auto n = ::send(socket_fd_, outbound_data_.data(), next_send_valid_index_, MSG_DONTWAIT | MSG_NOSIGNAL);
-            logger_.log("%:% %() % send socket:% len:%\n", __FILE__, __LINE__, __FUNCTION__, Common::getCurrentTimeStr(&time_str_), socket_fd_, n);
+        // what the kernel did not take: a small payload is copied into the ring as a whole, a large one waits for the caller
+        if(sent < total && total < zerocopy_threshold_ && !disconnected_ && outbound_data_.writable() >= total - sent){
+            for(size_t i = 0, skip = sent; i < iov_count; ++i){
+                const auto part = min(skip, iov[i].iov_len);
+                skip -= part;
+                outbound_data_.write(static_cast<const char *>(iov[i].iov_base) + part, iov[i].iov_len - part);
+            }
+            result.accepted_ = total;
+            if(send_list_ && !in_send_list_ && !awaiting_writable_){
+                in_send_list_ = true;
+                send_list_->push_back(this);
+            }
+        }
+        if(result.accepted_ < total || outbound_data_.readable() >= send_high_watermark_){
+            send_backpressured_ = true;
         }
-        next_rcv_valid_index_ = 0;
-        return (read_size > 0); 
+        return result;
     }
 
-    auto TCPSocket::send(const void *data, size_t len) noexcept ->void {
+    auto TCPSocket::reapErrorQueue() noexcept -> void {
+        while(errorQueuePending()){
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping)) + CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in))];
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if(recvmsg(socket_fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0){
+                break;
+            }
+            // a timestamp comes as SCM_TIMESTAMPING followed by the extended error saying what it stamps
+            Nanos timestamp = 0;
+            for(auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+                if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING){
+                    scm_timestamping ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    timestamp = ts.ts[0].tv_sec * NANOS_TO_SECS + ts.ts[0].tv_nsec;
+                    continue;
+                }
+                if(!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                     (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))){
+                    continue;
+                }
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if(err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING && err.ee_info == SCM_TSTAMP_ACK){
+                    // ee_data is the offset of the last byte acknowledged, sends up to it are done
+                    while(tx_timestamp_head_ != tx_timestamp_tail_){
+                        const auto &pending = tx_timestamps_pending_[tx_timestamp_head_ % TCPTxTimestampSlots];
+                        if(static_cast<int32_t>(err.ee_data - pending.last_byte_) < 0){
+                            break;
+                        }
+                        if(pending.last_byte_ == err.ee_data && timestamp){
+                            stats_.send_to_ack_.record(timestamp - pending.sent_time_);
+                        }
+                        ++tx_timestamp_head_;
+                    }
+                    continue;
+                }
+                if(err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY){
+                    continue;
+                }
+                // ee_info to ee_data is an inclusive range of send ids, 32 bit and wrapping
+                const auto count = static_cast<uint32_t>(err.ee_data - err.ee_info + 1);
+                zerocopy_in_flight_ -= min<size_t>(count, zerocopy_in_flight_);
+                if(err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED){
+                    zerocopy_copied_ += count;
+                }
+                if(zerocopy_callback_){
+                    zerocopy_callback_(this, err.ee_info, err.ee_data);
+                }
+            }
+        }
+    }
+
+    auto TCPSocket::socketError() const noexcept -> int {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if(getsockopt(socket_fd_, SOL_SOCKET, SO_ERROR, &error, &len) != 0){
+            return errno;
+        }
+        return error;
+    }
+
+    auto TCPSocket::sendPending() noexcept -> bool {
+        // send pending outbound data if any, short writes leave the rest in the ring for the next call
+        while(!outbound_data_.empty()){
+            const auto n = ::send(socket_fd_, outbound_data_.readPtr(), outbound_data_.readable(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if(n > 0){
+                outbound_data_.consume(n);
+                sentToKernel(n);
+                continue;
+            }
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                awaiting_writable_ = true;
+            } else {
+                disconnected_ = true;
+            }
+            break;
+        }
+        sent(0);
+        return outbound_data_.empty();
+    }
+
+    auto TCPSocket::sentToKernel(size_t n) noexcept -> void {
+        ++stats_.sends_;
+        stats_.bytes_sent_ += n;
+        if(tx_timestamps_){
+            // the oldest is dropped when too many are outstanding, its ack timestamp is then ignored
+            if(tx_timestamp_tail_ - tx_timestamp_head_ == TCPTxTimestampSlots){
+                ++tx_timestamp_head_;
+            }
+            tx_timestamps_pending_[tx_timestamp_tail_++ % TCPTxTimestampSlots] = {static_cast<uint32_t>(stats_.bytes_sent_ - 1), getTSCNanos()};
+        }
+    }
+
+    auto TCPSocket::sent(size_t n) noexcept -> void {
+        outbound_data_.consume(n);
+        if(UNLIKELY(send_backpressured_ && outbound_data_.readable() <= send_low_watermark_)){
+            send_backpressured_ = false;
+            if(send_resumed_callback_){
+                send_resumed_callback_(this);
+            }
+        }
+    }
+
+    auto TCPSocket::send(const void *data, size_t len) noexcept -> bool {
         // copies the data into outbound buffer
-        memcpy(outbound_data_.data() + next_send_valid_index_, data, len);
-        next_send_valid_index_ += true;
+        auto next = reserve(len);
+        if(UNLIKELY(!next)){
+            return false;
+        }
+        memcpy(next, data, len);
+        commit(len);
+        return true;
+    }
+
+    auto TCPSocket::reserve(size_t len) noexcept -> char * {
+        if(UNLIKELY(len > outbound_data_.writable())){
+            send_backpressured_ = true;
+            return nullptr;
+        }
+        return outbound_data_.writePtr();
+    }
+
+    auto TCPSocket::commit(size_t len) noexcept -> void {
+        outbound_data_.commit(len);
+        if(UNLIKELY(outbound_data_.readable() >= send_high_watermark_)){
+            send_backpressured_ = true;
+        }
+        // a socket waiting for EPOLLOUT is queued again by the server when the event arrives
+        if(send_list_ && !in_send_list_ && !awaiting_writable_) {
+            in_send_list_ = true;
+            send_list_->push_back(this);
+        }
     }
 }
@@ -3,24 +3,208 @@
 #include <functional>
 #include "logging.h"
 #include <socket_utils.h>
+#include "mem_utils.h"
+#include "ring_buffer.h"
 #include <string>
+#include <limits>
 
 using namespace std;
 
 namespace Common {
-    constexpr size_t TCPBufferSize = 64 * 1024 * 1024;
+    // default size of each of a socket's inbound and outbound rings
+    constexpr size_t TCPBufferSize = 256 * 1024;
+
+    // sendv() payloads from this size up go out with MSG_ZEROCOPY, below it pinning pages costs more than copying them
+    constexpr size_t TCPZeroCopyThreshold = 16 * 1024;
+
+    struct TCPSendResult {
+        // bytes taken, the caller resubmits the rest once the socket is no longer backpressured
+        size_t accepted_ = 0;
+        // the kernel references the caller's buffers until zerocopy_callback_ reports zerocopy_id_
+        bool zerocopy_ = false;
+        uint32_t zerocopy_id_ = 0;
+    };
+
+    // sends whose ack timestamp we wait for, older ones are forgotten if more are outstanding
+    constexpr size_t TCPTxTimestampSlots = 256;
+
+    // count, mean and range of a latency in nanoseconds, owned by one thread
+    struct LatencyStat {
+        uint64_t count_ = 0;
+        Nanos total_ = 0;
+        Nanos min_ = numeric_limits<Nanos>::max();
+        Nanos max_ = 0;
+
+        auto record(Nanos value) noexcept {
+            ++count_;
+            total_ += value;
+            min_ = min(min_, value);
+            max_ = max(max_, value);
+        }
+
+        auto toString() const {
+            stringstream ss;
+            ss << "[count:" << count_
+            << " mean:" << (count_ ? total_ / static_cast<Nanos>(count_) : 0)
+            << " min:" << (count_ ? min_ : 0)
+            << " max:" << max_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // kept by the socket on every read and send in place of logging them, read them from the socket's thread
+    struct TCPSocketStats {
+        uint64_t reads_ = 0;
+        uint64_t bytes_read_ = 0;
+        uint64_t sends_ = 0;
+        uint64_t bytes_sent_ = 0;
+        // kernel receive timestamp to the read returning, and to recv_callback_ returning
+        LatencyStat kernel_to_user_;
+        LatencyStat kernel_to_callback_;
+        // handing data to the kernel to the peer acknowledging it, with tx_timestamps_
+        LatencyStat send_to_ack_;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "TCPSocketStats[reads:" << reads_
+            << " bytes_read:" << bytes_read_
+            << " sends:" << sends_
+            << " bytes_sent:" << bytes_sent_
+            << " kernel_to_user:" << kernel_to_user_.toString()
+            << " kernel_to_callback:" << kernel_to_callback_.toString()
+            << " send_to_ack:" << send_to_ack_.toString()
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // sequencing and counters of the framing layer (tcp_framing.h) on a connection
+    struct TCPFrameState {
+        // sequence numbers start at 1 in each direction, every frame carries the next one
+        uint64_t next_send_seq_num_ = 1;
+        uint64_t next_recv_seq_num_ = 1;
+        uint64_t frames_sent_ = 0;
+        uint64_t frames_received_ = 0;
+        // well formed frames of a type the protocol does not know, skipped
+        uint64_t unknown_frames_ = 0;
+        // frames whose sequence number was not the one expected
+        uint64_t sequence_gaps_ = 0;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "TCPFrameState[next_send_seq_num:" << next_send_seq_num_
+            << " next_recv_seq_num:" << next_recv_seq_num_
+            << " frames_sent:" << frames_sent_
+            << " frames_received:" << frames_received_
+            << " unknown_frames:" << unknown_frames_
+            << " sequence_gaps:" << sequence_gaps_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    struct TCPSocket;
+
+    // what a socket or server hands received data to: onRecv(socket, rx_time) parses socket->inbound_data_ in place
+    // and consume()s what it has handled, rx_time is the kernel receive timestamp or 0
+    // the template sendAndRecv() overloads call it directly, so the read path can be inlined into the business logic,
+    // the plain ones dispatch through the recv_callback_ std::function
+    template<typename Handler>
+    concept TCPRecvHandler = requires(Handler &handler, TCPSocket *socket, Nanos rx_time) {
+        handler.onRecv(socket, rx_time);
+    };
 
     struct TCPSocket {
-        explicit TCPSocket(Logger &logger): logger_(logger){
-            outbound_data_.resize(TCPBufferSize);
-            inbound_data_.resize(TCPBufferSize);
+        // buffer_size is rounded up to a power of two number of pages, see MirroredRingBuffer
+        explicit TCPSocket(Logger &logger, const StorageCfg &storage_cfg = {}, size_t buffer_size = TCPBufferSize):
+            outbound_data_(buffer_size, storage_cfg), inbound_data_(buffer_size, storage_cfg),
+            send_high_watermark_(outbound_data_.capacity() / 4 * 3), send_low_watermark_(outbound_data_.capacity() / 4), logger_(logger){
         }
 
-        auto connect(const string &ip,  const string &iface, int port, bool is_listening) -> int;
+        ~TCPSocket() {
+            if(socket_fd_ >= 0) {
+                close(socket_fd_);
+            }
+        }
 
+        // reuse_port lets several listeners share the port, see SocketCfg::reuse_port_
+        auto connect(const string &ip,  const string &iface, int port, bool is_listening, bool reuse_port = false) -> int;
+
+        // reads once into inbound_data_ and hands what arrived to recv_callback_, then flushes outbound_data_, returns true
+        // if something was read
         auto sendAndRecv() noexcept -> bool;
 
-        auto send(const void *data, size_t len)  noexcept -> void;
+        template<TCPRecvHandler Handler>
+        auto sendAndRecv(Handler &handler) noexcept -> bool {
+            Nanos kernel_time = 0;
+            const auto read_size = readInbound(&kernel_time);
+            if(read_size > 0) {
+                handler.onRecv(this, kernel_time);
+                if(kernel_time) {
+                    stats_.kernel_to_callback_.record(getTSCNanos() - kernel_time);
+                }
+            }
+
+            sendPending();
+            if(errorQueuePending()) {
+                reapErrorQueue();
+            }
+            return (read_size > 0);
+        }
+
+        // one recvmsg() into the free space of inbound_data_ with its kernel timestamp, sets disconnected_ on an orderly
+        // shutdown or an error, returns what recvmsg() did
+        auto readInbound(Nanos *kernel_time) noexcept -> ssize_t;
+
+        // queues all of data, or nothing and returns false if the outbound ring does not have room for it
+        auto send(const void *data, size_t len)  noexcept -> bool;
+
+        // encodes straight into the outbound ring: reserve() returns len contiguous bytes, or nullptr if the ring does not
+        // have room for them, commit() queues them like send() does
+        auto reserve(size_t len) noexcept -> char *;
+
+        auto commit(size_t len) noexcept -> void;
+
+        // transmits the caller's buffers without copying them into outbound_data_ where possible
+        // anything already queued is flushed first to keep the stream in order, then the iovecs go to one sendmsg(), with
+        // MSG_ZEROCOPY from zerocopy_threshold_ bytes on; a short send of a small payload is copied into outbound_data_,
+        // a large one is only taken in part (see TCPSendResult)
+        auto sendv(const iovec *iov, size_t iov_count) noexcept -> TCPSendResult;
+
+        // reads the socket's error queue: MSG_ZEROCOPY completions, reported through zerocopy_callback_, and ack
+        // timestamps, recorded in stats_
+        auto reapErrorQueue() noexcept -> void;
+
+        auto zeroCopyInFlight() const noexcept {
+            return zerocopy_in_flight_;
+        }
+
+        // something is expected on the error queue
+        auto errorQueuePending() const noexcept {
+            return zerocopy_in_flight_ || tx_timestamp_head_ != tx_timestamp_tail_;
+        }
+
+        // pending error on the socket, clears it
+        auto socketError() const noexcept -> int;
+
+        // writes out as much pending outbound data as the kernel takes, returns true once nothing is left
+        auto sendPending() noexcept -> bool;
+
+        // n bytes of outbound_data_ have been handed to the kernel
+        auto sent(size_t n) noexcept -> void;
+
+        // set once the outbound ring fills past send_high_watermark_, cleared when it drains below send_low_watermark_
+        auto isSendBackpressured() const noexcept {
+            return send_backpressured_;
+        }
+
+        auto storageInfo() const noexcept -> StorageInfo {
+            return inbound_data_.storageInfo();
+        }
 
         TCPSocket() = delete;
 
@@ -34,10 +218,67 @@ namespace Common {
 
         int socket_fd_ = -1;
 
-        vector<char> outbound_data_;
-        size_t next_send_valid_index_ = 0;
-        vector<char> inbound_data_;
-        size_t next_rcv_valid_index_ = 0;
+        // recv_callback_ parses inbound_data_ in place and consume()s what it has handled, a partial frame stays buffered
+        // until the rest of it arrives
+        MirroredRingBuffer outbound_data_;
+        MirroredRingBuffer inbound_data_;
+
+        size_t send_high_watermark_;
+        size_t send_low_watermark_;
+        bool send_backpressured_ = false;
+        // invoked when a backpressured socket drains below send_low_watermark_
+        function<void(TCPSocket *s)> send_resumed_callback_ = nullptr;
+
+        size_t zerocopy_threshold_ = TCPZeroCopyThreshold;
+        // invoked with an inclusive range of zero-copy send ids whose buffers the kernel has released
+        function<void(TCPSocket *s, uint32_t first_id, uint32_t last_id)> zerocopy_callback_ = nullptr;
+        // SO_ZEROCOPY is switched on with the first zero-copy send, -1 until then, 0 if the kernel refused
+        int zerocopy_enabled_ = -1;
+        uint32_t next_zerocopy_id_ = 0;
+        size_t zerocopy_in_flight_ = 0;
+        // completions where the kernel ended up copying anyway, e.g. always over loopback
+        size_t zerocopy_copied_ = 0;
+
+        // assigned by the TCPServer that accepted the socket, unique among its connections for its lifetime
+        // the low 32 bits are the connection's slot, TCPServer::connection() finds it from the id
+        uint64_t connection_id_ = 0;
+
+        // set before connect() to get ack timestamps for what we send, SocketCfg::needs_tx_timestamp_
+        bool tx_timestamps_ = false;
+        TCPSocketStats stats_;
+        TCPFrameState frames_;
+
+        // state of a socket driven by a TCPServer on the io_uring backend, whose sends and receives are all asynchronous:
+        // outbound data goes out only through the server, and sendAndRecv() / sendPending() / zero-copy are not used
+        struct IOURingState {
+            // slot in the ring's registered file table (the connection's slot), -1 when the socket is not on io_uring
+            int fixed_file_ = -1;
+            // requests the kernel still holds for the socket, it goes back to the pool only once they have all completed
+            uint32_t ops_in_flight_ = 0;
+            bool recv_armed_ = false;
+            // bytes at the front of outbound_data_ the send in flight covers, 0 when there is none
+            size_t send_bytes_ = 0;
+            bool closing_ = false;
+            // no receive is armed again until overflow_ drains, set once anything is in it
+            bool recv_paused_ = false;
+            // arrival time of the latest received data, taken when its completion is reaped
+            Nanos rx_time_ = 0;
+            // received bytes that did not fit into inbound_data_, moved in as recv_callback_ consumes
+            // bounded at TCPServerCfg::recv_overflow_size_, allocated when the server accepts the socket
+            unique_ptr<MirroredRingBuffer> overflow_;
+        } io_uring_;
+
+        // stream offset of the last byte of every send still waiting for its ack timestamp, and when it was sent
+        struct TxTimestamp {
+            uint32_t last_byte_ = 0;
+            Nanos sent_time_ = 0;
+        };
+        TxTimestamp tx_timestamps_pending_[TCPTxTimestampSlots];
+        size_t tx_timestamp_head_ = 0;
+        size_t tx_timestamp_tail_ = 0;
+
+        // counts a send of n bytes and remembers it for its ack timestamp
+        auto sentToKernel(size_t n) noexcept -> void;
 
         // fields in sockaddr_in:
         // takes in family, port, address, and padding
@@ -47,7 +288,27 @@ namespace Common {
         // recv_callback(this, rx_time)
         function<void(TCPSocket *s, Nanos rx_time)> recv_callback_ = nullptr;
 
+        // bookkeeping for the owning TCPServer
+        // ready flags, so the server's ready lists never hold a socket twice and membership checks are O(1)
+        bool in_receive_list_ = false;
+        bool in_send_list_ = false;
+        // the peer closed the connection or the socket failed, the owner closes it
+        bool disconnected_ = false;
+        // the kernel send buffer was full, flushing resumes on EPOLLOUT
+        bool awaiting_writable_ = false;
+        // send() queues the socket here so the owner flushes it without scanning every connection
+        vector<TCPSocket *> *send_list_ = nullptr;
+        // position in the owner's list of connections, for O(1) removal
+        size_t connection_index_ = 0;
+
         string time_str_;
         Logger &logger_;
     };
+
+    // the std::function flavour of TCPRecvHandler
+    struct RecvCallbackHandler {
+        auto onRecv(TCPSocket *socket, Nanos rx_time) {
+            socket->recv_callback_(socket, rx_time);
+        }
+    };
 }
\ No newline at end of file
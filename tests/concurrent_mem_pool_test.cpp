@@ -0,0 +1,141 @@
+#include "mem_pool.h"
+#include "lf_queue.h"
+#include "thread_utils.h"
+
+#include <set>
+
+using namespace std;
+using namespace Common;
+
+// ConcurrentMemPool across threads, also meant to be built with -fsanitize=thread:
+// - handoff: one thread allocates and hands the objects over a queue to another that checks and frees them, so every free
+//   is remote and the pool, much smaller than the number of objects, only keeps up by recycling them
+// - exhaustion: every block allocated on one thread and freed on another, a third thread then gets all of them back from
+//   the first one's remote free list, and nullptr rather than a crash once there are none
+// - more threads than MaxThreads: the ones past it share a cache and must neither crash nor lose blocks
+
+struct Order {
+    uint64_t id_;
+    uint64_t check_;
+
+    Order(uint64_t id) : id_(id), check_(~id) {}
+};
+
+constexpr size_t POOL_SIZE = 1024;
+constexpr size_t HANDOFF_ORDERS = 1'000'000;
+
+auto handoff() {
+    ConcurrentMemPool<Order> pool(POOL_SIZE, 16);
+    SPSCLFQueue<Order *> queue(POOL_SIZE / 2);
+
+    auto consumer = createAndStartThread(-1, "consumer", [&]() {
+        for(uint64_t id = 0; id < HANDOFF_ORDERS;) {
+            const auto next = queue.getNextToRead();
+            if(!next) {
+                this_thread::yield();
+                continue;
+            }
+            const auto order = *next;
+            queue.updateReadIndex();
+            if(UNLIKELY(order->id_ != id || order->check_ != ~id)) {
+                FATAL("order " + to_string(id) + " came through as " + to_string(order->id_));
+            }
+            pool.deallocate(order);
+            ++id;
+        }
+    });
+    ASSERT(consumer.joinable(), "Unable to start the consumer thread.");
+
+    for(uint64_t id = 0; id < HANDOFF_ORDERS;) {
+        auto next = queue.getNextToWriteTo();
+        if(!next) {
+            this_thread::yield();
+            continue;
+        }
+        auto order = pool.allocate(id);
+        if(!order) {
+            // the consumer has not freed enough yet
+            this_thread::yield();
+            continue;
+        }
+        *next = order;
+        queue.updateWriteIndex();
+        ++id;
+    }
+    consumer.join();
+    cout << "handoff ok orders:" << HANDOFF_ORDERS << endl;
+}
+
+auto exhaustion() {
+    ConcurrentMemPool<Order> pool(POOL_SIZE, 16);
+    vector<Order *> orders;
+
+    auto allocator = createAndStartThread(-1, "allocator", [&]() {
+        for(uint64_t id = 0; id < POOL_SIZE; ++id) {
+            orders.push_back(pool.allocate(id));
+            ASSERT(orders.back(), "pool ran out after " + to_string(id) + " of " + to_string(POOL_SIZE) + " orders");
+        }
+        ASSERT(!pool.allocate(POOL_SIZE), "allocated past the capacity");
+    });
+    allocator.join();
+
+    auto releaser = createAndStartThread(-1, "releaser", [&]() {
+        for(auto order : orders) {
+            pool.deallocate(order);
+        }
+    });
+    releaser.join();
+
+    auto stealer = createAndStartThread(-1, "stealer", [&]() {
+        set<Order *> reused;
+        for(uint64_t id = 0; id < POOL_SIZE; ++id) {
+            auto order = pool.allocate(id);
+            ASSERT(order, "got " + to_string(id) + " of the " + to_string(POOL_SIZE) + " orders freed back to another thread");
+            reused.insert(order);
+        }
+        ASSERT(reused.size() == POOL_SIZE, "the same block handed out twice");
+        ASSERT(!pool.allocate(POOL_SIZE), "allocated past the capacity");
+    });
+    stealer.join();
+    cout << "exhaustion ok" << endl;
+}
+
+auto manyThreads() {
+    constexpr size_t NUM_THREADS = 8;
+    constexpr size_t ORDERS_PER_THREAD = 64;
+    // by now this process has used more thread indexes than that, so every thread below shares the one extra cache
+    ConcurrentMemPool<Order, alignof(Order), 2> pool(NUM_THREADS * ORDERS_PER_THREAD, 8);
+
+    vector<jthread> threads;
+    for(size_t t = 0; t < NUM_THREADS; ++t) {
+        threads.emplace_back([&pool, t]() {
+            vector<Order *> orders;
+            for(int round = 0; round < 1000; ++round) {
+                for(uint64_t i = 0; i < ORDERS_PER_THREAD; ++i) {
+                    const auto id = t * ORDERS_PER_THREAD + i;
+                    orders.push_back(pool.allocate(id));
+                    if(UNLIKELY(!orders.back())) {
+                        FATAL("thread " + to_string(t) + " ran out of orders");
+                    }
+                }
+                for(uint64_t i = 0; i < ORDERS_PER_THREAD; ++i) {
+                    const auto id = t * ORDERS_PER_THREAD + i;
+                    if(UNLIKELY(orders[i]->id_ != id || orders[i]->check_ != ~id)) {
+                        FATAL("thread " + to_string(t) + " order " + to_string(id) + " overwritten");
+                    }
+                    pool.deallocate(orders[i]);
+                }
+                orders.clear();
+            }
+        });
+    }
+    threads.clear();
+    cout << "many_threads ok" << endl;
+}
+
+int main(int, char **) {
+    handoff();
+    exhaustion();
+    manyThreads();
+    return 0;
+}
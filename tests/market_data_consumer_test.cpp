@@ -0,0 +1,103 @@
+#include "time_utils.h"
+#include "tests/market_data_stand_in.h"
+
+using namespace std;
+using namespace Common;
+using namespace Exchange;
+using namespace Trading;
+
+// MarketDataConsumer recovery against a StandInPublisher over loopback multicast, dropping incrementals in a few ways
+// every case publishes a flow, sends until the consumer is in sync again, and fails unless the book the strategy built
+// from the consumer's queue is the publisher's, and the gaps were all noticed
+
+constexpr size_t UPDATES_PER_CASE = 20000;
+constexpr size_t BURST = 16;
+constexpr Nanos SNAPSHOT_INTERVAL = 2 * 1000 * 1000;
+// longest a consumer may take to be back in sync once the flow stops, a few snapshot intervals
+constexpr Nanos SYNC_TIMEOUT = 50 * SNAPSHOT_INTERVAL;
+
+auto droppingSeqNums(const set<uint64_t> &seq_nums) {
+    StandInPublisherCfg cfg;
+    cfg.drop_seq_nums_ = seq_nums;
+    return cfg;
+}
+
+auto droppingAtRandom(double rate) {
+    StandInPublisherCfg cfg;
+    cfg.drop_rate_ = rate;
+    return cfg;
+}
+
+auto runCase(Logger &logger, const string &name, int port, StandInPublisherCfg publisher_cfg) {
+    MarketDataConsumerCfg cfg;
+    cfg.incremental_port_ = port;
+    cfg.snapshot_port_ = port + 1;
+    cfg.mcast_cfg_.rcvbuf_size_ = 16 * 1024 * 1024;
+    publisher_cfg.snapshot_interval_ = SNAPSHOT_INTERVAL;
+
+    MEMarketUpdateLFQueue strategy_updates(ME_MAX_MARKET_UPDATES);
+    MarketDataConsumer consumer(&strategy_updates, logger, cfg);
+    StandInPublisher publisher(logger, cfg, publisher_cfg);
+    MarketDataBooks strategy_books(publisher_cfg.num_tickers_);
+
+    const auto step = [&]() {
+        publisher.flush();
+        publisher.pollSnapshots();
+        consumer.poll();
+        for(auto batch = strategy_updates.getNextToRead(256); !batch.empty(); batch = strategy_updates.getNextToRead(256)) {
+            for(const auto &update : batch) {
+                applyUpdate(strategy_books, update);
+            }
+            strategy_updates.updateReadIndex(batch.size());
+        }
+    };
+
+    for(size_t sent = 0; sent < UPDATES_PER_CASE; sent += BURST) {
+        for(size_t i = 0; i < BURST; ++i) {
+            publisher.publish(publisher.nextUpdate());
+        }
+        step();
+    }
+
+    // the last drop is only noticed once something follows it
+    const auto deadline = getCurrentNanos() + SYNC_TIMEOUT;
+    while((consumer.inRecovery() || consumer.nextExpectedSeqNum() != publisher.next_seq_num_) && getCurrentNanos() < deadline) {
+        publisher.publishTrade();
+        step();
+    }
+
+    const auto &stats = consumer.stats();
+    ASSERT(!consumer.inRecovery() && consumer.nextExpectedSeqNum() == publisher.next_seq_num_,
+           name + ": consumer not in sync, next expected seq:" + to_string(consumer.nextExpectedSeqNum()) + " published up to:" +
+           to_string(publisher.next_seq_num_ - 1) + " " + stats.toString());
+    ASSERT(sameBooks(strategy_books, publisher.books_), name + ": strategy's book differs from the publisher's " + stats.toString());
+    ASSERT(!publisher.dropped_ || stats.gaps_, name + ": " + to_string(publisher.dropped_) + " drops went unnoticed " + stats.toString());
+    ASSERT(stats.recovery_time_.count_ == stats.gaps_, name + ": not every gap recovered " + stats.toString());
+
+    cout << name << " ok dropped:" << publisher.dropped_ << " " << stats.toString() << endl;
+}
+
+int main(int, char **) {
+    Logger logger("market_data_consumer_test.log");
+
+    int port = 23000;
+    const auto next_port = [&port]() {
+        port += 2;
+        return port;
+    };
+
+    runCase(logger, "no_drops", next_port(), StandInPublisherCfg());
+    runCase(logger, "first_update", next_port(), droppingSeqNums({1}));
+    runCase(logger, "single_drop", next_port(), droppingSeqNums({5000}));
+    // a gap, and another one while recovering from it
+    runCase(logger, "drop_during_recovery", next_port(), droppingSeqNums({3000, 3001, 3002, 3010, 3100}));
+    set<uint64_t> long_gap;
+    for(uint64_t seq_num = 7000; seq_num < 9000; ++seq_num) {
+        long_gap.insert(seq_num);
+    }
+    runCase(logger, "long_gap", next_port(), droppingSeqNums(long_gap));
+    runCase(logger, "last_update", next_port(), droppingSeqNums({UPDATES_PER_CASE}));
+    runCase(logger, "random_1pct", next_port(), droppingAtRandom(0.01));
+    runCase(logger, "random_10pct", next_port(), droppingAtRandom(0.1));
+    return 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <map>
+#include <random>
+#include <set>
+
+#include "snapshot_synthesizer.h"
+#include "market_data_consumer.h"
+
+using namespace std;
+
+// a stand-in for the exchange's market data publisher, for driving a MarketDataConsumer over loopback multicast
+// it numbers its updates and sends them on the incremental group, skipping the ones it is told to drop, and hands all of
+// them to a SnapshotSynthesizer serving the snapshot group, as the MarketDataPublisher does
+// everything runs on the caller's thread: publish() / flush() send, pollSnapshots() lets the synthesizer apply what was
+// published and send a snapshot when one is due
+
+// resting orders per ticker keyed by market order id, what a strategy rebuilds from the consumer's updates
+typedef vector<map<Exchange::OrderId, Exchange::MEMarketUpdate>> MarketDataBooks;
+
+inline auto applyUpdate(MarketDataBooks &books, const Exchange::MEMarketUpdate &update) {
+    if(update.ticker_id_ >= books.size()) {
+        return;
+    }
+    auto &orders = books[update.ticker_id_];
+    switch(update.type_) {
+        case Exchange::MarketUpdateType::ADD:
+            orders[update.order_id_] = update;
+            break;
+        case Exchange::MarketUpdateType::MODIFY:
+            orders[update.order_id_].qty_ = update.qty_;
+            break;
+        case Exchange::MarketUpdateType::CANCEL:
+            orders.erase(update.order_id_);
+            break;
+        case Exchange::MarketUpdateType::CLEAR:
+            orders.clear();
+            break;
+        default:
+            break;
+    }
+}
+
+inline auto sameBooks(const MarketDataBooks &lhs, const MarketDataBooks &rhs) {
+    if(lhs.size() != rhs.size()) {
+        return false;
+    }
+    for(size_t ticker_id = 0; ticker_id < lhs.size(); ++ticker_id) {
+        if(lhs[ticker_id].size() != rhs[ticker_id].size()) {
+            return false;
+        }
+        for(auto l = lhs[ticker_id].begin(), r = rhs[ticker_id].begin(); l != lhs[ticker_id].end(); ++l, ++r) {
+            if(l->first != r->first || l->second.qty_ != r->second.qty_ || l->second.price_ != r->second.price_ ||
+               l->second.side_ != r->second.side_) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+struct StandInPublisherCfg {
+    size_t num_tickers_ = 8;
+    // resting orders the flow keeps, so snapshots stay small
+    size_t max_open_orders_ = 512;
+    Common::Nanos snapshot_interval_ = 5 * 1000 * 1000;
+    // share of the incrementals dropped at random, on top of drop_seq_nums_
+    double drop_rate_ = 0;
+    set<uint64_t> drop_seq_nums_;
+};
+
+// publishes a random flow of adds, modifies and cancels
+struct StandInPublisher {
+    StandInPublisher(Common::Logger &logger, const Trading::MarketDataConsumerCfg &consumer_cfg, const StandInPublisherCfg &cfg) :
+        cfg_(cfg), books_(cfg.num_tickers_), socket_(logger), snapshot_updates_(Exchange::ME_MAX_MARKET_UPDATES),
+        synthesizer_(&snapshot_updates_, logger, snapshotCfg(consumer_cfg, cfg)), drop_(cfg.drop_rate_) {
+        ASSERT(socket_.init(consumer_cfg.incremental_ip_, consumer_cfg.iface_, consumer_cfg.incremental_port_, false) >= 0,
+               "Unable to create the stand-in's incremental socket.");
+    }
+
+    static auto snapshotCfg(const Trading::MarketDataConsumerCfg &consumer_cfg, const StandInPublisherCfg &cfg)
+    -> Exchange::SnapshotSynthesizerCfg {
+        Exchange::SnapshotSynthesizerCfg snapshot_cfg;
+        snapshot_cfg.iface_ = consumer_cfg.iface_;
+        snapshot_cfg.ip_ = consumer_cfg.snapshot_ip_;
+        snapshot_cfg.port_ = consumer_cfg.snapshot_port_;
+        snapshot_cfg.interval_ = cfg.snapshot_interval_;
+        snapshot_cfg.num_tickers_ = cfg.num_tickers_;
+        return snapshot_cfg;
+    }
+
+    auto nextUpdate() {
+        using namespace Exchange;
+        MEMarketUpdate update;
+        if(open_orders_.size() < cfg_.max_open_orders_ / 2 || (open_orders_.size() < cfg_.max_open_orders_ && random_() % 2)) {
+            update = {MarketUpdateType::ADD, next_order_id_, static_cast<TickerId>(next_order_id_ % cfg_.num_tickers_),
+                      (next_order_id_ % 2 ? Side::BUY : Side::SELL), static_cast<Price>(100 + random_() % 32),
+                      static_cast<Qty>(1 + random_() % 100), next_order_id_};
+            ++next_order_id_;
+            open_orders_.push_back(update);
+            return update;
+        }
+
+        const auto index = random_() % open_orders_.size();
+        update = open_orders_[index];
+        if(random_() % 2) {
+            update.type_ = MarketUpdateType::MODIFY;
+            update.qty_ = static_cast<Qty>(1 + random_() % 100);
+            open_orders_[index].qty_ = update.qty_;
+        } else {
+            update.type_ = MarketUpdateType::CANCEL;
+            open_orders_[index] = open_orders_.back();
+            open_orders_.pop_back();
+        }
+        return update;
+    }
+
+    // returns false if the incremental was dropped
+    auto publish(const Exchange::MEMarketUpdate &update) {
+        const Exchange::MDPMarketUpdate mdp_update{next_seq_num_++, update};
+        applyUpdate(books_, update);
+        *snapshot_updates_.getNextToWriteTo() = mdp_update;
+        snapshot_updates_.updateWriteIndex();
+
+        if(drop_(random_) || cfg_.drop_seq_nums_.count(mdp_update.seq_num_)) {
+            ++dropped_;
+            return false;
+        }
+        while(!socket_.send(&mdp_update, sizeof(mdp_update))) {
+            socket_.sendPending();
+        }
+        return true;
+    }
+
+    // an update books ignore, so a consumer hears of a gap at the end of the flow
+    auto publishTrade() {
+        Exchange::MEMarketUpdate trade;
+        trade.type_ = Exchange::MarketUpdateType::TRADE;
+        return publish(trade);
+    }
+
+    auto flush() {
+        while(!socket_.sendPending()) {
+        }
+    }
+
+    auto pollSnapshots() {
+        synthesizer_.poll();
+    }
+
+    const StandInPublisherCfg cfg_;
+    MarketDataBooks books_;
+    vector<Exchange::MEMarketUpdate> open_orders_;
+    Exchange::OrderId next_order_id_ = 1;
+    uint64_t next_seq_num_ = 1;
+    size_t dropped_ = 0;
+
+    Common::McastSocket socket_;
+    Exchange::MDPMarketUpdateLFQueue snapshot_updates_;
+    Exchange::SnapshotSynthesizer synthesizer_;
+
+    mt19937_64 random_{42};
+    bernoulli_distribution drop_;
+};
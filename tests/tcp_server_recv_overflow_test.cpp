@@ -0,0 +1,99 @@
+#include "time_utils.h"
+#include "tcp_server.h"
+
+#include <arpa/inet.h>
+
+using namespace std;
+using namespace Common;
+
+// a client that sends far more than an io_uring TCPServer's recv_callback_ takes: while the callback consumes nothing the
+// connection must stop receiving with its overflow bounded, the client being pushed back on by TCP flow control instead,
+// and once the callback catches up every byte must arrive, in order, on the same connection
+// on a kernel without io_uring the server falls back to epoll, which has no overflow, and there is nothing to test
+
+constexpr size_t TOTAL_BYTES = 32 * 1024 * 1024;
+constexpr Nanos TIMEOUT = 30 * NANOS_TO_SECS;
+
+int main(int, char **) {
+    Logger logger("tcp_server_recv_overflow_test.log");
+
+    TCPServerCfg cfg;
+    cfg.backend_ = TCPServerBackend::IO_URING;
+    TCPServer server(logger, 1, cfg);
+
+    bool stalled = true;
+    size_t received = 0;
+    server.recv_callback_ = [&](TCPSocket *socket, Nanos) {
+        if(stalled) {
+            return;
+        }
+        auto &inbound = socket->inbound_data_;
+        const auto data = reinterpret_cast<const uint8_t *>(inbound.readPtr());
+        for(size_t i = 0; i < inbound.readable(); ++i, ++received) {
+            if(UNLIKELY(data[i] != static_cast<uint8_t>(received % 251))) {
+                FATAL("byte " + to_string(received) + " out of order");
+            }
+        }
+        inbound.consume(inbound.readable());
+    };
+    const int port = 12400;
+    server.listen("lo", port);
+    if(server.backend() != TCPServerBackend::IO_URING) {
+        cout << "io_uring unavailable, skipped" << endl;
+        return 0;
+    }
+
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{AF_INET, htons(port), {htonl(INADDR_LOOPBACK)}, {}};
+    ASSERT(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0, "connect() failed. error:" + string(strerror(errno)));
+    ASSERT(setNonBlocking(fd), "setNonBlocking() failed.");
+    // on loopback the client's send buffer drains in the server's own receive, as if the network were infinitely fast,
+    // keep it to what a remote client could have in flight
+    const int sndbuf = 64 * 1024;
+    ASSERT(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0, "SO_SNDBUF failed. error:" + string(strerror(errno)));
+
+    vector<uint8_t> pattern(251 * 256);
+    for(size_t i = 0; i < pattern.size(); ++i) {
+        pattern[i] = static_cast<uint8_t>(i % 251);
+    }
+
+    size_t sent = 0;
+    size_t max_overflow = 0;
+    bool paused = false;
+    TCPSocket *connection = nullptr;
+    const auto deadline = getCurrentNanos() + TIMEOUT;
+    while(received < TOTAL_BYTES && getCurrentNanos() < deadline) {
+        if(sent < TOTAL_BYTES) {
+            const auto offset = sent % 251;
+            const auto n = ::send(fd, pattern.data() + offset, min(pattern.size() - offset, TOTAL_BYTES - sent), 0);
+            if(n > 0) {
+                sent += static_cast<size_t>(n);
+            } else {
+                ASSERT(errno == EAGAIN || errno == EWOULDBLOCK, "client send() failed. error:" + string(strerror(errno)));
+                // the client is pushed back on, time for the callback to catch up
+                if(stalled && paused) {
+                    stalled = false;
+                }
+            }
+        }
+        server.poll();
+        server.sendAndRecv();
+
+        if(!connection && !server.connections_.empty()) {
+            connection = server.connections_.front();
+        }
+        if(connection) {
+            ASSERT(server.connections_.size() == 1 && server.connections_.front() == connection && !connection->disconnected_,
+                   "connection closed after " + to_string(received) + " bytes");
+            max_overflow = max(max_overflow, connection->io_uring_.overflow_->readable());
+            paused |= connection->io_uring_.recv_paused_;
+        }
+    }
+
+    ASSERT(paused, "receives never paused");
+    ASSERT(received == TOTAL_BYTES, "received " + to_string(received) + " of " + to_string(sent) + " bytes sent");
+    ASSERT(max_overflow <= cfg.recv_overflow_size_, "overflow grew to " + to_string(max_overflow) + " bytes");
+    cout << "received:" << received << " max_overflow:" << max_overflow << endl;
+    close(fd);
+    return 0;
+}
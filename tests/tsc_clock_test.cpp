@@ -0,0 +1,48 @@
+#include "tsc_clock.h"
+
+using namespace std;
+using namespace Common;
+
+// TSCClock recalibrated in the background as often as a caller would ever ask for: nanos() must never go backwards across
+// a recalibration, and must stay close to CLOCK_REALTIME
+
+constexpr Nanos RECALIBRATION_PERIOD = NANOS_TO_MILLIS;
+constexpr Nanos RUN_TIME = 500 * NANOS_TO_MILLIS;
+// the offset is at most what the frequency error builds up over a period or two before the slew takes it out
+constexpr Nanos MAX_OFFSET = 100 * NANOS_TO_MICROS;
+// nanos() is compared with CLOCK_REALTIME read just before and just after it, samples where the thread was preempted in
+// between and the two are further apart than this are skipped
+constexpr Nanos MAX_BRACKET = 5 * NANOS_TO_MICROS;
+
+int main(int, char **) {
+    auto &clock = TSCClock::instance();
+    clock.startRecalibrationThread(RECALIBRATION_PERIOD);
+
+    size_t reads = 0, samples = 0;
+    Nanos max_offset = 0;
+    auto last = clock.nanos();
+    for(const auto end = getCurrentNanos() + RUN_TIME; getCurrentNanos() < end;) {
+        for(int i = 0; i < 1000; ++i, ++reads) {
+            const auto now = clock.nanos();
+            if(UNLIKELY(now < last)) {
+                FATAL("nanos() went back " + to_string(last - now) + "ns after " + to_string(reads) + " reads");
+            }
+            last = now;
+        }
+
+        const auto before = getCurrentNanos();
+        const auto now = clock.nanos();
+        const auto after = getCurrentNanos();
+        if(after - before > MAX_BRACKET) {
+            continue;
+        }
+        ++samples;
+        max_offset = max(max_offset, (now < before ? before - now : (now > after ? now - after : 0)));
+    }
+
+    ASSERT(samples, "no sample of nanos() against CLOCK_REALTIME was taken within " + to_string(MAX_BRACKET) + "ns");
+    ASSERT(max_offset < MAX_OFFSET, "nanos() drifted " + to_string(max_offset) + "ns from CLOCK_REALTIME over " +
+           to_string(samples) + " samples");
+    cout << "reads:" << reads << " samples:" << samples << " max_offset_ns:" << max_offset << endl;
+    return 0;
+}
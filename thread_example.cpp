@@ -19,8 +19,8 @@ int main(){
     auto t2 = createAndStartThread(-1, "dummyFunction2", dummyFunction, 15, 51, true);
 
     cout<<"Main waiting for the threads to be done.\n";
-    t1->join();
-    t2->join();
+    t1.join();
+    t2.join();
     cout<<"Main exiting\n";
     return 0;
 }
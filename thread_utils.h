@@ -1,11 +1,26 @@
-#pragma once 
+#pragma once
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <atomic>
 #include <thread>
+#include <latch>
+#include <memory>
+#include <map>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <alloca.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 
+#include "macros.h"
+
 using namespace std;
 
 namespace Common {
@@ -13,33 +28,252 @@ namespace Common {
         cpu_set_t cpuset;
         CPU_ZERO(&cpuset);
         CPU_SET(core_id, &cpuset);
-        
-        return (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)==0);
+
+        // pthread calls return their error instead of setting errno
+        const auto error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        if(error) {
+            errno = error;
+        }
+        return (error == 0);
     }
-    template<typename T, typename... A>
-    inline auto createAndStartThread(int core_id, const string& name, T &&func, A &&... args) noexcept {
-        cout<<"Thread "<<name<<" started...\n";
-        atomic<bool> running(false), failed(false);
-        auto thread_body = [&] {
-            if(core_id >= 0 && !setThreadCore(core_id)){
-                cerr<<"Failed to set core affinity for "<<name<<" "<<pthread_self()<<" to "<<core_id<<endl;
-                failed = true;
-                return;
-            }
-            cout<<"Set core affinity for "<<name<<" "<<pthread_self()<<" to "<<core_id<<endl;
-            running = true;
-            forward<T>(func)((forward<A>(args))...);
+
+    // lets the calling thread run on any of cores, e.g. a set of isolcpus shared by several housekeeping threads
+    inline auto setThreadCores(const vector<int> &cores) noexcept {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for(auto core : cores) {
+            CPU_SET(core, &cpuset);
+        }
+
+        const auto error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        if(error) {
+            errno = error;
+        }
+        return (error == 0);
+    }
+
+    // small dense id for the calling thread, assigned on first use and never reused
+    // lets per-thread state live in a flat array indexed by thread instead of a map
+    inline auto getThreadIndex() noexcept -> size_t {
+        static atomic<size_t> next_thread_index = {0};
+        thread_local const size_t thread_index = next_thread_index.fetch_add(1, memory_order_relaxed);
+        return thread_index;
+    }
+
+    // locks every page the process has and will map into memory, so the hot path never takes a major fault or has a page
+    // swapped out from under it, process wide, call once at startup before allocating the big pools
+    // needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK
+    inline auto lockMemory() noexcept {
+        return (mlockall(MCL_CURRENT | MCL_FUTURE) == 0);
+    }
+
+    // "2,4-6" -> {2, 4, 5, 6}, the kernel's cpu list format (isolcpus=, /sys/devices/system/cpu/isolated), false if malformed
+    inline auto parseCpuList(const string &list, vector<int> *cores) noexcept -> bool {
+        stringstream ss(list);
+        string range;
+        while(getline(ss, range, ',')) {
+            if(range.empty()) {
+                continue;
+            }
+            char *end = nullptr;
+            const auto first = strtol(range.c_str(), &end, 10);
+            auto last = first;
+            if(*end == '-') {
+                last = strtol(end + 1, &end, 10);
+            }
+            if(*end != '\0' && *end != '\n') {
+                return false;
+            }
+            if(first < 0 || last < first || last >= CPU_SETSIZE) {
+                return false;
+            }
+            for(auto core = first; core <= last; ++core) {
+                cores->push_back(static_cast<int>(core));
+            }
+        }
+        return true;
+    }
+
+    // cores taken out of the scheduler's load balancing with isolcpus=, empty when there are none
+    inline auto isolatedCpus() noexcept -> vector<int> {
+        vector<int> cores;
+        ifstream file("/sys/devices/system/cpu/isolated");
+        string list;
+        if(file && getline(file, list)) {
+            parseCpuList(list, &cores);
+        }
+        return cores;
+    }
+
+    struct ThreadCfg {
+        // shows up in top / perf / gdb, the kernel keeps the first 15 characters
+        string name_;
+        // cores the thread may run on, empty leaves it to the scheduler
+        vector<int> cores_;
+        // SCHED_FIFO priority 1-99, 0 keeps the default time sharing policy; needs CAP_SYS_NICE or RLIMIT_RTPRIO
+        int fifo_priority_ = 0;
+        // stack touched before the thread body runs, so its first deep call does not fault pages in, and after
+        // lockMemory() they stay resident; keep it well below the thread's stack size (8MB by default)
+        size_t prefault_stack_bytes_ = 0;
+
+        auto toString() const {
+            stringstream ss;
+            ss << "ThreadCfg[name:" << name_ << " cores:";
+            for(size_t i = 0; i < cores_.size(); ++i) {
+                ss << (i ? "," : "") << cores_[i];
+            }
+            ss << " fifo_priority:" << fifo_priority_
+            << " prefault_stack_bytes:" << prefault_stack_bytes_
+            << "]";
+
+            return ss.str();
+        }
+    };
+
+    // which cores and priority each role of the process runs with, e.g. for the gateway, matching engine and logger
+    // threads, so the same binary is laid out per machine without a rebuild
+    // the spec is "role=cpulist[@fifo_priority];...", e.g. "gateway=2;engine=3@80;logger=isolated", where the cpu list
+    // "isolated" stands for the isolcpus= cores (none leaves the role unpinned); roles that are not mentioned run unpinned
+    // with the default policy
+    class CpuLayout final {
+        public:
+        CpuLayout() = default;
+
+        explicit CpuLayout(const string &spec) {
+            ASSERT(parse(spec), "Malformed cpu layout:" + spec);
+        }
+
+        // the process wide layout, read from LOW_LATENCY_CPU_LAYOUT on first use
+        static auto instance() noexcept -> const CpuLayout & {
+            static const CpuLayout layout(getenv("LOW_LATENCY_CPU_LAYOUT") ? getenv("LOW_LATENCY_CPU_LAYOUT") : "");
+            return layout;
+        }
+
+        auto parse(const string &spec) noexcept -> bool {
+            stringstream ss(spec);
+            string entry;
+            while(getline(ss, entry, ';')) {
+                if(entry.empty()) {
+                    continue;
+                }
+                const auto equals = entry.find('=');
+                if(equals == string::npos || equals == 0) {
+                    return false;
+                }
+                Role role;
+                auto cpus = entry.substr(equals + 1);
+                const auto at = cpus.find('@');
+                if(at != string::npos) {
+                    role.fifo_priority_ = atoi(cpus.c_str() + at + 1);
+                    cpus.resize(at);
+                    if(role.fifo_priority_ < 1 || role.fifo_priority_ > 99) {
+                        return false;
+                    }
+                }
+                if(cpus == "isolated") {
+                    role.cores_ = isolatedCpus();
+                } else if(!parseCpuList(cpus, &role.cores_)) {
+                    return false;
+                }
+                roles_[entry.substr(0, equals)] = role;
+            }
+            return true;
+        }
+
+        // how to start a thread of role, named name
+        auto threadCfg(const string &role, const string &name) const noexcept -> ThreadCfg {
+            ThreadCfg cfg;
+            cfg.name_ = name;
+            const auto it = roles_.find(role);
+            if(it != roles_.end()) {
+                cfg.cores_ = it->second.cores_;
+                cfg.fifo_priority_ = it->second.fifo_priority_;
+            }
+            return cfg;
+        }
+
+        auto toString() const {
+            stringstream ss;
+            ss << "CpuLayout[";
+            for(const auto &[role, cfg] : roles_) {
+                ss << role << ":" << threadCfg(role, "").toString() << " ";
+            }
+            ss << "]";
+
+            return ss.str();
+        }
+
+        private:
+        struct Role {
+            vector<int> cores_;
+            int fifo_priority_ = 0;
         };
-        auto t = new thread(thread_body);
-        while(!running && !failed){
-            using namespace literals::chrono_literals;
-            this_thread::sleep_for(1s);
+
+        map<string, Role> roles_;
+    };
+
+    // applies cfg to the calling thread, false and a message on cerr if any of it failed
+    inline auto setupThread(const ThreadCfg &cfg) noexcept -> bool {
+        // the name is best effort, it cannot fail in a way that matters to the thread
+        pthread_setname_np(pthread_self(), cfg.name_.substr(0, 15).c_str());
+        if(!cfg.cores_.empty() && !setThreadCores(cfg.cores_)) {
+            cerr << "Failed to set core affinity. " << cfg.toString() << " error:" << strerror(errno) << endl;
+            return false;
+        }
+        if(cfg.fifo_priority_) {
+            const sched_param param{cfg.fifo_priority_};
+            const auto error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if(error) {
+                cerr << "Failed to set SCHED_FIFO. " << cfg.toString() << " error:" << strerror(error) << endl;
+                return false;
+            }
         }
-        if(failed){
-            t->join();
-            delete t;
-            t = nullptr;
+        if(cfg.prefault_stack_bytes_) {
+            // the frame is popped on return, the pages it touched stay mapped
+            auto stack = static_cast<char *>(alloca(cfg.prefault_stack_bytes_));
+            memset(stack, 0, cfg.prefault_stack_bytes_);
+            asm volatile("" : : "r"(stack) : "memory");
         }
+        return true;
+    }
+
+    // starts func(args...) on a new thread set up with cfg, and returns once it is running, in microseconds: the new
+    // thread releases a latch (a futex wait) as soon as it is set up
+    // func and args are moved or copied into the thread, nothing of the caller's is referenced once this returns
+    // the handle owns the thread and joins it when destroyed, it is empty (not joinable) if the setup failed
+    template<typename T, typename... A>
+    inline auto createAndStartThread(const ThreadCfg &cfg, T &&func, A &&... args) noexcept -> jthread {
+        // shared with the new thread, which may still be inside count_down() when the caller's wait() returns
+        struct StartState {
+            latch started_{1};
+            bool ok_ = false;
+        };
+        auto state = make_shared<StartState>();
+        jthread t([state, cfg, func = forward<T>(func), ...args = forward<A>(args)]() mutable {
+            state->ok_ = setupThread(cfg);
+            const auto ok = state->ok_;
+            state->started_.count_down();
+            if(ok) {
+                func(std::move(args)...);
+            }
+        });
+        state->started_.wait();
+        if(!state->ok_) {
+            t.join();
+            return jthread();
+        }
+        cerr << "Thread " << cfg.name_ << " started. " << cfg.toString() << endl;
         return t;
     }
-}
\ No newline at end of file
+
+    // pinned to core_id, or unpinned for -1
+    template<typename T, typename... A>
+    inline auto createAndStartThread(int core_id, const string& name, T &&func, A &&... args) noexcept -> jthread {
+        ThreadCfg cfg;
+        cfg.name_ = name;
+        if(core_id >= 0) {
+            cfg.cores_.push_back(core_id);
+        }
+        return createAndStartThread(cfg, forward<T>(func), forward<A>(args)...);
+    }
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <ctime>
+#include <cpuid.h>
+#include <x86intrin.h>
+
+#include "macros.h"
+#include "time_utils.h"
+
+using namespace std;
+
+// timestamps from the CPU's time stamp counter instead of a clock_gettime() / chrono call
+// reading the TSC costs a handful of nanoseconds, converting it is a multiply and an add
+// at startup the TSC frequency is measured against CLOCK_MONOTONIC_RAW (which NTP does not slew) and the result is anchored
+// to CLOCK_REALTIME, so nanos() returns nanoseconds since epoch comparable with getCurrentNanos() and kernel timestamps
+// recalibrate() re-measures the frequency over the whole time since startup and slews nanos() toward CLOCK_REALTIME, call it
+// periodically (startRecalibrationThread(), or from an existing background thread) to correct drift
+// nanos() never jumps and never goes backwards: an offset from CLOCK_REALTIME is taken out over about one recalibration
+// period by running at most MAX_SLEW_RATE fast or slow, so a step of the system clock is followed gradually, as adjtime() does
+// on CPUs without an invariant TSC every call falls back to clock_gettime(CLOCK_REALTIME)
+
+namespace Common {
+    class TSCClock final {
+        public:
+        static auto instance() noexcept -> TSCClock & {
+            static TSCClock clock;
+            return clock;
+        }
+
+        // raw counter, may be reordered with surrounding loads and stores - fine for stamping events
+        static auto ticks() noexcept -> uint64_t {
+            return __rdtsc();
+        }
+
+        // waits for all earlier instructions to finish first, use to close a measured interval
+        static auto ticksOrdered() noexcept -> uint64_t {
+            unsigned aux;
+            return __rdtscp(&aux);
+        }
+
+        // nanoseconds since epoch
+        auto nanos() const noexcept -> Nanos {
+            if(UNLIKELY(!invariant_tsc_)) {
+                return clockNanos(CLOCK_REALTIME);
+            }
+            return ticksToEpochNanos(ticks());
+        }
+
+        auto ticksToEpochNanos(uint64_t tsc) const noexcept -> Nanos {
+            while(true) {
+                const auto version = version_.load(memory_order_acquire);
+                const auto base_ticks = base_ticks_.load(memory_order_relaxed);
+                const auto base_nanos = base_nanos_.load(memory_order_relaxed);
+                const auto nanos_per_tick = nanos_per_tick_.load(memory_order_relaxed);
+                const auto slew_ticks = slew_ticks_.load(memory_order_relaxed);
+                const auto slew_per_tick = slew_per_tick_.load(memory_order_relaxed);
+                atomic_thread_fence(memory_order_acquire);
+                if(LIKELY(!(version & 1) && version == version_.load(memory_order_relaxed))) {
+                    const auto elapsed = static_cast<int64_t>(tsc - base_ticks);
+                    const auto slewed = clamp<int64_t>(elapsed, 0, slew_ticks);
+                    return base_nanos + static_cast<Nanos>(static_cast<double>(elapsed) * nanos_per_tick +
+                                                           static_cast<double>(slewed) * slew_per_tick);
+                }
+            }
+        }
+
+        // length of an interval measured in ticks, at the measured frequency without any slew
+        auto ticksToNanos(uint64_t ticks) const noexcept -> Nanos {
+            return static_cast<Nanos>(static_cast<double>(ticks) * nanos_per_tick_.load(memory_order_relaxed));
+        }
+
+        auto nanosPerTick() const noexcept {
+            return nanos_per_tick_.load(memory_order_relaxed);
+        }
+
+        auto isInvariantTSC() const noexcept {
+            return invariant_tsc_;
+        }
+
+        // re-measures the TSC frequency against CLOCK_MONOTONIC_RAW since construction, and continues nanos() from where
+        // it is now with a slew that takes out its offset from CLOCK_REALTIME over the time since the last call
+        // only one thread may call this at a time
+        auto recalibrate() noexcept -> void {
+            const auto [tsc, monotonic_raw, realtime] = sample();
+            const auto nanos_per_tick = static_cast<double>(monotonic_raw - start_monotonic_raw_) / static_cast<double>(tsc - start_ticks_);
+
+            // the first calibration anchors to CLOCK_REALTIME, there is nothing to be continuous with yet
+            auto base_nanos = realtime;
+            uint64_t slew_ticks = 0;
+            double slew_per_tick = 0;
+            if(LIKELY(last_recalibration_ticks_)) {
+                base_nanos = ticksToEpochNanos(tsc);
+                const auto offset = static_cast<double>(realtime - base_nanos);
+                const auto period = static_cast<double>(tsc - last_recalibration_ticks_) * nanos_per_tick;
+                const auto slew_rate = clamp(offset / period, -MAX_SLEW_RATE, MAX_SLEW_RATE);
+                if(slew_rate != 0) {
+                    slew_per_tick = slew_rate * nanos_per_tick;
+                    slew_ticks = static_cast<uint64_t>(offset / slew_per_tick);
+                }
+            }
+            last_recalibration_ticks_ = tsc;
+
+            const auto version = version_.load(memory_order_relaxed);
+            version_.store(version + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            base_ticks_.store(tsc, memory_order_relaxed);
+            base_nanos_.store(base_nanos, memory_order_relaxed);
+            nanos_per_tick_.store(nanos_per_tick, memory_order_relaxed);
+            slew_ticks_.store(slew_ticks, memory_order_relaxed);
+            slew_per_tick_.store(slew_per_tick, memory_order_relaxed);
+            version_.store(version + 2, memory_order_release);
+        }
+
+        // recalibrates every period on a background thread until the clock is destroyed
+        auto startRecalibrationThread(Nanos period) -> void {
+            ASSERT(!recalibration_thread_.joinable(), "TSCClock recalibration thread already running.");
+            recalibration_thread_ = thread([this, period]() {
+                while(running_.load(memory_order_relaxed)) {
+                    // sleep in small steps so shutdown does not wait for a whole period.
+                    for(Nanos slept = 0; slept < period && running_.load(memory_order_relaxed); slept += NANOS_TO_MILLIS) {
+                        this_thread::sleep_for(chrono::milliseconds(1));
+                    }
+                    recalibrate();
+                }
+            });
+        }
+
+        ~TSCClock() {
+            running_ = false;
+            if(recalibration_thread_.joinable()) {
+                recalibration_thread_.join();
+            }
+        }
+
+        TSCClock(const TSCClock &) = delete;
+
+        TSCClock(const TSCClock &&) = delete;
+
+        TSCClock &operator=(const TSCClock &) = delete;
+
+        TSCClock &operator=(const TSCClock &&) = delete;
+
+        private:
+        // measures the TSC frequency over CALIBRATION_TIME
+        static constexpr Nanos CALIBRATION_TIME = 10 * NANOS_TO_MILLIS;
+        // fastest nanos() runs ahead of or behind the TSC frequency while taking out an offset, the 500ppm adjtime() slews
+        // at plus headroom for NTP's own frequency correction of CLOCK_REALTIME
+        static constexpr double MAX_SLEW_RATE = 0.001;
+
+        TSCClock() : invariant_tsc_(hasInvariantTSC()) {
+            const auto start = sample();
+            start_ticks_ = start.ticks_;
+            start_monotonic_raw_ = start.monotonic_raw_;
+            while(clockNanos(CLOCK_MONOTONIC_RAW) - start_monotonic_raw_ < CALIBRATION_TIME) {
+            }
+            recalibrate();
+        }
+
+        static auto clockNanos(clockid_t clock_id) noexcept -> Nanos {
+            timespec ts;
+            clock_gettime(clock_id, &ts);
+            return ts.tv_sec * NANOS_TO_SECS + ts.tv_nsec;
+        }
+
+        static auto hasInvariantTSC() noexcept -> bool {
+            unsigned eax, ebx, ecx, edx;
+            return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8));
+        }
+
+        struct Sample {
+            uint64_t ticks_;
+            Nanos monotonic_raw_;
+            Nanos realtime_;
+        };
+
+        // reads the clocks several times and keeps the reading with the least time between the two TSC reads around them
+        static auto sample() noexcept -> Sample {
+            Sample best{};
+            uint64_t best_window = UINT64_MAX;
+            for(int i = 0; i < 16; ++i) {
+                const auto before = ticksOrdered();
+                const auto monotonic_raw = clockNanos(CLOCK_MONOTONIC_RAW);
+                const auto realtime = clockNanos(CLOCK_REALTIME);
+                const auto after = ticksOrdered();
+                if(after - before < best_window) {
+                    best_window = after - before;
+                    best = {before + (after - before) / 2, monotonic_raw, realtime};
+                }
+            }
+            return best;
+        }
+
+        const bool invariant_tsc_;
+        uint64_t start_ticks_ = 0;
+        Nanos start_monotonic_raw_ = 0;
+        uint64_t last_recalibration_ticks_ = 0;
+
+        // conversion parameters, published under a sequence lock: odd version_ means an update is in progress.
+        atomic<uint64_t> version_ = {0};
+        atomic<uint64_t> base_ticks_ = {0};
+        atomic<Nanos> base_nanos_ = {0};
+        atomic<double> nanos_per_tick_ = {0};
+        // nanos() runs slew_per_tick_ nanos per tick fast (or slow, if negative) for the first slew_ticks_ after base_ticks_
+        atomic<uint64_t> slew_ticks_ = {0};
+        atomic<double> slew_per_tick_ = {0};
+
+        atomic<bool> running_ = {true};
+        thread recalibration_thread_;
+    };
+
+    // TSC based replacement for getCurrentNanos() on hot paths
+    inline auto getTSCNanos() noexcept {
+        return TSCClock::instance().nanos();
+    }
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "macros.h"
+#include "mem_utils.h"
+
+using namespace std;
+
+// minimal io_uring wrapper on the raw syscalls (we do not depend on liburing)
+// one submission and one completion ring shared with the kernel, a sparse registered file table, and one ring of provided
+// buffers (buffer group 0) that multishot receives pick their buffers from
+// single threaded: the owning thread fills SQEs, submits and reaps, the kernel side is synchronized through acquire/release
+// on the ring indices
+// with sqpoll a kernel thread picks up submissions by itself, so in steady state submit() makes no syscall at all
+// construction never fails hard, isValid() is false when the kernel does not support what we need and the caller falls back
+
+namespace Common {
+    class IOURing final {
+        public:
+        IOURing(unsigned entries, bool sqpoll, int sqpoll_cpu) {
+            io_uring_params params{};
+            if(sqpoll) {
+                params.flags |= IORING_SETUP_SQPOLL;
+                params.sq_thread_idle = 1000; // ms the kernel thread spins before it needs a wakeup.
+                if(sqpoll_cpu >= 0) {
+                    params.flags |= IORING_SETUP_SQ_AFF;
+                    params.sq_thread_cpu = static_cast<unsigned>(sqpoll_cpu);
+                }
+            }
+            ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if(ring_fd_ < 0) {
+                return;
+            }
+            sqpoll_ = sqpoll;
+
+            sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if(params.features & IORING_FEAT_SINGLE_MMAP) {
+                sq_ring_size_ = cq_ring_size_ = max(sq_ring_size_, cq_ring_size_);
+            }
+            sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+            cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring_ :
+                       mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+            if(sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+                sq_ring_ = (sq_ring_ == MAP_FAILED ? nullptr : sq_ring_);
+                cq_ring_ = (cq_ring_ == MAP_FAILED ? nullptr : cq_ring_);
+                sqes_ = (sqes_ == MAP_FAILED ? nullptr : sqes_);
+                return;
+            }
+
+            auto sq = static_cast<char *>(sq_ring_);
+            sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+            sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            sq_flags_ = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+            sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            sq_entries_ = params.sq_entries;
+
+            auto cq = static_cast<char *>(cq_ring_);
+            cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+            cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+
+            // slot i of the submission array always points at SQE i, so it is filled once here
+            for(unsigned i = 0; i < sq_entries_; ++i) {
+                sq_array_[i] = i;
+            }
+            sqe_tail_ = submitted_tail_ = *sq_tail_;
+            valid_ = true;
+        }
+
+        ~IOURing() {
+            if(ring_fd_ >= 0) {
+                close(ring_fd_);
+            }
+            if(sqes_) {
+                munmap(sqes_, sqes_size_);
+            }
+            if(cq_ring_ && cq_ring_ != sq_ring_) {
+                munmap(cq_ring_, cq_ring_size_);
+            }
+            if(sq_ring_) {
+                munmap(sq_ring_, sq_ring_size_);
+            }
+            if(buffer_ring_) {
+                munmap(buffer_ring_, buffer_ring_size_);
+                freeStorage(buffers_, buffer_size_ * num_buffers_, HUGE_PAGE_SIZE, buffers_cfg_);
+            }
+        }
+
+        auto isValid() const noexcept {
+            return valid_;
+        }
+
+        auto isSQPoll() const noexcept {
+            return sqpoll_;
+        }
+
+        // a zeroed SQE to fill, submitting what is queued if the ring is full, nullptr if it stays full
+        auto getSqe() noexcept -> io_uring_sqe * {
+            if(UNLIKELY(sqe_tail_ - atomic_ref<unsigned>(*sq_head_).load(memory_order_acquire) == sq_entries_)) {
+                submit(false);
+                if(sqe_tail_ - atomic_ref<unsigned>(*sq_head_).load(memory_order_acquire) == sq_entries_) {
+                    return nullptr;
+                }
+            }
+            auto sqe = &sqes_[sqe_tail_++ & sq_mask_];
+            memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+
+        // hands the queued SQEs to the kernel, with get_events also runs pending completion work so reap() sees it
+        // with sqpoll this only enters the kernel when the poll thread went idle and has to be woken up
+        auto submit(bool get_events) noexcept -> void {
+            const auto to_submit = sqe_tail_ - submitted_tail_;
+            if(to_submit) {
+                atomic_ref<unsigned>(*sq_tail_).store(sqe_tail_, memory_order_release);
+                submitted_tail_ = sqe_tail_;
+            }
+            unsigned flags = (get_events ? IORING_ENTER_GETEVENTS : 0);
+            if(sqpoll_) {
+                // the poll thread sets NEED_WAKEUP before sleeping, the fence orders our tail store before that check
+                atomic_thread_fence(memory_order_seq_cst);
+                if(!(atomic_ref<unsigned>(*sq_flags_).load(memory_order_relaxed) & IORING_SQ_NEED_WAKEUP)) {
+                    return;
+                }
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            } else if(!to_submit && !get_events) {
+                return;
+            }
+            syscall(__NR_io_uring_enter, ring_fd_, sqpoll_ ? 0 : to_submit, 0, flags, nullptr, 0);
+        }
+
+        // calls f(const io_uring_cqe &) for every completion available, returns how many there were
+        template<typename F>
+        auto reap(F &&f) noexcept {
+            auto head = *cq_head_;
+            const auto tail = atomic_ref<unsigned>(*cq_tail_).load(memory_order_acquire);
+            const auto count = tail - head;
+            for(; head != tail; ++head) {
+                f(cqes_[head & cq_mask_]);
+            }
+            atomic_ref<unsigned>(*cq_head_).store(head, memory_order_release);
+            return count;
+        }
+
+        // a registered file table of num_files empty slots, filled with updateFile()
+        auto registerFiles(unsigned num_files) noexcept -> bool {
+            vector<int> fds(num_files, -1);
+            return syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_FILES, fds.data(), num_files) == 0;
+        }
+
+        auto updateFile(unsigned index, int fd) noexcept -> bool {
+            io_uring_files_update update{};
+            update.offset = index;
+            update.fds = reinterpret_cast<uint64_t>(&fd);
+            return syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+        }
+
+        // num_buffers (a power of two up to 32768) buffers of buffer_size bytes the kernel picks from for buffer group 0
+        auto registerBuffers(unsigned num_buffers, size_t buffer_size, const StorageCfg &storage_cfg) -> bool {
+            const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            buffer_ring_size_ = (num_buffers * sizeof(io_uring_buf) + page_size - 1) / page_size * page_size;
+            auto ring = mmap(nullptr, buffer_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+            if(ring == MAP_FAILED) {
+                return false;
+            }
+            io_uring_buf_reg reg{};
+            reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+            reg.ring_entries = num_buffers;
+            reg.bgid = 0;
+            if(syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+                munmap(ring, buffer_ring_size_);
+                return false;
+            }
+            buffer_ring_ = static_cast<io_uring_buf_ring *>(ring);
+            num_buffers_ = num_buffers;
+            buffer_size_ = buffer_size;
+            buffers_cfg_ = storage_cfg;
+            buffers_ = static_cast<char *>(allocateStorage(buffer_size * num_buffers, HUGE_PAGE_SIZE, storage_cfg, &buffers_info_));
+            for(unsigned i = 0; i < num_buffers; ++i) {
+                addBuffer(static_cast<uint16_t>(i), i);
+            }
+            atomic_ref<uint16_t>(buffer_ring_->tail).store(static_cast<uint16_t>(num_buffers), memory_order_release);
+            buffer_tail_ = static_cast<uint16_t>(num_buffers);
+            return true;
+        }
+
+        auto buffer(uint16_t buffer_id) const noexcept -> const char * {
+            return buffers_ + static_cast<size_t>(buffer_id) * buffer_size_;
+        }
+
+        // gives a buffer the kernel filled back to it
+        auto recycleBuffer(uint16_t buffer_id) noexcept {
+            addBuffer(buffer_id, 0);
+            atomic_ref<uint16_t>(buffer_ring_->tail).store(++buffer_tail_, memory_order_release);
+        }
+
+        auto buffersStorageInfo() const noexcept -> const StorageInfo & {
+            return buffers_info_;
+        }
+
+        IOURing() = delete;
+
+        IOURing(const IOURing &) = delete;
+
+        IOURing(const IOURing &&) = delete;
+
+        IOURing &operator=(const IOURing &) = delete;
+
+        IOURing &operator=(const IOURing &&) = delete;
+
+        private:
+        auto addBuffer(uint16_t buffer_id, unsigned offset) noexcept -> void {
+            // the ring is an array of io_uring_buf whose first entry overlaps the tail, indexed by hand since in C++ the
+            // header's flexible bufs member does not start at offset 0
+            auto &buf = reinterpret_cast<io_uring_buf *>(buffer_ring_)[(buffer_tail_ + offset) & (num_buffers_ - 1)];
+            buf.addr = reinterpret_cast<uint64_t>(buffer(buffer_id));
+            buf.len = static_cast<uint32_t>(buffer_size_);
+            buf.bid = buffer_id;
+        }
+
+        int ring_fd_ = -1;
+        bool valid_ = false;
+        bool sqpoll_ = false;
+
+        void *sq_ring_ = nullptr;
+        void *cq_ring_ = nullptr;
+        size_t sq_ring_size_ = 0;
+        size_t cq_ring_size_ = 0;
+        io_uring_sqe *sqes_ = nullptr;
+        size_t sqes_size_ = 0;
+
+        // submission ring, head is advanced by the kernel
+        unsigned *sq_head_ = nullptr;
+        unsigned *sq_tail_ = nullptr;
+        unsigned *sq_flags_ = nullptr;
+        unsigned *sq_array_ = nullptr;
+        unsigned sq_mask_ = 0;
+        unsigned sq_entries_ = 0;
+        // SQEs handed out, and how far the kernel has been told about them
+        unsigned sqe_tail_ = 0;
+        unsigned submitted_tail_ = 0;
+
+        // completion ring, tail is advanced by the kernel
+        unsigned *cq_head_ = nullptr;
+        unsigned *cq_tail_ = nullptr;
+        io_uring_cqe *cqes_ = nullptr;
+        unsigned cq_mask_ = 0;
+
+        // provided buffers
+        io_uring_buf_ring *buffer_ring_ = nullptr;
+        size_t buffer_ring_size_ = 0;
+        uint16_t buffer_tail_ = 0;
+        unsigned num_buffers_ = 0;
+        size_t buffer_size_ = 0;
+        char *buffers_ = nullptr;
+        StorageCfg buffers_cfg_;
+        StorageInfo buffers_info_;
+    };
+}